@@ -0,0 +1,71 @@
+#!/bin/bash
+# Run time of the same programs built by the native backend and by --emit=c (cc -O2):
+# arithmetic in a counted loop, a subroutine called in a loop, and the `@` array.
+# usage: bench/c_bench.sh <path/to/tinyb> [iterations] [-- tinyb options]
+
+TINYB=${1:?path to tinyb}
+shift
+N=10000000
+if [ $# -gt 0 ] && [ "$1" != "--" ]; then
+    N=$1
+    shift
+fi
+[ "$1" = "--" ] && shift
+
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+cat > "$WORK/arith.bas" <<BAS
+10 LET I = 0
+20 LET S = 0
+30 LET S = S + I * 7 / 3 - I / 5
+40 LET I = I + 1
+50 IF I < $N THEN GOTO 30
+60 PRINT S
+BAS
+
+cat > "$WORK/gosub.bas" <<BAS
+10 LET I = 0
+20 LET S = 0
+30 GOSUB 100
+40 LET I = I + 1
+50 IF I < $N THEN GOTO 30
+60 PRINT S
+70 END
+100 LET S = S + I * 3 / 7
+110 RETURN
+BAS
+
+cat > "$WORK/array.bas" <<BAS
+10 LET I = 0
+20 LET @(I - I / 1000 * 1000) = @(I - I / 1000 * 1000) + I
+30 LET I = I + 1
+40 IF I < $N THEN GOTO 20
+50 PRINT @(999)
+BAS
+
+ms() {  # <executable>, best of 3 runs; its output goes to <executable>.out
+    local best= start took
+    for run in 1 2 3; do
+        start=$(date +%s%N)
+        "$1" > "$1.out" || return 1
+        took=$(( ($(date +%s%N) - start) / 1000000 ))
+        if [ -z "$best" ] || [ "$took" -lt "$best" ]; then
+            best=$took
+        fi
+    done
+    echo "$best"
+}
+
+for prog in arith gosub array; do
+    "$TINYB" "$WORK/$prog.bas" -o "$WORK/$prog.native" "$@" || exit 1
+    "$TINYB" "$WORK/$prog.bas" -o "$WORK/$prog.c" --emit=c "$@" || exit 1
+
+    native=$(ms "$WORK/$prog.native") || exit 1
+    c=$(ms "$WORK/$prog.c") || exit 1
+    if ! cmp -s "$WORK/$prog.native.out" "$WORK/$prog.c.out"; then
+        echo "$prog: the outputs differ"
+        exit 1
+    fi
+    echo "$prog: native $native ms, --emit=c $c ms"
+done
@@ -0,0 +1,82 @@
+#!/bin/bash
+# Evaluations per second of a program run as a process of its own (fork/exec of the executable)
+# against the same program as a shared library called in-process through tinyb_run.
+# usage: bench/embed_bench.sh <path/to/tinyb> [runs]   (CC is the C compiler of the host)
+
+TINYB=${1:?path to tinyb}
+RUNS=${2:-2000}
+INCLUDE=$(cd "$(dirname "$0")/../include" && pwd)
+
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+cat > "$WORK/prog.bas" <<'EOF'
+5 LET N = 0
+10 INPUT N
+20 LET S = 0
+30 LET I = 1
+40 LET S = S + I * I
+50 LET I = I + 1
+60 IF I <= N THEN GOTO 40
+70 PRINT S
+EOF
+
+cat > "$WORK/host.c" <<'EOF'
+#include <dlfcn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "tinyb.h"
+
+static int64_t sum;
+static void print_number(void* user, int64_t value) { sum += value; }
+static void print_text(void* user, const char* text, size_t size) {}
+static int input_number(void* user, int64_t* value) { *value = *(int64_t*)user; return 1; }
+
+int main(int argc, char* argv[]) {
+    void* lib = dlopen(argv[1], RTLD_NOW);
+    if (!lib) {
+        fprintf(stderr, "%s\n", dlerror());
+        return 1;
+    }
+    int (*run)(tinyb_ctx*) = (int (*)(tinyb_ctx*))dlsym(lib, "tinyb_run");
+    int runs = atoi(argv[2]);
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < runs; i++) {
+        int64_t n = 100 + i % 7;
+        tinyb_ctx ctx = {.user = &n, .print_number = print_number, .print_text = print_text, .input_number = input_number};
+        if (run(&ctx) != TINYB_OK)
+            return 1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    long ns = (end.tv_sec - start.tv_sec) * 1000000000L + end.tv_nsec - start.tv_nsec;
+    printf("%ld %lld\n", ns / 1000, (long long)sum);
+    return 0;
+}
+EOF
+
+"$TINYB" "$WORK/prog.bas" -o "$WORK/prog" || exit 1
+"$TINYB" "$WORK/prog.bas" -o "$WORK/prog.so" --emit=shared || exit 1
+${CC:-cc} -O2 -I"$INCLUDE" "$WORK/host.c" -o "$WORK/host" -ldl || exit 1
+
+rate() {  # <label> <us>
+    echo "$1: $RUNS runs in $(( $2 / 1000 )) ms, $(( RUNS * 1000000 / ($2 > 0 ? $2 : 1) )) runs/s"
+}
+
+start=$(date +%s%N)
+sum=0
+for ((i = 0; i < RUNS; i++)); do
+    sum=$(( sum + $(echo $(( 100 + i % 7 )) | "$WORK/prog") ))
+done
+rate "fork/exec" $(( ($(date +%s%N) - start) / 1000 ))
+
+read -r us lib_sum <<< "$("$WORK/host" "$WORK/prog.so" "$RUNS")"
+rate "shared library" "$us"
+
+if [ "$sum" != "$lib_sum" ]; then
+    echo "the outputs differ"
+    exit 1
+fi
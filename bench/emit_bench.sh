@@ -0,0 +1,40 @@
+#!/bin/bash
+# Compile time of a generated program of many lines, with nasm and ld stubbed out,
+# so it is the time of tinyb itself: lexing, parsing, code generation and writing the .asm.
+# usage: bench/emit_bench.sh <path/to/tinyb> [lines] [runs]
+
+TINYB=${1:?path to tinyb}
+LINES=${2:-1000000}
+RUNS=${3:-5}
+
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+mkdir "$WORK/bin"
+for tool in nasm ld; do
+    printf '#!/bin/sh\nexit 0\n' > "$WORK/bin/$tool"
+    chmod +x "$WORK/bin/$tool"
+done
+
+# arithmetic, strings, jumps and subroutines, in the proportions of ordinary programs
+awk -v lines="$LINES" 'BEGIN {
+    print "LET A = 1"; print "LET B = 2"; print "LET C = 3"
+    for (i = 1; i <= lines - 4; i++) {
+        n = i * 10
+        if (i % 4 == 0)      print n " LET A = A * 3 + B / 2 - C"
+        else if (i % 4 == 1) print n " PRINT \"A = \", A"
+        else if (i % 4 == 2) print n " IF A > " i " THEN LET B = B + 1"
+        else                 print n " LET C = (A + B) * (C - " i ")"
+    }
+    print "END"
+}' > "$WORK/big.bas"
+
+best=
+for ((i = 0; i < RUNS; i++)); do
+    start=$(date +%s%N)
+    PATH="$WORK/bin:$PATH" "$TINYB" "$WORK/big.bas" -o "$WORK/out" --keep-temps || exit 1
+    ms=$(( ($(date +%s%N) - start) / 1000000 ))
+    [ -z "$best" ] || [ "$ms" -lt "$best" ] && best=$ms
+done
+
+echo "$LINES lines, $(stat -c %s "$WORK/out.asm") bytes of assembly: best of $RUNS runs ${best} ms"
@@ -0,0 +1,88 @@
+#!/bin/bash
+# Differential test and run time of --int32 against the default 64-bit code: every program is built
+# both ways and run on the same input (<prog>.in next to it, if there is one), their outputs and exit
+# codes have to be the same unless a value leaves 32 bits. Without programs it runs arithmetic,
+# division and `@` array loops of 32-bit values.
+# usage: bench/int32_bench.sh <path/to/tinyb> [prog.bas...] [-- tinyb options]
+
+TINYB=${1:?path to tinyb}
+shift
+
+PROGS=()
+while [ $# -gt 0 ] && [ "$1" != "--" ]; do
+    PROGS+=("$1")
+    shift
+done
+[ "$1" = "--" ] && shift
+
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+if [ ${#PROGS[@]} -eq 0 ]; then
+    N=10000000
+
+    cat > "$WORK/arith.bas" <<BAS
+10 LET I = 0
+20 LET S = 0
+30 LET S = S + I * 7 - I / 5
+35 LET S = S - S / 1000000 * 1000000
+40 LET I = I + 1
+50 IF I < $N THEN GOTO 30
+60 PRINT S
+BAS
+
+    cat > "$WORK/divide.bas" <<BAS
+10 LET I = 1
+20 LET S = 0
+30 LET S = (S + I) / 3 + I / 7
+40 LET I = I + 1
+50 IF I < $N THEN GOTO 30
+60 PRINT S
+BAS
+
+    cat > "$WORK/array.bas" <<BAS
+10 LET I = 0
+20 LET @(I - I / 4096 * 4096) = @(I - I / 4096 * 4096) + I / 4096
+30 LET I = I + 1
+40 IF I < $N THEN GOTO 20
+50 PRINT @(4095)
+BAS
+
+    PROGS=("$WORK/arith.bas" "$WORK/divide.bas" "$WORK/array.bas")
+fi
+
+ms() {  # <executable> <input>, best of 3 runs; its output and exit code go to <executable>.out
+    local best= start took
+    for run in 1 2 3; do
+        start=$(date +%s%N)
+        "$1" < "$2" > "$1.out" 2>&1
+        echo "exit $?" >> "$1.out"
+        took=$(( ($(date +%s%N) - start) / 1000000 ))
+        if [ -z "$best" ] || [ "$took" -lt "$best" ]; then
+            best=$took
+        fi
+    done
+    echo "$best"
+}
+
+status=0
+for bas in "${PROGS[@]}"; do
+    prog=$(basename "$bas" .bas)
+    input="${bas%.bas}.in"
+    [ -f "$input" ] || input=/dev/null
+
+    "$TINYB" "$bas" -o "$WORK/$prog.64" "$@" || exit 1
+    "$TINYB" "$bas" -o "$WORK/$prog.32" --int32 "$@" || exit 1
+
+    t64=$(ms "$WORK/$prog.64" "$input")
+    t32=$(ms "$WORK/$prog.32" "$input")
+    if ! cmp -s "$WORK/$prog.64.out" "$WORK/$prog.32.out"; then
+        echo "$prog: the outputs differ"
+        diff "$WORK/$prog.64.out" "$WORK/$prog.32.out" | head -n 5
+        status=1
+        continue
+    fi
+    echo "$prog: 64-bit $t64 ms, --int32 $t32 ms"
+done
+
+exit $status
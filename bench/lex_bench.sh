@@ -0,0 +1,121 @@
+#!/bin/bash
+# Lexing rate of a generated program heavy on comments, strings and long names, measured on the
+# lexer alone: it is built into a small driver twice, with the SSE2 scans and with the byte at
+# a time fallback (TINYB_NO_SIMD), and both have to produce the same tokens. The scanning rate
+# is of the scans by themselves, walking the runs the lexer would without making tokens.
+# usage: bench/lex_bench.sh [lines] [runs]   (CXX and CXXFLAGS are passed to the compiler)
+
+LINES=${1:-1000000}
+RUNS=${2:-5}
+SRC=$(cd "$(dirname "$0")/../src" && pwd)
+
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+awk -v lines="$LINES" -v q="'" 'BEGIN {
+    for (i = 1; i <= lines; i++) {
+        n = i * 10
+        if (i % 4 == 0)      print n " LET COUNTER = COUNTER * 3 + BASE / 2   " q " scale the counter, keep the base"
+        else if (i % 4 == 1) print n " PRINT \"The value of the counter, after scaling it and adding half the base, is now:\\t\", COUNTER, \" (line " i ")\\n\""
+        else if (i % 4 == 2) print n " IF COUNTER > " i % 1000 * 7919 " THEN GOTO " n + 20 "          " q " skip ahead"
+        else                 print q " ------------------------------------------------------------------------"
+    }
+}' > "$WORK/big.bas"
+
+cat > "$WORK/lex.cpp" <<'EOF'
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include "lexer.hpp"
+#include "scan.hpp"
+
+// the runs the lexer takes, without making tokens of them
+static size_t scan_all(const std::string& source) {
+    const char* p = source.data();
+    const char* end = p + source.size();
+    size_t runs = 0;
+
+    while (p < end) {
+        const char* q = p + 1;
+        if (scan::is_alpha(*p)) {
+            q = p + scan::alpha(p, end);
+        } else if (scan::is_digit(*p)) {
+            q = p + scan::digits(p, end);
+        } else if (*p == ' ') {
+            q = p + scan::spaces(p, end);
+        } else if (*p == '\'') {
+            q = p + scan::to_newline(p, end);
+        } else if (*p == '"') {
+            while (q < end && *q != '"') {
+                q += scan::str_text(q, end);
+                if (q < end && *q == '\\')
+                    q = std::min(q + 2, end);
+            }
+            q = std::min(q + 1, end);
+        }
+        p = q;
+        runs++;
+    }
+    return runs;
+}
+
+int main(int argc, char* argv[]) {
+    std::ifstream input(argv[1]);
+    std::stringstream stream;
+    stream << input.rdbuf();
+    const std::string source = stream.str();
+
+    double best = 1e9, best_scan = 1e9;
+    uint64_t hash = 14695981039346656037ull;
+    size_t tokens = 0, runs = 0;
+
+    for (int run = 0; run < std::atoi(argv[2]); run++) {
+        auto start = std::chrono::steady_clock::now();
+        runs = scan_all(source);
+        best_scan = std::min(best_scan, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+
+        std::string code = source;
+        start = std::chrono::steady_clock::now();
+        auto result = Lexer{code}.gen_tokens();
+        best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+
+        if (run == 0) {
+            tokens = result.size();
+            auto mix = [&hash](uint64_t v) { hash = (hash ^ v) * 1099511628211ull; };
+            for (auto& token: result) {
+                mix(static_cast<uint64_t>(token.type));
+                mix(token.line);
+                for (char c: token.var.value_or(""))
+                    mix(static_cast<unsigned char>(c));
+            }
+        }
+    }
+
+    std::printf(
+        "%zu %016llx %zu %.2f %.2f\n", tokens, static_cast<unsigned long long>(hash), runs,
+        source.size() / best_scan / 1e9, source.size() / best / 1e9
+    );
+}
+EOF
+
+for mode in simd scalar; do
+    flags=""
+    [ "$mode" = scalar ] && flags="-DTINYB_NO_SIMD"
+    ${CXX:-g++} -std=c++20 -O2 $CXXFLAGS $flags -I"$SRC" "$WORK/lex.cpp" "$SRC/lexer.cpp" -o "$WORK/lex_$mode" || exit 1
+    read -r count hash runs scan rate <<< "$("$WORK/lex_$mode" "$WORK/big.bas" "$RUNS" 2> /dev/null)"
+    echo "$mode: scanning $scan GB/s ($runs runs), lexing $rate GB/s ($count tokens)"
+    eval "hash_$mode=$hash"
+done
+
+size=$(stat -c %s "$WORK/big.bas")
+echo "$LINES lines, $size bytes, best of $RUNS runs"
+if [ "$hash_simd" != "$hash_scalar" ]; then
+    echo "the tokens differ"
+    exit 1
+fi
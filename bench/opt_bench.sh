@@ -0,0 +1,66 @@
+#!/bin/bash
+# Compile time against run time at -O0, -O1 and -O2: every program is compiled and run at each level
+# (on <prog>.in next to it, if there is one), and all levels have to print the same. Without programs
+# it uses a loop of arithmetic on a counter and the `@` array.
+# usage: bench/opt_bench.sh <path/to/tinyb> [prog.bas...] [-- tinyb options]
+
+TINYB=${1:?path to tinyb}
+shift
+
+PROGS=()
+while [ $# -gt 0 ] && [ "$1" != "--" ]; do
+    PROGS+=("$1")
+    shift
+done
+[ "$1" = "--" ] && shift
+
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+if [ ${#PROGS[@]} -eq 0 ]; then
+    cat > "$WORK/loop.bas" <<BAS
+10 LET I = 0
+20 LET S = 0
+30 LET S = S + I * 7 / 3 - I / 5
+40 LET @(I - I / 1000 * 1000) = S
+50 LET I = I + 1
+60 IF I < 10000000 THEN GOTO 30
+70 PRINT S
+80 PRINT @(999)
+BAS
+    PROGS=("$WORK/loop.bas")
+fi
+
+best() {  # <command...>, the fastest of 3 runs in ms
+    local best= start took
+    for run in 1 2 3; do
+        start=$(date +%s%N)
+        "$@" || return 1
+        took=$(( ($(date +%s%N) - start) / 1000000 ))
+        if [ -z "$best" ] || [ "$took" -lt "$best" ]; then
+            best=$took
+        fi
+    done
+    echo "$best"
+}
+
+status=0
+for bas in "${PROGS[@]}"; do
+    prog=$(basename "$bas" .bas)
+    input="${bas%.bas}.in"
+    [ -f "$input" ] || input=/dev/null
+
+    for level in 0 1 2; do
+        exe="$WORK/$prog.O$level"
+        compile=$(best "$TINYB" "$bas" -o "$exe" -O$level "$@") || exit 1
+        run=$(best sh -c '"$1" < "$2" > "$1.out" 2>&1; echo "exit $?" >> "$1.out"' sh "$exe" "$input")
+
+        if [ $level -gt 0 ] && ! cmp -s "$WORK/$prog.O0.out" "$exe.out"; then
+            echo "$prog: -O$level prints something else than -O0"
+            status=1
+        fi
+        echo "$prog -O$level: compile $compile ms, run $run ms"
+    done
+done
+
+exit $status
@@ -0,0 +1,54 @@
+#!/bin/bash
+# Latency of RUN in `tinyb --repl` for programs of growing size: the first RUN compiles every line,
+# every RUN after an edit of one line should take about the same time however long the program is.
+# usage: bench/repl_bench.sh <path/to/tinyb> [sizes...] [-- tinyb options]   (default sizes 100 1000 10000)
+
+TINYB=${1:?path to tinyb}
+shift
+
+SIZES=()
+while [ $# -gt 0 ] && [ "$1" != "--" ]; do
+    SIZES+=("$1")
+    shift
+done
+[ "$1" = "--" ] && shift
+[ ${#SIZES[@]} -eq 0 ] && SIZES=(100 1000 10000)
+
+ms() {  # <start ns>
+    echo "$(( ($(date +%s%N) - $1) / 1000000 ))"
+}
+
+for lines in "${SIZES[@]}"; do
+    coproc REPL { "$TINYB" --repl "$@"; }
+
+    echo "5 LET S = 0" >&"${REPL[1]}"
+    for ((i = 1; i <= lines; i++)); do
+        echo "$(( i * 10 )) LET S = S + $i"
+    done >&"${REPL[1]}"
+    echo "$(( lines * 10 + 10 )) PRINT S" >&"${REPL[1]}"
+
+    start=$(date +%s%N)
+    echo RUN >&"${REPL[1]}"
+    read -r sum <&"${REPL[0]}"
+    first=$(ms "$start")
+
+    best=
+    for edit in 1 2 3 4 5; do
+        start=$(date +%s%N)
+        printf '20 LET S = S + %d\nRUN\n' $(( 2 + edit )) >&"${REPL[1]}"
+        read -r sum <&"${REPL[0]}"
+        took=$(ms "$start")
+        if [ -z "$best" ] || [ "$took" -lt "$best" ]; then
+            best=$took
+        fi
+    done
+
+    if [ "$sum" != "$(( lines * (lines + 1) / 2 + 5 ))" ]; then
+        echo "$lines lines: wrong sum $sum"
+        exit 1
+    fi
+    echo "$lines lines: first RUN $first ms, RUN after an edit $best ms"
+
+    exec {REPL[1]}>&-
+    wait
+done
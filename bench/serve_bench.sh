@@ -0,0 +1,32 @@
+#!/bin/bash
+# Requests per second of cold `tinyb` runs against a warm `tinyb --serve`.
+# usage: bench/serve_bench.sh <path/to/tinyb> <source.bas> [requests]
+
+TINYB=${1:?path to tinyb}
+SOURCE=${2:?source file}
+REQUESTS=${3:-200}
+
+WORK=$(mktemp -d)
+SOCKET="$WORK/tinyb.sock"
+trap 'kill $SERVER 2>/dev/null; rm -rf "$WORK"' EXIT
+
+rate() {  # <label> <start ns> <end ns>
+    local ms=$(( ($3 - $2) / 1000000 ))
+    echo "$1: $REQUESTS requests in ${ms} ms, $(( REQUESTS * 1000 / (ms > 0 ? ms : 1) )) req/s"
+}
+
+start=$(date +%s%N)
+for ((i = 0; i < REQUESTS; i++)); do
+    "$TINYB" "$SOURCE" -o "$WORK/cold" || exit 1
+done
+rate "cold" $start $(date +%s%N)
+
+"$TINYB" --serve="$SOCKET" 2>/dev/null &
+SERVER=$!
+while [ ! -S "$SOCKET" ]; do sleep 0.01; done
+
+start=$(date +%s%N)
+for ((i = 0; i < REQUESTS; i++)); do
+    "$TINYB" --connect="$SOCKET" "$SOURCE" -o "$WORK/warm" || exit 1
+done
+rate "server" $start $(date +%s%N)
@@ -1,4 +1,4 @@
 #!/bin/bash
 
-nasm -g -felf64 out.asm
+nasm -g -F dwarf -felf64 out.asm
 ld -o out out.o -lc --dynamic-linker /lib64/ld-linux-x86-64.so.2
\ No newline at end of file
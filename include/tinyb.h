@@ -0,0 +1,46 @@
+#ifndef TINYB_H
+#define TINYB_H
+
+/*
+    A BASIC program compiled with `tinyb --emit=obj` or `--emit=shared` is
+    a C function of a tinyb_ctx, `tinyb_run` unless `--entry=<symbol>`
+    names it otherwise. It starts with the vars of the ctx, prints and
+    reads through its callbacks, and writes the vars back when it ends
+    (END or its last line). It keeps nothing between calls: any number of
+    threads can run it at once, each with a ctx of its own.
+
+        tinyb_ctx ctx = {.vars = {[0] = 10}, .print_number = ..., .print_text = ...};
+        if (tinyb_run(&ctx) != TINYB_OK)
+            fprintf(stderr, "%s\n", ctx.error);
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TINYB_OK 0
+#define TINYB_ERROR 2  /* a runtime error, the vars of the ctx are as they were */
+
+typedef struct tinyb_ctx {
+    int64_t vars[26];  /* A to Z */
+    void* user;        /* passed to the callbacks */
+
+    void (*print_number)(void* user, int64_t value);
+    void (*print_text)(void* user, const char* text, size_t size);  /* a PRINT ends with "\n" unless no-nl */
+    int (*input_number)(void* user, int64_t* value);  /* 1, 0 - the input is over, -1 - not a number */
+
+    /* set with TINYB_ERROR: "@: index out of range", "division by zero", "division overflow"
+       (the lowest value by -1), "INPUT: end of input", "INPUT: not a number", ... */
+    const char* error;
+} tinyb_ctx;
+
+int tinyb_run(tinyb_ctx* ctx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
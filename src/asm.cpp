@@ -0,0 +1,411 @@
+#include <algorithm>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include "asm.hpp"
+#include "emitter.hpp"
+
+static const char* reg_name(Reg r, Width width) {
+    static const char* names_q[] = {
+        "", "rax", "rbx", "rcx", "rdx", "rsi", "rdi", "rbp", "rsp",
+        "r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15"
+    };
+    static const char* names_d[] = {
+        "", "eax", "ebx", "ecx", "edx", "esi", "edi", "ebp", "esp",
+        "r8d", "r9d", "r10d", "r11d", "r12d", "r13d", "r14d", "r15d"
+    };
+    static const char* names_b[] = {
+        "", "al", "bl", "cl", "dl", "sil", "dil", "bpl", "spl",
+        "r8b", "r9b", "r10b", "r11b", "r12b", "r13b", "r14b", "r15b"
+    };
+
+    switch (width) {
+        case Width::q: return names_q[static_cast<size_t>(r)];
+        case Width::d: return names_d[static_cast<size_t>(r)];
+        case Width::b: return names_b[static_cast<size_t>(r)];
+    }
+    return "";
+}
+
+static const char* op_name(Op op) {
+    static const char* names[] = {
+        "",
+        "mov", "movzx", "movsxd", "lea", "push", "pop",
+        "add", "sub", "imul", "idiv", "div", "cqo", "cdq", "neg", "inc", "dec",
+        "xor", "and", "or", "shl", "cmp", "test",
+        "jmp", "je", "jne", "jl", "jle", "jg", "jge", "jz", "jnz", "jae", "jb", "jbe", "ja", "jo", "jno",
+        "call", "ret", "syscall", "rdtsc",
+        "nop", "align", "section", "loc",
+    };
+
+    return names[static_cast<size_t>(op)];
+}
+
+std::optional<Op> invert_jump(Op jcc) {
+    switch (jcc) {
+        case Op::je:  return Op::jne;
+        case Op::jne: return Op::je;
+        case Op::jl:  return Op::jge;
+        case Op::jge: return Op::jl;
+        case Op::jle: return Op::jg;
+        case Op::jg:  return Op::jle;
+        case Op::jz:  return Op::jnz;
+        case Op::jnz: return Op::jz;
+        case Op::jae: return Op::jb;
+        case Op::jb:  return Op::jae;
+        case Op::jbe: return Op::ja;
+        case Op::ja:  return Op::jbe;
+        case Op::jo:  return Op::jno;
+        case Op::jno: return Op::jo;
+        default:      return {};
+    }
+}
+
+static void print_label(const Label& l, Emitter& out) {
+    static const char* prefixes[] = {"", "com", "skip", "str", "", "", "loop", "line", "cold", "bas", "gosub"};
+
+    if (l.kind == LabelKind::named || l.kind == LabelKind::fail) {
+        out.put(l.name);
+    } else if (l.kind != LabelKind::none) {
+        out.put(prefixes[static_cast<size_t>(l.kind)]);
+        out.put_int(l.id);
+    }
+}
+
+// rip - a symbol in memory operands is addressed relative to rip
+static void print_operand(const Operand& operand, bool sized, Syntax syntax, Emitter& out, bool rip = false) {
+    switch (operand.kind) {
+        case OperandKind::reg:
+            out.put(reg_name(operand.reg, operand.width));
+            break;
+        case OperandKind::imm:
+            out.put_int(operand.imm);
+            break;
+        case OperandKind::label:
+            print_label(operand.label, out);
+            if (operand.imm != 0) {
+                out.put('+');
+                out.put_int(operand.imm);
+            }
+            break;
+        case OperandKind::mem: {
+            if (sized) {
+                static const char* sizes[] = {"QWORD ", "DWORD ", "BYTE "};
+                out.put(sizes[static_cast<size_t>(operand.width)]);
+                if (syntax == Syntax::gas)
+                    out.put("PTR ");
+            }
+
+            out.put('[');
+            bool first = true;
+
+            if (operand.label.kind != LabelKind::none) {
+                if (rip && syntax == Syntax::gas)  // nasm has `default rel` for it
+                    out.put("rip+");
+                print_label(operand.label, out);
+                first = false;
+            }
+            if (operand.reg != Reg::none) {
+                if (!first) out.put('+');
+                out.put(reg_name(operand.reg, Width::q));
+                first = false;
+            }
+            if (operand.index != Reg::none) {
+                if (!first) out.put('+');
+                out.put(reg_name(operand.index, Width::q));
+                if (operand.scale != 1) {
+                    out.put('*');
+                    out.put_int(operand.scale);
+                }
+                first = false;
+            }
+            if (operand.imm != 0 || first) {
+                if (operand.imm >= 0 && !first)
+                    out.put('+');
+                out.put_int(operand.imm);
+            }
+
+            out.put(']');
+            break;
+        }
+        case OperandKind::none:
+            break;
+    }
+}
+
+static void print_bytes(const std::string& bytes, Emitter& out) {  // nasm: 'text', 10, 0
+    bool in_quotes = false;
+
+    for (unsigned char c: bytes) {
+        bool printable = c >= 0x20 && c < 0x7f && c != '\'';
+
+        if (printable && !in_quotes) {
+            out.put('\'');
+            in_quotes = true;
+        } else if (!printable) {
+            if (in_quotes)
+                out.put("', ");
+            in_quotes = false;
+            out.put_int(static_cast<int>(c));
+            out.put(", ");
+            continue;
+        }
+
+        out.put(static_cast<char>(c));
+    }
+
+    if (in_quotes)
+        out.put("', ");
+    out.put('0');
+}
+
+static void print_string(const std::string& bytes, Emitter& out) {  // gas: "text\012", .asciz adds the 0
+    out.put('"');
+
+    for (unsigned char c: bytes) {
+        if (c >= 0x20 && c < 0x7f && c != '"' && c != '\\') {
+            out.put(static_cast<char>(c));
+        } else {
+            char octal[] = {'\\', static_cast<char>('0' + (c >> 6)), static_cast<char>('0' + ((c >> 3) & 7)),
+                            static_cast<char>('0' + (c & 7))};
+            out.put(std::string_view(octal, sizeof(octal)));
+        }
+    }
+
+    out.put('"');
+}
+
+static void print_data(const DataDef& def, Syntax syntax, Emitter& out) {
+    if (def.kind == DataDef::Kind::quads && def.quads.empty()) {  // label of an empty table
+        print_label(def.label, out);
+        out.put(":\n");
+        return;
+    }
+
+    out.put('\t');
+    if (def.label.kind != LabelKind::none) {
+        print_label(def.label, out);
+        out.put(syntax == Syntax::gas ? ": " : " ");
+    }
+
+    bool gas = syntax == Syntax::gas;
+
+    switch (def.kind) {
+        case DataDef::Kind::bytes:
+            if (gas) {
+                out.put(".asciz ");
+                print_string(def.bytes, out);
+            } else {
+                out.put("db ");
+                print_bytes(def.bytes, out);
+            }
+            break;
+        case DataDef::Kind::quads:
+            out.put(gas ? ".quad " : "dq ");
+            for (size_t i = 0; i < def.quads.size(); i++) {
+                if (i) out.put(", ");
+                print_operand(def.quads[i], false, syntax, out);
+            }
+            break;
+        case DataDef::Kind::zero:
+            out.put(gas ? ".zero " : "resq ");
+            out.put_int(gas ? def.zero * 8 : def.zero);
+            break;
+    }
+
+    out.put('\n');
+}
+
+static void print_section(const char* name, Syntax syntax, Emitter& out) {
+    out.put(syntax == Syntax::gas ? ".section " : "section ");
+    out.put(name);
+    out.put('\n');
+}
+
+static void print_externs(const std::vector<const char*>& externs, Syntax syntax, Emitter& out) {
+    if (syntax == Syntax::gas) {  // undefined symbols are external, only the syntax needs saying
+        out.put(".intel_syntax noprefix\n");
+        return;
+    }
+
+    if (externs.empty())
+        return;
+
+    out.put("extern ");
+    for (size_t i = 0; i < externs.size(); i++) {
+        if (i) out.put(", ");
+        out.put(externs[i]);
+    }
+    out.put('\n');
+}
+
+static void print_global(const std::string& entry, const char* table, bool pic, Syntax syntax, Emitter& out) {
+    if (pic && syntax == Syntax::nasm)
+        out.put("\tdefault rel\n");
+
+    auto global = [&](std::string_view name, const char* gas_type, const char* nasm_type) {
+        if (syntax == Syntax::gas) {
+            out.put("\t.globl ");
+            out.put(name);
+            if (pic) {
+                out.put("\n\t.type ");
+                out.put(name);
+                out.put(gas_type);
+            }
+        } else {
+            out.put("\tglobal ");
+            out.put(name);
+            if (pic)
+                out.put(nasm_type);
+        }
+        out.put('\n');
+    };
+
+    if (!entry.empty())
+        global(entry, ", @function", ":function");
+    if (table)
+        global(table, ", @object", ":data");
+    out.put('\n');
+}
+
+static void print_stack_note(Syntax syntax, Emitter& out) {  // the stack isn't executable, a dlopen may refuse it otherwise
+    out.put('\n');
+    out.put(syntax == Syntax::gas ? ".section .note.GNU-stack,\"\",@progbits\n" : "section .note.GNU-stack noalloc noexec nowrite progbits\n");
+}
+
+static void print_source(const std::string& source, Syntax syntax, Emitter& out) {  // the file every loc refers to
+    if (source.empty())
+        return;
+
+    if (syntax == Syntax::gas) {
+        out.put(".file 1 ");
+        print_string(source, out);
+    } else {
+        out.put("%line 0+0 ");
+        out.put(source);
+    }
+    out.put('\n');
+}
+
+// pic - addresses of symbols are taken with lea relative to rip instead of moved as immediates
+static void print_text(const std::vector<Instr>& text, Syntax syntax, Emitter& out, bool pic = false) {
+    bool gas = syntax == Syntax::gas;
+
+    for (auto& instr: text) {
+        if (pic && instr.op == Op::mov && instr.a.kind == OperandKind::reg && instr.b.kind == OperandKind::label) {
+            out.put("\tlea ");
+            out.put(reg_name(instr.a.reg, instr.a.width));
+            out.put(gas ? ", [rip+" : ", [");
+            print_operand(instr.b, false, syntax, out);
+            out.put("]\n");
+            continue;
+        }
+
+        if (instr.op == Op::label) {
+            print_label(instr.a.label, out);
+            out.put(":\n");
+            continue;
+        }
+        if (instr.op == Op::loc) {  // the assembler takes the lines of the debug info from it
+            out.put(gas ? ".loc 1 " : "%line ");
+            out.put_int(instr.a.imm);
+            out.put(gas ? "\n" : "+0\n");
+            continue;
+        }
+        if (instr.op == Op::section) {
+            out.put(gas ? "\n.section " : "\nsection ");
+            print_label(instr.a.label, out);
+            out.put(gas ? ",\"ax\",@progbits\n" : " progbits alloc exec nowrite align=16\n");
+            continue;
+        }
+        if (instr.op == Op::align && gas) {  // pads code with long nops by itself
+            out.put("\t.balign ");
+            out.put_int(instr.a.imm);
+            out.put('\n');
+            continue;
+        }
+
+        out.put('\t');
+        out.put(op_name(instr.op));
+
+        if (instr.a.kind != OperandKind::none) {
+            // memory size is spelled out unless a register operand already gives it
+            bool sized = instr.op != Op::lea && instr.b.kind != OperandKind::reg;
+
+            out.put(' ');
+            // a bare symbol is its address to nasm, but a load from it to gas unless it's a jump target
+            if (gas && instr.a.kind == OperandKind::label && !is_jump(instr.op) && instr.op != Op::call)
+                out.put("OFFSET ");
+            print_operand(instr.a, sized, syntax, out, pic);
+        }
+        if (instr.b.kind != OperandKind::none) {
+            out.put(", ");
+            bool sized = instr.op == Op::movzx || instr.op == Op::movsxd || (instr.op != Op::lea && instr.a.kind != OperandKind::reg);
+            if (gas && instr.b.kind == OperandKind::label)
+                out.put("OFFSET ");
+            print_operand(instr.b, sized, syntax, out, pic);
+        }
+
+        out.put('\n');
+    }
+}
+
+void print_asm(const AsmProgram& program, Syntax syntax, Emitter& out) {
+    bool aligned = std::any_of(program.text.begin(), program.text.end(), [](const Instr& in) {
+        return in.op == Op::align;
+    });
+    if (aligned && syntax == Syntax::nasm)  // long nops instead of runs of single byte ones
+        out.put("%use smartalign\nalignmode p6\n");
+
+    print_externs(program.externs, syntax, out);
+
+    print_section(".data", syntax, out);
+    for (auto& def: program.data)
+        print_data(def, syntax, out);
+
+    out.put('\n');
+    print_section(".text", syntax, out);
+    print_global(program.entry, program.table, program.pic, syntax, out);
+
+    print_source(program.source, syntax, out);
+    print_text(program.text, syntax, out, program.pic);
+    print_asm_bss(program.bss, syntax, out);
+
+    if (program.pic)
+        print_stack_note(syntax, out);
+}
+
+void print_asm_head(const std::vector<const char*>& externs, const std::string& source, Syntax syntax, Emitter& out) {
+    print_externs(externs, syntax, out);  // no align in the text, no %use
+
+    out.put('\n');
+    print_section(".text", syntax, out);
+    print_global("_start", nullptr, false, syntax, out);
+
+    print_source(source, syntax, out);
+}
+
+void print_asm_piece(const std::vector<Instr>& text, const std::vector<DataDef>& data, Syntax syntax, Emitter& out) {
+    print_text(text, syntax, out);
+
+    if (data.empty())
+        return;
+
+    out.put('\n');
+    print_section(".data", syntax, out);
+    for (auto& def: data)
+        print_data(def, syntax, out);
+    out.put('\n');
+    print_section(".text", syntax, out);
+}
+
+void print_asm_bss(const std::vector<DataDef>& bss, Syntax syntax, Emitter& out) {
+    if (bss.empty())
+        return;
+
+    out.put('\n');
+    print_section(".bss", syntax, out);
+    for (auto& def: bss)
+        print_data(def, syntax, out);
+}
@@ -0,0 +1,147 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "emitter.hpp"
+
+enum class Reg : uint8_t {
+    none, rax, rbx, rcx, rdx, rsi, rdi, rbp, rsp,
+    r8, r9, r10, r11, r12, r13, r14, r15
+};
+
+enum class Width : uint8_t {
+    q, d, b  // 64, 32 and 8 bit: register names and memory operand size
+};
+
+enum class Op : uint8_t {
+    label,  // a - label
+    mov, movzx, movsxd, lea, push, pop,
+    add, sub, imul, idiv, div, cqo, cdq, neg, inc, dec,
+    _xor, _and, _or, shl, cmp, test,
+    jmp, je, jne, jl, jle, jg, jge, jz, jnz, jae, jb, jbe, ja, jo, jno,
+    call, ret, syscall, rdtsc,
+    nop,      // removed by an optimization, dropped before printing
+    align,    // a - imm: pads with nops up to a multiple of it
+    section,  // a - named label: the code after it goes into that executable section
+    loc,      // a - imm: the code after it comes from this line of the source (0 - none), with -g
+};
+
+enum class LabelKind : uint8_t {
+    none, com, skip, str, named, 
+    fail,  // named runtime error exit, never returns
+    loop,  // loop<line>: start and end of an unrolled loop, statements start there
+    line,  // line<line>: a line moved to or from the cold code, a statement starts there
+    cold,  // cold<id>: THEN of skip<id> moved to the cold code
+    basic, // bas<num>: symbol of a numbered line for profilers and debuggers, nothing jumps there
+    gosub  // gosub<num>: the same for a subroutine
+};
+
+struct Label {
+    LabelKind kind = LabelKind::none;
+    uint64_t id = 0;             // com<id>, skip<id>, str<id>, loop<id>, line<id>, cold<id>, bas<id>, gosub<id>
+    const char* name = nullptr;  // named and fail (runtime symbols), a string literal or the entry of the options
+
+    bool operator==(const Label& other) const = default;
+};
+
+enum class OperandKind : uint8_t {
+    none, reg, imm, mem, label
+};
+
+struct Operand {
+    OperandKind kind = OperandKind::none;
+    Width width = Width::q;
+    Reg reg = Reg::none;    // reg, or base of mem
+    Reg index = Reg::none;  // mem
+    uint8_t scale = 1;      // mem
+    int64_t imm = 0;        // imm, or displacement of mem
+    Label label{};          // label (its address), or symbol of mem
+
+    bool operator==(const Operand& other) const = default;
+};
+
+struct Instr {
+    Op op = Op::nop;
+    Operand a{};
+    Operand b{};
+};
+
+struct DataDef {
+    enum class Kind : uint8_t { bytes, quads, zero } kind;
+    Label label;                // none - continues the previous definition
+    std::string bytes;          // bytes: contents, printed with a trailing 0
+    std::vector<Operand> quads; // quads: imm or label operands
+    size_t zero = 0;            // zero: reserved qwords (bss)
+};
+
+struct AsmProgram {
+    std::string entry = "_start";  // the global symbol, empty - none
+    bool pic = false;    // position independent, the entry is a C function of an object or shared library
+    const char* table = nullptr;  // a quads table of the data exported as well, with --repl
+    std::string source;  // file of the loc lines, empty - no debug info
+    std::vector<const char*> externs;
+    std::vector<DataDef> data;
+    std::vector<DataDef> bss;
+    std::vector<Instr> text;
+};
+
+inline Label named(const char* name) {
+    return {.kind = LabelKind::named, .name = name};
+}
+
+inline Label fail_label(const char* name) {
+    return {.kind = LabelKind::fail, .name = name};
+}
+
+inline Operand reg(Reg r, Width width = Width::q) {
+    return {.kind = OperandKind::reg, .width = width, .reg = r};
+}
+
+inline Operand imm(int64_t value) {
+    return {.kind = OperandKind::imm, .imm = value};
+}
+
+inline Operand mem(Reg base, int64_t disp = 0, Width width = Width::q) {
+    return {.kind = OperandKind::mem, .width = width, .reg = base, .imm = disp};
+}
+
+inline Operand mem(Reg base, Reg index, uint8_t scale, int64_t disp = 0) {
+    return {.kind = OperandKind::mem, .reg = base, .index = index, .scale = scale, .imm = disp};
+}
+
+inline Operand mem(Label symbol, int64_t disp = 0, Reg index = Reg::none, uint8_t scale = 1) {
+    return {.kind = OperandKind::mem, .index = index, .scale = scale, .imm = disp, .label = symbol};
+}
+
+inline Operand label(Label l) {
+    return {.kind = OperandKind::label, .label = l};
+}
+
+std::optional<Op> invert_jump(Op jcc);  // the conditional jump taken exactly when jcc isn't
+
+inline bool is_jump(Op op) {
+    return op >= Op::jmp && op <= Op::jno;
+}
+
+// -g markers: line info and symbols of BASIC lines, no code
+inline bool is_debug(const Instr& in) {
+    return in.op == Op::loc ||
+           (in.op == Op::label && (in.a.label.kind == LabelKind::basic || in.a.label.kind == LabelKind::gosub));
+}
+
+enum class Syntax : uint8_t {
+    nasm,
+    gas  // GNU as, .intel_syntax noprefix
+};
+
+void print_asm(const AsmProgram& program, Syntax syntax, Emitter& out);
+
+// the same a piece at a time, for a program printed while it is generated:
+// the head once, then the text and data of every piece, the bss last
+void print_asm_head(const std::vector<const char*>& externs, const std::string& source, Syntax syntax, Emitter& out);
+void print_asm_piece(const std::vector<Instr>& text, const std::vector<DataDef>& data, Syntax syntax, Emitter& out);
+void print_asm_bss(const std::vector<DataDef>& bss, Syntax syntax, Emitter& out);
@@ -0,0 +1,229 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/file.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include "cache.hpp"
+
+#ifndef TINYB_VERSION
+#define TINYB_VERSION "dev"
+#endif
+
+namespace fs = std::filesystem;
+
+uint64_t fnv1a(const std::string& data, uint64_t hash) {
+    for (unsigned char c: data) {
+        hash ^= c;
+        hash *= 0x100000001b3;
+    }
+    return hash;
+}
+
+fs::path Cache::default_dir() {
+    if (const char* dir = std::getenv("TINYB_CACHE_DIR"))
+        return dir;
+    if (const char* dir = std::getenv("XDG_CACHE_HOME"))
+        return fs::path(dir) / "tinyb";
+    if (const char* dir = std::getenv("HOME"))
+        return fs::path(dir) / ".cache" / "tinyb";
+
+    return fs::temp_directory_path() / "tinyb-cache";
+}
+
+// the version stays the same across rebuilds of the compiler, the code it generates may not
+static const std::string& build_id() {
+    static const std::string id = [] {
+        std::ifstream exe("/proc/self/exe", std::ios::binary);
+        std::stringstream bytes;
+        bytes << exe.rdbuf();
+        return exe ? std::format("{:016x}", fnv1a(bytes.str())) : std::string();
+    }();
+    return id;
+}
+
+std::string Cache::key(const std::string& code, const std::string& flags) {
+    std::string material = std::format("{} {}\n{}\n", TINYB_VERSION, build_id(), flags);
+    material += code;
+
+    // two differently seeded 64 bit FNV-1a = 128 bit key
+    return std::format(
+        "{:016x}{:016x}",
+        fnv1a(material, 0xcbf29ce484222325), fnv1a(material, 0x84222325cbf29ce4)
+    );
+}
+
+// a copy-on-write clone where the filesystem supports it (btrfs, xfs), it costs no space until written
+static bool reflink(const fs::path& from, const fs::path& to) {
+    int in = open(from.c_str(), O_RDONLY | O_CLOEXEC);
+    if (in < 0) return false;
+
+    int out = open(to.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0755);
+    bool cloned = out >= 0 && ioctl(out, FICLONE, in) == 0;
+
+    if (out >= 0) close(out);
+    close(in);
+
+    if (!cloned && out >= 0) {
+        std::error_code ec;
+        fs::remove(to, ec);
+    }
+
+    return cloned;
+}
+
+bool Cache::fetch(const std::string& key, const fs::path& output) {
+    std::error_code ec;
+    fs::path object = object_path(key);
+
+    if (!fs::exists(object, ec)) {
+        count(false);
+        return false;
+    }
+
+    fs::remove(output, ec);
+
+    // never link: strip or patchelf on the output would edit the cached entry in place
+    if (!reflink(object, output)) {
+        ec.clear();
+        fs::copy_file(object, output, fs::copy_options::overwrite_existing, ec);
+    }
+
+    if (ec) {  // evicted in between or unreadable
+        count(false);
+        return false;
+    }
+
+    fs::last_write_time(object, fs::file_time_type::clock::now(), ec);
+    count(true);
+
+    return true;
+}
+
+void Cache::store(const std::string& key, const fs::path& binary) {
+    static std::atomic<unsigned> tmp_counter = 0;
+
+    std::error_code ec;
+    fs::create_directories(m_dir / "objects", ec);
+    if (ec) return;
+
+    // copy next to the destination first, so readers never see a half written file
+    fs::path tmp = m_dir / std::format("tmp-{}-{}", getpid(), tmp_counter++);
+
+    fs::copy_file(binary, tmp, fs::copy_options::overwrite_existing, ec);
+    if (!ec)
+        fs::rename(tmp, object_path(key), ec);
+
+    if (ec) {
+        fs::remove(tmp, ec);
+        return;
+    }
+
+    evict();
+}
+
+void Cache::evict() {
+    struct Entry {
+        fs::path path;
+        fs::file_time_type used;
+        uintmax_t size;
+    };
+
+    std::error_code ec;
+    std::vector<Entry> entries;
+    uintmax_t total = 0;
+
+    for (auto& file: fs::directory_iterator(m_dir / "objects", ec)) {
+        std::error_code file_ec;
+        uintmax_t size = file.file_size(file_ec);
+        auto used = file.last_write_time(file_ec);
+
+        if (file_ec) continue;
+
+        entries.push_back({.path = file.path(), .used = used, .size = size});
+        total += size;
+    }
+
+    if (total <= m_max_size)
+        return;
+
+    std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
+        return a.used < b.used;
+    });
+
+    for (auto& entry: entries) {
+        if (total <= m_max_size) break;
+
+        fs::remove(entry.path, ec);  // someone else may have evicted it already
+        total -= entry.size;
+    }
+}
+
+void Cache::count(bool hit) {
+    std::error_code ec;
+    fs::create_directories(m_dir, ec);
+
+    int fd = open((m_dir / "stats").c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0) return;
+
+    flock(fd, LOCK_EX);
+
+    char buf[64] = {};
+    unsigned long long hits = 0, misses = 0;
+
+    if (read(fd, buf, sizeof(buf) - 1) > 0)
+        std::sscanf(buf, "%llu %llu", &hits, &misses);
+
+    if (hit) hits++;
+    else misses++;
+
+    std::string stats = std::format("{} {}\n", hits, misses);
+
+    if (ftruncate(fd, 0) == 0)
+        pwrite(fd, stats.data(), stats.size(), 0);
+
+    flock(fd, LOCK_UN);
+    close(fd);
+}
+
+void Cache::print_stats(std::ostream& out) {
+    std::error_code ec;
+    size_t entries = 0;
+    uintmax_t total = 0;
+
+    for (auto& file: fs::directory_iterator(m_dir / "objects", ec)) {
+        std::error_code file_ec;
+        uintmax_t size = file.file_size(file_ec);
+
+        if (file_ec) continue;
+
+        entries++;
+        total += size;
+    }
+
+    unsigned long long hits = 0, misses = 0;
+    if (FILE* stats = std::fopen((m_dir / "stats").c_str(), "r")) {
+        if (std::fscanf(stats, "%llu %llu", &hits, &misses) != 2)
+            hits = misses = 0;
+        std::fclose(stats);
+    }
+
+    out << std::format("cache:   {}\n", m_dir.string());
+    out << std::format("entries: {}\n", entries);
+    out << std::format("size:    {} bytes (limit {} bytes)\n", total, m_max_size);
+    out << std::format("hits:    {}\n", hits);
+    out << std::format("misses:  {}\n", misses);
+}
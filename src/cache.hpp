@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <ostream>
+#include <string>
+
+constexpr uintmax_t DEFAULT_CACHE_SIZE = 256 * 1024 * 1024;
+
+uint64_t fnv1a(const std::string& data, uint64_t hash = 0xcbf29ce484222325);
+
+/*
+    Content addressed cache of linked executables.
+
+    <dir>/objects/<key>  - executable, its mtime is the last use (for LRU)
+    <dir>/stats          - "<hits> <misses>", updated under flock
+    <dir>/tmp-*          - entries being written, renamed into objects/
+*/
+class Cache {
+public:
+    explicit Cache(std::filesystem::path dir, uintmax_t max_size = DEFAULT_CACHE_SIZE)
+        : m_dir(std::move(dir)), m_max_size(max_size) {}
+
+    static std::filesystem::path default_dir();
+    static std::string key(const std::string& code, const std::string& flags);
+
+    bool fetch(const std::string& key, const std::filesystem::path& output);
+    void store(const std::string& key, const std::filesystem::path& binary);
+
+    void print_stats(std::ostream& out);
+
+private:
+    void count(bool hit);
+    void evict();
+
+    std::filesystem::path object_path(const std::string& key) {
+        return m_dir / "objects" / key;
+    }
+
+    std::filesystem::path m_dir;
+    uintmax_t m_max_size;
+};
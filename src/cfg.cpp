@@ -0,0 +1,161 @@
+#include <format>
+#include <string>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "cfg.hpp"
+#include "error.hpp"
+
+const std::string& jump_target(const NodeExpr* expr) {
+    return std::get<1>(std::get<1>(std::get<1>(expr->term)->fact)->body).num;
+}
+
+Cfg::Cfg(const NodeProg& prog, bool keep_all) : m_lines(prog.lines.size()) {
+    for (size_t i = 0; i < prog.lines.size(); i++) {
+        if (prog.lines[i]->num.has_value())
+            m_index.insert({std::stoll(prog.lines[i]->num->num), i});
+    }
+
+    for (size_t i = 0; i < prog.lines.size(); i++) {
+        m_lines[i].src_line = prog.lines[i]->line;
+        add_stat(prog.lines[i]->stat, m_lines[i], true);
+    }
+
+    walk(keep_all);
+}
+
+size_t Cfg::index_of(const std::string& num) const {
+    return m_index.at(std::stoll(num));  // the parser checked every target exists
+}
+
+void Cfg::add_stat(const NodeStat* stat, Line& line, bool top) {
+    struct StatVisitor {
+        Cfg* cfg;
+        Line& line;
+        bool top;
+
+        void operator()(NodeStatGoto* stat_goto) {
+            line.gotos.push_back(cfg->index_of(jump_target(stat_goto->expr)));
+            if (top)
+                line.falls = false;
+        }
+
+        void operator()(NodeStatGosub* stat_gosub) {
+            line.gosubs.push_back(cfg->index_of(jump_target(stat_gosub->expr)));
+        }
+
+        void operator()(NodeStatReturn* stat_return) {
+            if (top) {
+                line.falls = false;
+                line.is_return = true;
+            }
+        }
+
+        void operator()(NodeStatEnd* stat_end) {
+            if (top)
+                line.falls = false;
+        }
+
+        void operator()(NodeStatIf* stat_if) {  // the condition may fail, so it always falls
+            cfg->add_stat(stat_if->then, line, false);
+        }
+
+        void operator()(NodeStatPrint* stat_print) {}
+        void operator()(NodeStatInput* stat_input) {}
+        void operator()(NodeStatLet* stat_let) {}
+        void operator()(NodeStatClear* stat_clear) {}
+        void operator()(NodeStatList* stat_list) {}
+        void operator()(NodeStatRun* stat_run) {}
+        void operator()(const std::monostate& mono) {}
+    };
+
+    std::visit(StatVisitor{.cfg = this, .line = line, .top = top}, stat->com);
+}
+
+void Cfg::walk(bool keep_all) {
+    if (m_lines.empty())
+        return;
+
+    // state 2 * i - line i outside of subroutines, 2 * i + 1 - inside one
+    std::vector<bool> seen(m_lines.size() * 2);
+    std::vector<size_t> work{0};
+    seen[0] = true;
+
+    for (size_t i = 1; keep_all && i < m_lines.size(); i++) {
+        seen[i * 2] = true;
+        work.push_back(i * 2);
+    }
+
+    auto visit = [&](size_t line, bool in_sub) {
+        if (line >= m_lines.size())
+            return;
+
+        size_t state = line * 2 + in_sub;
+        if (!seen[state]) {
+            seen[state] = true;
+            work.push_back(state);
+        }
+    };
+
+    while (!work.empty()) {
+        size_t state = work.back();
+        work.pop_back();
+
+        size_t i = state / 2;
+        bool in_sub = state % 2;
+        Line& line = m_lines[i];
+
+        for (auto t: line.gotos)
+            visit(t, in_sub);
+        for (auto t: line.gosubs)
+            visit(t, true);
+
+        // back from a GOSUB, or RETURN with nothing to return to
+        if (line.falls || (line.is_return && !in_sub))
+            visit(i + 1, in_sub);
+    }
+
+    for (size_t i = 0; i < m_lines.size(); i++) {
+        Line& line = m_lines[i];
+        line.reachable = seen[i * 2] || seen[i * 2 + 1];
+        line.in_sub_only = !seen[i * 2] && seen[i * 2 + 1];
+
+        if (!line.reachable)
+            continue;
+
+        for (auto t: line.gotos) {
+            m_lines[t].is_target = true;
+            m_lines[t].is_loop_head = m_lines[t].is_loop_head || t <= i;
+            line.succ.push_back(t);
+        }
+        for (auto t: line.gosubs) {
+            m_lines[t].is_target = true;
+            m_lines[t].is_sub = true;
+            line.succ.push_back(t);
+        }
+
+        line.falls = line.falls || (line.is_return && seen[i * 2]);
+        if (line.falls && i + 1 < m_lines.size())
+            line.succ.push_back(i + 1);
+    }
+}
+
+void Cfg::warn_unreachable() const {
+    for (size_t i = 0; i < m_lines.size();) {
+        if (m_lines[i].reachable) {
+            i++;
+            continue;
+        }
+
+        size_t start = i;
+        while (i < m_lines.size() && !m_lines[i].reachable)
+            i++;
+
+        size_t count = i - start;
+        Error::warning(
+            m_lines[start].src_line,
+            std::format("Unreachable code, {} line{} dropped", count, count == 1 ? "" : "s").c_str()
+        );
+    }
+}
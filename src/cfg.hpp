@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "parser.hpp"
+
+// number of the line a GOTO/GOSUB jumps to (the parser made sure it is a constant)
+const std::string& jump_target(const NodeExpr* expr);
+
+/*
+    Control flow between the lines of a program. A line is reachable when a
+    path from the first line gets to it, going to GOTO and GOSUB targets and
+    falling through to the next line. RETURN falls through only when no
+    GOSUB is active, so paths are followed apart inside and outside of
+    subroutines. With `keep_all` every line is taken as reachable (an entry
+    of its own, outside of subroutines), so nothing is dropped.
+*/
+class Cfg {
+public:
+    explicit Cfg(const NodeProg& prog, bool keep_all = false);
+
+    size_t size() const { return m_lines.size(); }
+
+    bool reachable(size_t i) const { return m_lines[i].reachable; }
+    bool is_target(size_t i) const { return m_lines[i].is_target; }  // of a reachable GOTO/GOSUB
+    bool is_loop_head(size_t i) const { return m_lines[i].is_loop_head; }  // a GOTO below or on it goes back
+    bool in_sub_only(size_t i) const { return m_lines[i].in_sub_only; }    // a GOSUB is always active there
+    bool is_sub(size_t i) const { return m_lines[i].is_sub; }  // a reachable GOSUB calls it
+    bool falls(size_t i) const { return m_lines[i].falls; }  // on to the next line (or the end) on some path
+    const std::vector<size_t>& succ(size_t i) const { return m_lines[i].succ; }
+    const std::vector<size_t>& gotos(size_t i) const { return m_lines[i].gotos; }    // IF ... THEN GOTO too
+    const std::vector<size_t>& gosubs(size_t i) const { return m_lines[i].gosubs; }
+
+    size_t index_of(const std::string& num) const;  // of a line number the program has
+
+    void warn_unreachable() const;  // one warning for every run of dropped lines
+private:
+    struct Line {
+        std::vector<size_t> gotos;
+        std::vector<size_t> gosubs;
+        bool falls = true;       // to the next line, after walk() only on a path that gets there
+        bool is_return = false;  // falls only outside of subroutines
+
+        std::vector<size_t> succ;
+        bool reachable = false;
+        bool is_target = false;
+        bool is_loop_head = false;
+        bool in_sub_only = false;
+        bool is_sub = false;
+        size_t src_line = 0;
+    };
+
+    void add_stat(const NodeStat* stat, Line& line, bool top);
+    void walk(bool keep_all);
+
+    std::vector<Line> m_lines;
+    std::unordered_map<long long, size_t> m_index;  // BASIC line number -> line
+};
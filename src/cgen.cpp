@@ -0,0 +1,475 @@
+#include <cstdint>
+#include <format>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <variant>
+
+#include "cfg.hpp"
+#include "cgen.hpp"
+#include "error.hpp"
+#include "parser.hpp"
+
+constexpr size_t GOSUB_DEPTH = 1 << 20;  // return sites the stack of the C code holds
+
+static constexpr std::string_view C_INCLUDES = R"(#include <inttypes.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+)";
+
+// the wrapping arithmetic and the traps of the native code, in tb_int
+static constexpr std::string_view C_RUNTIME = R"(
+__attribute__((noreturn, cold)) static void tb_fail(const char* msg) {
+    fflush(NULL);
+    fputs(msg, stderr);
+    _exit(2);
+}
+
+static inline tb_int tb_add(tb_int a, tb_int b) { return (tb_int)((tb_uint)a + (tb_uint)b); }
+static inline tb_int tb_sub(tb_int a, tb_int b) { return (tb_int)((tb_uint)a - (tb_uint)b); }
+static inline tb_int tb_mul(tb_int a, tb_int b) { return (tb_int)((tb_uint)a * (tb_uint)b); }
+static inline tb_int tb_neg(tb_int a) { return (tb_int)(0 - (tb_uint)a); }
+
+static inline tb_int tb_div(tb_int a, tb_int b) {
+    if (b == 0 || (b == -1 && a == TB_INT_MIN))
+        raise(SIGFPE);
+    return a / b;
+}
+)";
+
+static constexpr std::string_view C_ARRAY = R"(
+static tb_int* tb_array;
+
+static inline size_t tb_index(tb_int i) {
+    if ((uint64_t)(int64_t)i >= TB_ARRAY_SIZE)
+        tb_fail("@: index out of range\n");
+    return (size_t)i;
+}
+
+static void tb_map_array(void) {
+    void* array = mmap(NULL, TB_ARRAY_SIZE * sizeof(tb_int), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (array == MAP_FAILED)
+        tb_fail("@: cannot map the array\n");
+    tb_array = array;
+}
+)";
+
+static constexpr std::string_view C_INPUT = R"(
+static char tb_in_buf[TB_INPUT_BUFFER_SIZE];
+static size_t tb_in_pos, tb_in_end;
+
+static int tb_in_byte(void) {  // the unread byte, -1 at the end of the input
+    if (tb_in_pos == tb_in_end) {
+        fflush(NULL);  // prompts go out before the program waits
+        ssize_t got = read(0, tb_in_buf, sizeof(tb_in_buf));
+        tb_in_pos = 0;
+        tb_in_end = got > 0 ? (size_t)got : 0;
+        if (!tb_in_end)
+            return -1;
+    }
+    return (unsigned char)tb_in_buf[tb_in_pos];
+}
+
+static tb_int tb_input(void) {
+    int c;
+    while ((c = tb_in_byte()) == ' ' || (c >= '\t' && c <= '\r'))
+        tb_in_pos++;
+    if (c < 0)
+        tb_fail("INPUT: end of input\n");
+
+    int negative = c == '-';
+    if (c == '-' || c == '+') {
+        tb_in_pos++;
+        c = tb_in_byte();
+    }
+    if (c < '0' || c > '9')
+        tb_fail("INPUT: not a number\n");
+
+    uint64_t value = 0, limit = (uint64_t)TB_INT_MAX + negative;  /* the lowest value has no positive twin */
+    do {
+        if (value > (limit - (uint64_t)(c - '0')) / 10)
+            tb_fail("INPUT: not a number\n");
+        value = value * 10 + (uint64_t)(c - '0');
+        tb_in_pos++;
+    } while ((c = tb_in_byte()) >= '0' && c <= '9');
+
+    return (tb_int)(tb_uint)(negative ? 0 - value : value);
+}
+)";
+
+// a C string literal of the bytes, escaped in octal where they aren't printable
+static void put_literal(std::string_view bytes, std::string& out) {
+    out += '"';
+    for (unsigned char c: bytes) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += static_cast<char>(c);
+        } else if (c >= 0x20 && c < 0x7f && c != '?') {  // no trigraphs
+            out += static_cast<char>(c);
+        } else {
+            out += '\\';
+            out += static_cast<char>('0' + (c >> 6));
+            out += static_cast<char>('0' + (c >> 3 & 7));
+            out += static_cast<char>('0' + (c & 7));
+        }
+    }
+    out += '"';
+}
+
+static bool uses_input(const NodeStat* stat) {
+    if (std::holds_alternative<NodeStatInput*>(stat->com))
+        return true;
+    if (auto stat_if = std::get_if<NodeStatIf*>(&stat->com))
+        return uses_input((*stat_if)->then);
+    return false;
+}
+
+void CGenerator::gen_c(Emitter& out) {
+    Cfg cfg{m_node_prog, !m_options.drop_unreachable};
+    cfg.warn_unreachable();
+    m_cfg = &cfg;
+
+    bool input = false;
+    for (size_t i = 0; i < m_node_prog.lines.size(); i++) {
+        gen_line(m_node_prog.lines[i], i);
+        input = input || (cfg.reachable(i) && uses_input(m_node_prog.lines[i]->stat));
+    }
+    m_cfg = nullptr;
+
+    // --int32 only changes the type
+    out.put(C_INCLUDES);
+    if (m_options.int32)
+        out.put("\ntypedef int32_t tb_int;\ntypedef uint32_t tb_uint;\n#define TB_INT_MIN INT32_MIN\n#define TB_INT_MAX INT32_MAX\n#define TB_PRI PRId32\n");
+    else
+        out.put("\ntypedef int64_t tb_int;\ntypedef uint64_t tb_uint;\n#define TB_INT_MIN INT64_MIN\n#define TB_INT_MAX INT64_MAX\n#define TB_PRI PRId64\n");
+    out.put(C_RUNTIME);
+    if (m_node_prog.uses_array) {
+        out.put(std::format("\n#define TB_ARRAY_SIZE {}u\n", m_options.array_size));
+        out.put(C_ARRAY);
+    }
+    if (input) {
+        out.put(std::format("\n#define TB_INPUT_BUFFER_SIZE {}\n", INPUT_BUFFER_SIZE));
+        out.put(C_INPUT);
+    }
+    // a RETURN tests the stack even when no GOSUB ever fills it
+    bool stack = m_returns || m_return;
+    if (stack)
+        out.put(std::format("\n#define TB_GOSUB_DEPTH {}\nstatic uint32_t tb_ret[TB_GOSUB_DEPTH];\n", GOSUB_DEPTH));
+
+    out.put("\nint main(void) {\n");
+    for (char name = 'A'; name <= 'Z'; name++) {
+        if (m_vars.contains(std::string(1, name)))
+            out.put(std::format("    tb_int {} = 0;\n", name));
+    }
+    if (stack)
+        out.put("    size_t tb_sp = 0;\n");
+    if (m_node_prog.uses_array)
+        out.put("    tb_map_array();\n");
+    out.put("\n");
+
+    out.put(m_body);
+
+    out.put("\ntb_exit:\n    fflush(NULL);\n    return 0;\n");
+
+    if (stack) {  // back to the GOSUB on top of the stack
+        out.put("\ntb_return:\n    switch (tb_ret[--tb_sp]) {\n");
+        for (size_t i = 0; i < m_returns; i++)
+            out.put(std::format("        case {0}: goto R{0};\n", i));
+        out.put("    }\n    __builtin_unreachable();\n");
+    }
+    out.put("}\n");
+}
+
+void CGenerator::gen_line(NodeLine* line, size_t index) {
+    m_line = line->line;
+
+    if (!m_cfg->reachable(index)) {  // its vars stay, the lines below may use them
+        check(line->stat);
+        return;
+    }
+
+    if (line->num.has_value() && m_cfg->is_target(index))
+        m_body += line_label(line->num->num) + ":;\n";
+    if (m_options.debug) {
+        m_body += std::format("#line {} ", line->line);
+        put_literal(m_options.source_path, m_body);
+        m_body += '\n';
+    }
+
+    gen_stat(line->stat);
+}
+
+void CGenerator::gen_stat(NodeStat* stat) {
+    struct StatVisitor {
+        CGenerator* gen;
+
+        void operator()(NodeStatPrint* stat_print) {
+            gen->gen_print(stat_print);
+        }
+
+        void operator()(NodeStatLet* stat_let) {
+            if (stat_let->var.index) {  // the value first, then the index, as the native code does
+                std::string value = gen->expr(stat_let->expr);
+                gen->m_body += std::format("{}{{ tb_int v = {}; {} = v; }}\n", gen->m_indent, value, gen->elem(stat_let->var.index));
+                return;
+            }
+
+            gen->m_vars.insert(stat_let->var.name);
+            gen->m_body += std::format("{}{} = {};\n", gen->m_indent, stat_let->var.name, gen->expr(stat_let->expr));
+        }
+
+        void operator()(NodeStatIf* stat_if) {
+            const char* relop = "";
+            switch (stat_if->relop.type) {
+                case RelopType::eq:  relop = "=="; break;
+                case RelopType::lt:  relop = "<";  break;
+                case RelopType::lte: relop = "<="; break;
+                case RelopType::gt:  relop = ">";  break;
+                case RelopType::gte: relop = ">="; break;
+                case RelopType::ne:
+                case RelopType::crazy: relop = "!="; break;  // generated the same
+            }
+
+            std::string a = gen->expr(stat_if->expr);
+            std::string b = gen->expr(stat_if->expr2);
+            gen->m_body += std::format("{}if ({} {} {}) {{\n", gen->m_indent, a, relop, b);
+
+            gen->m_indent += "    ";
+            gen->gen_stat(stat_if->then);
+            gen->m_indent.resize(gen->m_indent.size() - 4);
+
+            gen->m_body += gen->m_indent + "}\n";
+        }
+
+        void operator()(NodeStatGoto* stat_goto) {
+            gen->m_body += std::format("{}goto {};\n", gen->m_indent, gen->line_label(jump_target(stat_goto->expr)));
+        }
+
+        void operator()(NodeStatInput* stat_input) {
+            for (auto& var: stat_input->var_list.list) {
+                if (var.index) {
+                    gen->m_body += std::format("{}{{ tb_int v = tb_input(); {} = v; }}\n", gen->m_indent, gen->elem(var.index));
+                    continue;
+                }
+
+                if (!gen->m_vars.contains(var.name))
+                    Error::critical(gen->m_line, std::format("Var `{}` doesn't exist!", var.name).c_str());
+                gen->m_body += std::format("{}{} = tb_input();\n", gen->m_indent, var.name);
+            }
+        }
+
+        void operator()(NodeStatGosub* stat_gosub) {
+            size_t site = gen->m_returns++;
+
+            gen->m_body += std::format(
+                "{0}if (tb_sp == TB_GOSUB_DEPTH)\n{0}    tb_fail(\"GOSUB: too deep\\n\");\n"
+                "{0}tb_ret[tb_sp++] = {1};\n{0}goto {2};\nR{1}:;\n",
+                gen->m_indent, site, gen->line_label(jump_target(stat_gosub->expr))
+            );
+        }
+
+        void operator()(NodeStatReturn* stat_return) {
+            // with no GOSUB active it goes on with the next line; the stack is empty without GOSUBs
+            gen->m_body += gen->m_indent + "if (tb_sp)\n" + gen->m_indent + "    goto tb_return;\n";
+            gen->m_return = true;
+        }
+
+        void operator()(NodeStatEnd* stat_end) {
+            gen->m_body += gen->m_indent + "goto tb_exit;\n";
+        }
+
+        void operator()(NodeStatClear* stat_clear) {}
+        void operator()(NodeStatList* stat_list) {}
+        void operator()(NodeStatRun* stat_run) {}
+        void operator()(std::monostate& mono) {}
+    };
+
+    std::visit(StatVisitor{.gen = this}, stat->com);
+}
+
+void CGenerator::gen_print(NodeStatPrint* stat_print) {
+    auto& list = stat_print->exprs->list;
+
+    for (auto& item: list) {
+        bool new_line = &item == &list.back() && !m_options.no_new_line;
+
+        if (auto e = std::get_if<NodeExpr*>(&item)) {
+            // a literal alone is an int, printf needs the tb_int of TB_PRI
+            m_body += std::format("{}printf(\"%\" TB_PRI{}, (tb_int)({}));\n", m_indent, new_line ? " \"\\n\"" : "", expr(*e));
+            continue;
+        }
+
+        // what printf makes of the string as its format, up to a 0 byte
+        const std::string& str = std::get<std::string>(item);
+        std::string text;
+        for (size_t i = 0; i < str.size() && str[i]; i++) {
+            text.push_back(str[i]);
+            if (str[i] == '%' && i + 1 < str.size() && str[i + 1] == '%')
+                i++;
+        }
+        if (new_line)
+            text.push_back('\n');
+
+        if (!text.empty()) {
+            m_body += m_indent + "fputs(";
+            put_literal(text, m_body);
+            m_body += ", stdout);\n";
+        }
+    }
+}
+
+std::string CGenerator::expr(NodeExpr* expr) {
+    if (auto t = std::get_if<NodeTerm*>(&expr->term))
+        return term(*t);
+    if (auto t = std::get_if<NodeTermOp*>(&expr->term))
+        return term_op(*t);
+    return "0";
+}
+
+std::string CGenerator::term(NodeTerm* term) {
+    // like the native code, the sign goes to the first factor
+    if (auto f = std::get_if<NodeFactor*>(&term->fact))
+        return fact(*f, term->is_negative);
+    if (auto f = std::get_if<NodeFactorOp*>(&term->fact))
+        return fact_op(*f, term->is_negative);
+    return "0";
+}
+
+std::string CGenerator::term_op(NodeTermOp* term_op) {
+    std::string a = "0";
+    if (auto t = std::get_if<NodeTerm*>(&term_op->term))
+        a = term(*t);
+    else if (auto t = std::get_if<NodeTermOp*>(&term_op->term))
+        a = this->term_op(*t);
+
+    std::string b = term(std::get<NodeTerm*>(term_op->term2));
+    return std::format("{}({}, {})", term_op->is_add ? "tb_add" : "tb_sub", a, b);
+}
+
+std::string CGenerator::fact(NodeFactor* fact, bool is_negative) {
+    struct FactorVisitor {
+        CGenerator* gen;
+        bool is_negative;
+
+        std::string operator()(NodeNum& num) {
+            return gen->number(num.num, is_negative);
+        }
+
+        std::string operator()(NodeVar& var) {
+            if (var.index)
+                return sign(gen->elem(var.index));
+
+            if (!gen->m_vars.contains(var.name))
+                Error::critical(gen->m_line, std::format("Var `{}` hasn't been initialized!", var.name).c_str());
+            return sign(var.name);
+        }
+
+        std::string operator()(NodeTerm* term) { return sign(gen->term(term)); }
+        std::string operator()(NodeTermOp* term_op) { return sign(gen->term_op(term_op)); }
+
+        std::string sign(std::string value) const {
+            return is_negative ? std::format("tb_neg({})", value) : value;
+        }
+    };
+
+    return std::visit(FactorVisitor{.gen = this, .is_negative = is_negative}, fact->body);
+}
+
+std::string CGenerator::fact_op(NodeFactorOp* fact_op, bool is_negative) {
+    std::string a;
+    if (auto f = std::get_if<NodeFactor*>(&fact_op->fact))
+        a = fact(*f, is_negative);
+    else
+        a = this->fact_op(std::get<NodeFactorOp*>(fact_op->fact), is_negative);
+
+    std::string b = fact(std::get<NodeFactor*>(fact_op->fact2), false);
+    return std::format("{}({}, {})", fact_op->is_mul ? "tb_mul" : "tb_div", a, b);
+}
+
+std::string CGenerator::elem(NodeExpr* index) {
+    // a constant index is checked right here
+    if (auto term = std::get_if<NodeTerm*>(&index->term)) {
+        auto fact = std::get_if<NodeFactor*>(&(*term)->fact);
+        auto num = fact ? std::get_if<NodeNum>(&(*fact)->body) : nullptr;
+
+        if (num) {
+            int64_t i = std::stoll(number(num->num, (*term)->is_negative));
+            if (i < 0 || static_cast<uint64_t>(i) >= m_options.array_size)
+                Error::critical(m_line, std::format("Index {} is out of the `@` array!", i).c_str());
+            return std::format("tb_array[{}]", i);
+        }
+    }
+
+    return std::format("tb_array[tb_index({})]", expr(index));
+}
+
+std::string CGenerator::number(const std::string& num, bool is_negative) {
+    int64_t value = std::stoll(is_negative ? "-" + num : num);  // the parser has checked that it fits
+
+    if (value == (m_options.int32 ? INT32_MIN : INT64_MIN))  // no literal of its own in C
+        return "TB_INT_MIN";
+    return value < 0 ? std::format("({})", value) : std::to_string(value);
+}
+
+std::string CGenerator::line_label(const std::string& num) {
+    try {
+        return std::format("L{}", std::stoull(num));
+    } catch (const std::out_of_range&) {
+        Error::critical(m_line, std::format("Line number `{}` is too big!", num).c_str());
+    }
+}
+
+void CGenerator::check(NodeStat* stat) {
+    // the C of its expressions is built and thrown away, that is where the errors come from
+    struct CheckVisitor {
+        CGenerator* gen;
+
+        void operator()(NodeStatPrint* stat_print) {
+            for (auto& item: stat_print->exprs->list) {
+                if (auto e = std::get_if<NodeExpr*>(&item))
+                    gen->expr(*e);
+            }
+        }
+
+        void operator()(NodeStatLet* stat_let) {
+            if (stat_let->var.index) {
+                gen->expr(stat_let->expr);
+                gen->elem(stat_let->var.index);
+                return;
+            }
+
+            gen->m_vars.insert(stat_let->var.name);
+            gen->expr(stat_let->expr);
+        }
+
+        void operator()(NodeStatIf* stat_if) {
+            gen->expr(stat_if->expr);
+            gen->expr(stat_if->expr2);
+            gen->check(stat_if->then);
+        }
+
+        void operator()(NodeStatInput* stat_input) {
+            for (auto& var: stat_input->var_list.list) {
+                if (var.index)
+                    gen->elem(var.index);
+                else if (!gen->m_vars.contains(var.name))
+                    Error::critical(gen->m_line, std::format("Var `{}` doesn't exist!", var.name).c_str());
+            }
+        }
+
+        void operator()(NodeStatGoto* stat_goto) {}  // the parser checks the targets
+        void operator()(NodeStatGosub* stat_gosub) {}
+        void operator()(NodeStatReturn* stat_return) {}
+        void operator()(NodeStatClear* stat_clear) {}
+        void operator()(NodeStatList* stat_list) {}
+        void operator()(NodeStatRun* stat_run) {}
+        void operator()(NodeStatEnd* stat_end) {}
+        void operator()(std::monostate& mono) {}
+    };
+
+    std::visit(CheckVisitor{.gen = this}, stat->com);
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <unordered_set>
+#include <utility>
+
+#include "cfg.hpp"
+#include "emitter.hpp"
+#include "generator.hpp"
+#include "parser.hpp"
+
+/*
+    --emit=c: the program as one C translation unit, built by the system C
+    compiler with -O2. The vars are locals of main, a numbered line that
+    is jumped to is the label L<num>, and a GOSUB pushes the number of its
+    return site on a stack that RETURN pops and switches on. PRINT, INPUT
+    and `@` go through a small runtime in front of main with the output,
+    input syntax, runtime errors and exit codes of the native code; the
+    arithmetic wraps around and a division traps like idiv.
+*/
+class CGenerator {
+public:
+    CGenerator(NodeProg& node_prog, GenOptions options)
+        : m_node_prog(std::move(node_prog)), m_options(std::move(options)) {}
+
+    void gen_c(Emitter& out);
+
+private:
+    void gen_line(NodeLine* line, size_t index);
+    void gen_stat(NodeStat* stat);
+    void gen_print(NodeStatPrint* stat_print);
+
+    std::string expr(NodeExpr* expr);
+    std::string term(NodeTerm* term);
+    std::string term_op(NodeTermOp* term_op);
+    std::string fact(NodeFactor* fact, bool is_negative);
+    std::string fact_op(NodeFactorOp* fact_op, bool is_negative);
+    std::string elem(NodeExpr* index);  // the lvalue of @(index)
+    std::string number(const std::string& num, bool is_negative);
+
+    std::string line_label(const std::string& num);
+    void check(NodeStat* stat);  // the errors of gen_stat on an unreachable line, and the vars its LETs set
+
+    NodeProg m_node_prog;
+    GenOptions m_options;
+    const Cfg* m_cfg = nullptr;
+
+    std::string m_body;  // of main, the vars it declares go in front of it
+    std::string m_indent = "    ";
+    std::unordered_set<std::string> m_vars;  // set by a LET above the current line
+    size_t m_returns = 0;  // return sites of GOSUB
+    bool m_return = false;  // some RETURN was generated
+    size_t m_line = 1;
+};
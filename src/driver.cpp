@@ -0,0 +1,338 @@
+#include <cstdlib>
+#include <exception>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <set>
+#include <stdexcept>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "cgen.hpp"
+#include "driver.hpp"
+#include "emitter.hpp"
+#include "error.hpp"
+#include "frontend.hpp"
+#include "generator.hpp"
+#include "lexer.hpp"
+#include "parser.hpp"
+#include "profile.hpp"
+#include "thread_pool.hpp"
+#include "toolchain.hpp"
+
+namespace fs = std::filesystem;
+
+static const char* output_extension(Emit emit) {
+    switch (emit) {
+        case Emit::obj:    return ".o";
+        case Emit::shared: return ".so";
+        default:           return "";
+    }
+}
+
+bool Driver::plan(std::vector<Job>& jobs) {
+    const auto& inputs = m_options.inputs;
+    const char* extension = output_extension(m_options.gen.emit);
+
+    if (inputs.size() == 1) {
+        jobs.push_back({
+            .input = inputs.front(),
+            .output = m_options.output.empty() ? std::string("out") + extension : m_options.output
+        });
+        return true;
+    }
+
+    // many inputs: <input without extension>, or <-o dir>/<stem>, with .o or .so for --emit
+    if (!m_options.output.empty()) {
+        std::error_code ec;
+        fs::create_directories(m_options.output, ec);
+    }
+
+    std::set<std::string> outputs;
+    for (auto& input: inputs) {
+        fs::path output = m_options.output.empty()
+            ? fs::path(input).replace_extension()
+            : fs::path(m_options.output) / fs::path(input).stem();
+        output += extension;
+
+        if (output == fs::path(input))
+            output += ".out";
+
+        if (!outputs.insert(output.string()).second) {
+            std::cerr << std::format("Output `{}` is produced by more than one input\n", output.string());
+            return false;
+        }
+
+        jobs.push_back({.input = input, .output = output.string()});
+    }
+
+    return true;
+}
+
+JobResult Driver::compile(const Job& job) {
+    Options options = m_options;
+    options.gen.profile_path = job.output + ".prof";
+    options.gen.source_path = fs::absolute(job.input).string();
+
+    if (m_options.stream)
+        return stream(job, options);
+
+    if (m_options.inputs.size() == 1)  // nothing else to run in parallel
+        options.gen.threads = m_options.jobs;
+
+    std::fstream input(job.input, std::ios::in);
+    if (!input.is_open())
+        return {.ok = false, .diagnostics = std::format("Cannot open `{}`\n", job.input)};
+
+    std::stringstream code_stream;
+    code_stream << input.rdbuf();
+    input.close();
+
+    return build(code_stream.str(), job.output, options);
+}
+
+std::shared_ptr<const Profile> Driver::load_profile(const std::string& path, const std::string& hash, std::string& text) {
+    // a missing or stale profile only costs the optimizations it would drive
+    std::fstream input(path, std::ios::in);
+    if (!input.is_open()) {
+        Error::sink() << std::format("WARN: cannot open the profile `{}`, compiling without it\n", path);
+        return nullptr;
+    }
+
+    std::stringstream stream;
+    stream << input.rdbuf();
+    text = stream.str();
+
+    std::string error;
+    auto profile = parse_profile(text, hash, error);
+    if (!profile) {
+        Error::sink() << std::format("WARN: profile `{}` rejected ({}), compiling without it\n", path, error);
+        text.clear();
+    }
+
+    return profile;
+}
+
+JobResult Driver::build(std::string code, const std::string& output_path, 
+                        const Options& options, MemoryPool* mem_pool) 
+{
+    JobResult result;
+
+    std::ostringstream diagnostics;
+    Error::set_sink(diagnostics);
+
+    struct SinkGuard {
+        ~SinkGuard() { Error::set_sink(std::cerr); }
+    } sink_guard;
+
+    try {
+        GenOptions gen = options.gen;
+        gen.source_hash = source_hash(code);
+
+        std::string profile_text;
+        if (!gen.profile_use.empty())
+            gen.profile_data = load_profile(gen.profile_use, gen.source_hash, profile_text);
+
+        std::string cache_key;
+        if (options.cache) {
+            cache_key = Cache::key(code, options.cache_flags() + "\n" + profile_text);
+
+            if (m_cache.fetch(cache_key, output_path)) {
+                result.ok = true;
+                result.diagnostics = diagnostics.str();
+                return result;
+            }
+        }
+
+        // every job owns its front end (and so its arenas, unless one is lent) and generator
+        FrontEnd front{code, gen.threads, gen.int32, mem_pool};
+
+        Emitter asm_text;
+        if (gen.emit == Emit::c) {
+            CGenerator g{front.prog(), gen};
+            g.gen_c(asm_text);
+        } else {
+            Generator g{front.prog(), front.unique_let(), gen};
+            g.gen_asm(asm_text);
+        }
+
+        Intermediates temps{output_path, options.keep_temps, gen.emit == Emit::c ? ".c" : ".asm"};
+
+        std::string error;
+        if (!asm_text.write(temps.asm_fd(), error))
+            throw std::runtime_error(std::format("Cannot write the assembly: {}", error));
+
+        std::string tool_output;
+        result.status = assemble(temps, output_path, gen, tool_output);
+        diagnostics << tool_output;
+
+        if (result.status == 0) {
+            if (options.cache)
+                m_cache.store(cache_key, output_path);
+            result.ok = true;
+        }
+    } catch (const std::exception& e) {
+        diagnostics << e.what() << "\n";
+    }
+
+    result.diagnostics = diagnostics.str();
+    return result;
+}
+
+JobResult Driver::stream(const Job& job, const Options& options) {
+    JobResult result;
+
+    std::ostringstream diagnostics;
+    Error::set_sink(diagnostics);
+
+    struct SinkGuard {
+        ~SinkGuard() { Error::set_sink(std::cerr); }
+    } sink_guard;
+
+    try {
+        std::ifstream input(job.input, std::ios::binary);
+        if (!input.is_open())
+            return {.ok = false, .diagnostics = std::format("Cannot open `{}`\n", job.input)};
+
+        Intermediates temps{job.output, options.keep_temps};
+        int fd = temps.asm_fd();
+
+        // a source line at a time: its tokens, its nodes and its code are gone before the next one
+        Lexer l{input};
+        MemoryPool mem_pool;
+        Parser p{mem_pool};
+        p.set_int32(options.gen.int32);
+        Generator g{options.gen};
+        Emitter asm_text;
+
+        std::vector<Token> tokens;
+        std::vector<NodeLine*> lines;
+        std::string error;
+
+        g.stream_begin(asm_text);
+        while (l.next_line(tokens)) {
+            lines.clear();
+            p.parse_lines(tokens, lines);
+
+            for (auto line: lines)
+                g.stream_line(line, asm_text);
+            mem_pool.reset();
+
+            if (asm_text.size() >= STREAM_FLUSH_SIZE && !asm_text.flush(fd, error))
+                throw std::runtime_error(std::format("Cannot write the assembly: {}", error));
+        }
+
+        p.check_targets();
+        g.stream_end(p.uses_array(), asm_text);
+
+        if (!asm_text.flush(fd, error))
+            throw std::runtime_error(std::format("Cannot write the assembly: {}", error));
+
+        std::string tool_output;
+        result.status = assemble(temps, job.output, options.gen, tool_output);
+        result.ok = result.status == 0;
+        diagnostics << tool_output;
+    } catch (const std::exception& e) {
+        diagnostics << e.what() << "\n";
+    }
+
+    result.diagnostics = diagnostics.str();
+    return result;
+}
+
+int Driver::assemble(const Intermediates& temps, const std::string& output_path, const GenOptions& gen,
+                     std::string& tool_output)
+{
+    std::error_code ec;
+    fs::remove(output_path, ec);  // may be a hard link into the cache
+
+    auto run = [&tool_output](const std::vector<std::string>& argv, int input_fd) {
+        int status = run_tool(argv, input_fd, tool_output);
+        if (status > 128)
+            tool_output += std::format("`{}` killed by signal {}\n", argv.front(), status - 128);
+        else if (status && status != 127)  // 127 - couldn't start, run_tool said why
+            tool_output += std::format("`{}` failed with exit status {}\n", argv.front(), status);
+        return status;
+    };
+
+    if (gen.emit == Emit::c) {  // compiled and linked in one go, the C says where its lines are for -g
+        std::vector<std::string> cc = {"cc", "-O2", "-x", "c", temps.asm_path(), "-o", output_path};
+        if (gen.debug)
+            cc.insert(cc.begin() + 2, "-g");
+        return run(cc, temps.asm_fd());
+    }
+
+    // --emit=obj wants the object itself
+    const std::string& obj_path = gen.emit == Emit::obj ? output_path : temps.obj_path();
+
+    std::vector<std::string> assembler;
+    if (gen.syntax == Syntax::gas) {  // takes the line info from .file and .loc, no flag for it
+        assembler = {"as", "--64", temps.asm_path(), "-o", obj_path};
+    } else {
+        assembler = {"nasm", "-felf64", temps.asm_path(), "-o", obj_path};
+        if (gen.debug)
+            assembler.insert(assembler.begin() + 2, {"-g", "-F", "dwarf"});
+    }
+
+    if (int status = run(assembler, temps.asm_fd()))
+        return status;
+
+    if (gen.emit == Emit::obj)
+        return 0;
+    if (gen.emit == Emit::shared || gen.emit == Emit::repl)  // the function needs no library, only the callbacks of its host
+        return run({"ld", "-shared", "-o", output_path, obj_path}, -1);
+
+    return run({
+        "ld", "-o", output_path, temps.obj_path(), "-lc", "--dynamic-linker", "/lib64/ld-linux-x86-64.so.2"
+    }, -1);
+}
+
+int Driver::run() {
+    std::vector<Job> jobs;
+    if (!plan(jobs))
+        return EXIT_FAILURE;
+
+    std::vector<JobResult> results(jobs.size());
+
+    if (jobs.size() == 1) {
+        results.front() = compile(jobs.front());
+    } else {
+        ThreadPool pool{std::min(m_options.jobs, jobs.size())};
+
+        for (size_t i = 0; i < jobs.size(); i++)
+            pool.submit([this, &jobs, &results, i] { results[i] = compile(jobs[i]); });
+
+        pool.wait();
+    }
+
+    size_t failed = 0;
+    int status = EXIT_SUCCESS;  // of the first program that failed
+    for (size_t i = 0; i < jobs.size(); i++) {
+        auto& result = results[i];
+
+        if (!result.ok && !failed++)
+            status = result.status;
+
+        if (result.diagnostics.empty())
+            continue;
+
+        if (jobs.size() == 1) {
+            std::cerr << result.diagnostics;
+        } else {  // tag every line with its file
+            std::istringstream lines(result.diagnostics);
+            for (std::string line; std::getline(lines, line);)
+                std::cerr << jobs[i].input << ": " << line << "\n";
+        }
+    }
+
+    if (jobs.size() > 1 && failed)
+        std::cerr << std::format("{} of {} programs failed to compile\n", failed, jobs.size());
+
+    if (m_options.cache_stats)
+        m_cache.print_stats(std::cout);
+
+    return status;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "cache.hpp"
+#include "emitter.hpp"
+#include "mem_pool.hpp"
+#include "options.hpp"
+#include "profile.hpp"
+#include "toolchain.hpp"
+
+constexpr size_t STREAM_FLUSH_SIZE = 4 * EMITTER_CHUNK_SIZE;  // of assembly kept before it is written
+
+struct Job {
+    std::string input;
+    std::string output;  // executable (or object, shared library), --keep-temps leaves <output>.asm and <output>.o by it
+};
+
+struct JobResult {
+    bool ok = false;
+    int status = EXIT_FAILURE;  // when not ok: exit status of the assembler or linker that failed, or EXIT_FAILURE
+    std::string diagnostics;  // warnings, errors and assembler/linker output
+};
+
+class Driver {
+public:
+    Driver(const Options& options, Cache& cache) : m_options(options), m_cache(cache) {}
+
+    bool plan(std::vector<Job>& jobs);
+    JobResult compile(const Job& job);
+    JobResult build(std::string code, const std::string& output_path, 
+                    const Options& options, MemoryPool* mem_pool = nullptr);
+    int run();
+
+    // exit status of the failed tool, 0 - linked (also the pieces of --repl)
+    static int assemble(const Intermediates& temps, const std::string& output_path, const GenOptions& gen,
+                        std::string& tool_output);
+
+private:
+    JobResult stream(const Job& job, const Options& options);  // --stream
+    std::shared_ptr<const Profile> load_profile(const std::string& path, const std::string& hash, std::string& text);
+
+    const Options& m_options;
+    Cache& m_cache;
+};
@@ -0,0 +1,88 @@
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "emitter.hpp"
+
+void Emitter::grow() {
+    if (!m_chunks.empty())
+        m_sizes.push_back(m_pos - m_chunks.back().get());
+
+    m_chunks.push_back(std::make_unique_for_overwrite<char[]>(EMITTER_CHUNK_SIZE));
+    m_pos = m_chunks.back().get();
+    m_end = m_pos + EMITTER_CHUNK_SIZE;
+}
+
+size_t Emitter::size() const {
+    size_t size = m_pos - m_chunks.back().get();
+    for (size_t chunk: m_sizes)
+        size += chunk;
+    return size;
+}
+
+bool Emitter::write(int fd, std::string& error) const {
+    std::vector<iovec> iov(m_chunks.size());
+    for (size_t i = 0; i < m_chunks.size(); i++) {
+        size_t size = i < m_sizes.size() ? m_sizes[i] : m_pos - m_chunks[i].get();
+        iov[i] = {.iov_base = m_chunks[i].get(), .iov_len = size};
+    }
+
+    for (size_t first = 0; first < iov.size();) {
+        int count = static_cast<int>(std::min<size_t>(iov.size() - first, IOV_MAX));
+
+        ssize_t written = writev(fd, &iov[first], count);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            error = std::strerror(errno);
+            return false;
+        }
+
+        // a short write leaves the rest of a chunk for the next call
+        auto left = static_cast<size_t>(written);
+        while (first < iov.size() && left >= iov[first].iov_len)
+            left -= iov[first++].iov_len;
+
+        if (left) {
+            iov[first].iov_base = static_cast<char*>(iov[first].iov_base) + left;
+            iov[first].iov_len -= left;
+        }
+    }
+
+    return true;
+}
+
+bool Emitter::flush(int fd, std::string& error) {
+    bool ok = write(fd, error);
+
+    m_chunks.resize(1);
+    m_sizes.clear();
+    m_pos = m_chunks.front().get();
+    m_end = m_pos + EMITTER_CHUNK_SIZE;
+
+    return ok;
+}
+
+bool Emitter::write_file(const std::string& path, std::string& error) const {
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        error = std::strerror(errno);
+        return false;
+    }
+
+    bool ok = write(fd, error);
+    if (close(fd) < 0 && ok) {
+        error = std::strerror(errno);
+        ok = false;
+    }
+
+    return ok;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+constexpr size_t EMITTER_CHUNK_SIZE = 1 << 20;
+
+/*
+    Append-only text buffer of the assembly. It grows by whole chunks, so
+    nothing written is ever moved or copied again, and the chunks go to the
+    file as they are with writev.
+*/
+class Emitter {
+public:
+    Emitter() { grow(); }
+
+    void put(char c) {
+        if (m_pos == m_end)
+            grow();
+        *m_pos++ = c;
+    }
+
+    void put(std::string_view str) {
+        while (static_cast<size_t>(m_end - m_pos) < str.size()) {
+            size_t room = m_end - m_pos;
+            std::memcpy(m_pos, str.data(), room);
+            m_pos += room;
+            str.remove_prefix(room);
+            grow();
+        }
+        std::memcpy(m_pos, str.data(), str.size());
+        m_pos += str.size();
+    }
+
+    template <typename Int>
+    void put_int(Int value) {
+        if (m_end - m_pos < 24)  // the longest 64-bit number, with its sign
+            grow();
+        m_pos = std::to_chars(m_pos, m_end, value).ptr;
+    }
+
+    size_t size() const;
+
+    bool write(int fd, std::string& error) const;  // the whole text, error is strerror
+    bool write_file(const std::string& path, std::string& error) const;
+    bool flush(int fd, std::string& error);  // write and start over, for output too big to keep
+private:
+    void grow();
+
+    std::vector<std::unique_ptr<char[]>> m_chunks;
+    std::vector<size_t> m_sizes;  // of the full chunks, the last one ends at m_pos
+    char* m_pos = nullptr;
+    char* m_end = nullptr;
+};
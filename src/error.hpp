@@ -3,6 +3,19 @@
 #include <format>
 #include <cstddef>
 #include <iostream>
+#include <stdexcept>
+#include <string>
+
+class CompileError : public std::runtime_error {
+public:
+    CompileError(size_t line, const char* msg)
+        : std::runtime_error(std::format("ERROR (line={}): {}", line, msg)), m_line(line) {}
+
+    size_t line() const { return m_line; }
+
+private:
+    size_t m_line;
+};
 
 class Error {
 public:
@@ -13,11 +26,22 @@ public:
     Error(Error&& copy) = delete;
 
     inline static void warning(size_t line, const char* msg) {
-        std::cerr << std::format("WARN (line={}): {}\n", line, msg);
+        *s_sink << std::format("WARN (line={}): {}\n", line, msg);
     }
 
-    inline static void critical(size_t line, const char* msg) {
-        std::cerr << std::format("ERROR (line={}): {}\n", line, msg);
-        exit(1);
+    [[noreturn]] inline static void critical(size_t line, const char* msg) {
+        throw CompileError(line, msg);  // whoever drives the compilation reports it
     }
-};
\ No newline at end of file
+
+    // where warnings of the current thread go (every batch job has its own)
+    inline static void set_sink(std::ostream& sink) {
+        s_sink = &sink;
+    }
+
+    inline static std::ostream& sink() {
+        return *s_sink;
+    }
+
+private:
+    inline static thread_local std::ostream* s_sink = &std::cerr;
+};
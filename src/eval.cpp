@@ -0,0 +1,370 @@
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <format>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "cfg.hpp"
+#include "eval.hpp"
+#include "parser.hpp"
+
+// the wrapping arithmetic of the generated code
+static int64_t wrap_add(int64_t a, int64_t b) { return static_cast<int64_t>(static_cast<uint64_t>(a) + b); }
+static int64_t wrap_sub(int64_t a, int64_t b) { return static_cast<int64_t>(static_cast<uint64_t>(a) - b); }
+static int64_t wrap_mul(int64_t a, int64_t b) { return static_cast<int64_t>(static_cast<uint64_t>(a) * b); }
+static int64_t wrap_neg(int64_t a) { return static_cast<int64_t>(0 - static_cast<uint64_t>(a)); }
+
+PartialEval::PartialEval(
+    const NodeProg& prog, const Cfg& cfg, const std::vector<bool>& resumable, const EvalBudget& budget
+) : m_cfg(cfg), m_resumable(resumable), m_budget(budget)
+{
+    if (!prog.lines.empty())
+        run(prog);
+}
+
+void PartialEval::run(const NodeProg& prog) {
+    size_t i = 0;
+
+    for (;;) {
+        if (i >= prog.lines.size()) {  // fell off the end
+            m_finished = true;
+            return;
+        }
+
+        if (m_returns.empty() && m_resumable[i])
+            save(i);
+
+        if (m_steps == m_budget.steps) {
+            m_reason = "the step budget";
+            break;
+        }
+        m_steps++;
+
+        Flow flow = exec(prog.lines[i]->stat, i);
+        if (memory() > m_budget.memory) {
+            m_reason = "the memory budget";
+            break;
+        }
+
+        if (flow == Flow::next) {
+            i++;
+        } else if (flow == Flow::jump) {
+            i = m_target;
+        } else if (flow == Flow::end) {
+            m_finished = true;
+            return;
+        } else {
+            break;
+        }
+    }
+
+    restore();
+}
+
+void PartialEval::save(size_t line) {
+    m_checkpoint = {.line = line, .steps = m_steps, .output = m_output.size(), .vars = m_vars, .set = m_set};
+    m_undo.clear();
+}
+
+void PartialEval::restore() {
+    m_output.resize(m_checkpoint.output);
+    m_vars = m_checkpoint.vars;
+    m_set = m_checkpoint.set;
+
+    for (auto it = m_undo.rbegin(); it != m_undo.rend(); it++) {
+        if (it->second)
+            m_array[it->first] = *it->second;
+        else
+            m_array.erase(it->first);
+    }
+    m_undo.clear();
+    m_returns.clear();
+
+    m_resume = m_checkpoint.line;
+    m_steps = m_checkpoint.steps;
+}
+
+size_t PartialEval::memory() const {
+    return m_output.size() + (m_array.size() + m_undo.size()) * 16 + m_returns.size() * 8;
+}
+
+PartialEval::Flow PartialEval::exec(const NodeStat* stat, size_t line) {
+    struct StatVisitor {
+        PartialEval* eval;
+        size_t line;
+
+        Flow operator()(const NodeStatPrint* stat_print) {
+            eval->print(stat_print);
+            return eval->m_failed ? Flow::stop : Flow::next;
+        }
+
+        Flow operator()(const NodeStatLet* stat_let) {
+            int64_t value = eval->expr(stat_let->expr);
+
+            if (stat_let->var.index) {
+                auto index = eval->index(stat_let->var.index);
+                if (!index)
+                    return Flow::stop;
+                eval->store(*index, value);
+                return Flow::next;
+            }
+
+            if (eval->m_failed)
+                return Flow::stop;
+
+            size_t v = stat_let->var.name.at(0) - 'A';  // the parser made sure it's a capital letter
+            eval->m_vars[v] = value;
+            eval->m_set |= 1u << v;
+            return Flow::next;
+        }
+
+        Flow operator()(const NodeStatIf* stat_if) {
+            int64_t a = eval->expr(stat_if->expr);
+            int64_t b = eval->expr(stat_if->expr2);
+            if (eval->m_failed)
+                return Flow::stop;
+
+            bool then = false;
+            switch (stat_if->relop.type) {
+                case RelopType::eq:  then = a == b; break;
+                case RelopType::lt:  then = a < b;  break;
+                case RelopType::lte: then = a <= b; break;
+                case RelopType::gt:  then = a > b;  break;
+                case RelopType::gte: then = a >= b; break;
+                case RelopType::ne:
+                case RelopType::crazy: then = a != b; break;  // generated the same
+            }
+
+            return then ? eval->exec(stat_if->then, line) : Flow::next;
+        }
+
+        Flow operator()(const NodeStatGoto* stat_goto) {
+            eval->m_target = eval->m_cfg.index_of(jump_target(stat_goto->expr));
+            return Flow::jump;
+        }
+
+        Flow operator()(const NodeStatGosub* stat_gosub) {
+            eval->m_returns.push_back(line + 1);  // the GOSUB ends its line
+            eval->m_target = eval->m_cfg.index_of(jump_target(stat_gosub->expr));
+            return Flow::jump;
+        }
+
+        Flow operator()(const NodeStatReturn* stat_return) {
+            if (eval->m_returns.empty())  // the generated code goes on as well
+                return Flow::next;
+
+            eval->m_target = eval->m_returns.back();
+            eval->m_returns.pop_back();
+            return Flow::jump;
+        }
+
+        Flow operator()(const NodeStatInput* stat_input) {
+            eval->m_reason = "INPUT";
+            return Flow::stop;
+        }
+
+        Flow operator()(const NodeStatEnd* stat_end) { return Flow::end; }
+
+        Flow operator()(const NodeStatClear* stat_clear) { return Flow::next; }
+        Flow operator()(const NodeStatList* stat_list) { return Flow::next; }
+        Flow operator()(const NodeStatRun* stat_run) { return Flow::next; }
+        Flow operator()(const std::monostate& mono) { return Flow::next; }
+    };
+
+    return std::visit(StatVisitor{.eval = this, .line = line}, stat->com);
+}
+
+void PartialEval::print(const NodeStatPrint* stat_print) {
+    auto& list = stat_print->exprs->list;
+
+    for (auto& item: list) {
+        bool new_line = &item == &list.back() && !m_budget.no_new_line;
+
+        if (auto e = std::get_if<NodeExpr*>(&item)) {
+            int64_t value = expr(*e);
+            if (m_failed)
+                return;
+
+            char buf[24];
+            m_output.append(buf, std::to_chars(buf, buf + sizeof(buf), value).ptr);
+        } else {
+            // the string is the format of a printf, and ends at a 0 byte like one
+            const std::string& str = std::get<std::string>(item);
+
+            for (size_t i = 0; i < str.size() && str[i]; i++) {
+                if (str[i] == '%') {
+                    if (i + 1 == str.size() || str[i + 1] != '%') {
+                        m_reason = "a printf conversion in a PRINT";
+                        m_failed = true;
+                        return;
+                    }
+                    i++;
+                }
+                m_output.push_back(str[i]);
+            }
+        }
+
+        if (new_line)
+            m_output.push_back('\n');
+    }
+}
+
+void PartialEval::store(size_t index, int64_t value) {
+    auto elem = m_array.find(index);
+    m_undo.push_back({index, elem == m_array.end() ? std::nullopt : std::optional<int64_t>(elem->second)});
+    m_array[index] = value;
+}
+
+int64_t PartialEval::expr(const NodeExpr* expr) {
+    if (auto t = std::get_if<NodeTerm*>(&expr->term))
+        return term(*t);
+    if (auto t = std::get_if<NodeTermOp*>(&expr->term))
+        return term_op(*t);
+
+    m_failed = true;
+    return 0;
+}
+
+int64_t PartialEval::term(const NodeTerm* term) {
+    // like the generator, the sign goes to the first factor
+    if (auto f = std::get_if<NodeFactor*>(&term->fact))
+        return fact(*f, term->is_negative);
+    if (auto f = std::get_if<NodeFactorOp*>(&term->fact))
+        return fact_op(*f, term->is_negative);
+
+    m_failed = true;
+    return 0;
+}
+
+int64_t PartialEval::term_op(const NodeTermOp* term_op) {
+    int64_t a = 0;
+    if (auto t = std::get_if<NodeTerm*>(&term_op->term))
+        a = term(*t);
+    else if (auto t = std::get_if<NodeTermOp*>(&term_op->term))
+        a = this->term_op(*t);
+    else
+        m_failed = true;
+
+    int64_t b = term(std::get<NodeTerm*>(term_op->term2));
+    return wrap(term_op->is_add ? wrap_add(a, b) : wrap_sub(a, b));
+}
+
+int64_t PartialEval::fact(const NodeFactor* fact, bool is_negative) {
+    struct FactorVisitor {
+        PartialEval* eval;
+        bool is_negative;
+
+        int64_t operator()(const NodeNum& num) { return eval->number(num.num, is_negative); }
+        int64_t operator()(const NodeVar& var) { return sign(eval->var(var)); }
+        int64_t operator()(const NodeTerm* term) { return sign(eval->term(term)); }
+        int64_t operator()(const NodeTermOp* term_op) { return sign(eval->term_op(term_op)); }
+
+        int64_t sign(int64_t value) const { return is_negative ? eval->wrap(wrap_neg(value)) : value; }
+    };
+
+    return std::visit(FactorVisitor{.eval = this, .is_negative = is_negative}, fact->body);
+}
+
+int64_t PartialEval::fact_op(const NodeFactorOp* fact_op, bool is_negative) {
+    int64_t a = 0;
+    if (auto f = std::get_if<NodeFactor*>(&fact_op->fact))
+        a = fact(*f, is_negative);
+    else
+        a = this->fact_op(std::get<NodeFactorOp*>(fact_op->fact), is_negative);
+
+    int64_t b = fact(std::get<NodeFactor*>(fact_op->fact2), false);
+
+    if (fact_op->is_mul)
+        return wrap(wrap_mul(a, b));
+
+    if (b == 0 || (b == -1 && a == (m_budget.int32 ? INT32_MIN : INT64_MIN))) {  // idiv traps, at run time as it would
+        m_reason = "a division that traps";
+        m_failed = true;
+        return 0;
+    }
+    return a / b;
+}
+
+int64_t PartialEval::var(const NodeVar& var) {
+    if (var.index) {
+        auto index = this->index(var.index);
+        if (!index)
+            return 0;
+
+        auto elem = m_array.find(*index);
+        return elem == m_array.end() ? 0 : elem->second;  // the mapping starts out zeroed
+    }
+
+    auto& name = var.name;
+    if (name.size() == 1 && name[0] >= 'A' && name[0] <= 'Z' && (m_set >> (name[0] - 'A') & 1))
+        return m_vars[name[0] - 'A'];
+
+    // what its stack slot holds isn't known, nor whether the name is a var at all
+    m_reason = "a var read before the run set it";
+    m_failed = true;
+    return 0;
+}
+
+int64_t PartialEval::number(const std::string& num, bool is_negative) {
+    uint64_t magnitude = 0;
+    auto [end, error] = std::from_chars(num.data(), num.data() + num.size(), magnitude);
+
+    uint64_t limit = static_cast<uint64_t>(m_budget.int32 ? INT32_MAX : INT64_MAX) + is_negative;
+    if (error != std::errc() || end != num.data() + num.size() || magnitude > limit) {
+        m_failed = true;  // the parser has rejected it already
+        return 0;
+    }
+
+    return is_negative ? static_cast<int64_t>(0 - magnitude) : static_cast<int64_t>(magnitude);
+}
+
+std::optional<size_t> PartialEval::index(const NodeExpr* expr) {
+    int64_t i = this->expr(expr);
+    if (m_failed)
+        return std::nullopt;
+
+    if (i < 0 || static_cast<uint64_t>(i) >= m_budget.array_size) {
+        m_reason = "an index out of `@`";
+        m_failed = true;
+        return std::nullopt;
+    }
+    return static_cast<size_t>(i);
+}
+
+std::vector<std::pair<char, int64_t>> PartialEval::vars() const {
+    std::vector<std::pair<char, int64_t>> result;
+    for (size_t v = 0; v < m_vars.size(); v++) {
+        if (m_set >> v & 1)
+            result.push_back({static_cast<char>('A' + v), m_vars[v]});
+    }
+    return result;
+}
+
+std::vector<std::pair<size_t, int64_t>> PartialEval::array() const {
+    std::vector<std::pair<size_t, int64_t>> result;
+    for (auto& [index, value]: m_array) {
+        if (value)
+            result.push_back({index, value});
+    }
+    std::sort(result.begin(), result.end());
+    return result;
+}
+
+void PartialEval::dump(const NodeProg& prog, std::ostream& out) const {
+    if (m_finished) {
+        out << std::format("eval: finished after {} lines run, {} bytes of output\n", m_steps, m_output.size());
+        return;
+    }
+
+    auto& line = prog.lines[m_resume];
+    out << std::format(
+        "eval: stopped by {}, starts at {} (line {}) after {} lines run: {} bytes of output, {} vars, {} `@` elements\n",
+        m_reason, line->num.has_value() ? line->num->num : std::format("#{}", line->line), line->line,
+        m_steps, m_output.size(), vars().size(), array().size()
+    );
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "cfg.hpp"
+#include "parser.hpp"
+
+struct EvalBudget {
+    size_t steps;         // lines run
+    size_t memory;        // bytes of output, `@` elements and GOSUB returns
+    size_t array_size;    // elements of `@`, an index outside is a runtime error
+    bool no_new_line;     // PRINT doesn't end with a new line
+    bool int32 = false;   // values wrap around at 32 bits
+};
+
+/*
+    Runs a program at compile time, from its first line for as long as the
+    outcome doesn't depend on anything but the program: up to an INPUT, a
+    runtime error, a var read before the run set it or the end of the budget.
+
+    A finished program is just its output. Otherwise it stops at the last
+    line it could start the compiled code at: no GOSUB active and not inside
+    a loop whose entry code sets up its derived expressions (a loop header
+    is fine, the entry code runs again). What it printed and the vars and
+    `@` elements it set up to that line are the start of the compiled code.
+*/
+class PartialEval {
+public:
+    // resumable - lines the compiled code can start at
+    PartialEval(const NodeProg& prog, const Cfg& cfg, const std::vector<bool>& resumable, const EvalBudget& budget);
+
+    bool finished() const { return m_finished; }
+    bool empty() const { return !m_finished && m_resume == 0; }  // stopped before the first line
+    size_t resume() const { return m_resume; }
+    size_t steps() const { return m_steps; }
+
+    const std::string& output() const { return m_output; }
+    std::vector<std::pair<char, int64_t>> vars() const;         // set by the run, by name
+    std::vector<std::pair<size_t, int64_t>> array() const;      // elements not 0, by index
+
+    void dump(const NodeProg& prog, std::ostream& out) const;
+private:
+    enum class Flow { next, jump, end, stop };
+
+    struct Checkpoint {
+        size_t line = 0;
+        size_t steps = 0;
+        size_t output = 0;
+        std::array<int64_t, 26> vars{};
+        uint32_t set = 0;  // bit per var
+    };
+
+    void run(const NodeProg& prog);
+    void save(size_t line);
+    void restore();
+    size_t memory() const;
+
+    Flow exec(const NodeStat* stat, size_t line);
+    void print(const NodeStatPrint* stat_print);
+    void store(size_t index, int64_t value);
+
+    int64_t expr(const NodeExpr* expr);
+    int64_t term(const NodeTerm* term);
+    int64_t term_op(const NodeTermOp* term_op);
+    int64_t fact(const NodeFactor* fact, bool is_negative);
+    int64_t fact_op(const NodeFactorOp* fact_op, bool is_negative);
+    int64_t var(const NodeVar& var);
+    int64_t number(const std::string& num, bool is_negative);
+    int64_t wrap(int64_t value) const { return m_budget.int32 ? static_cast<int32_t>(value) : value; }
+    std::optional<size_t> index(const NodeExpr* expr);  // of `@`, nullopt - out of it
+
+    const Cfg& m_cfg;
+    const std::vector<bool>& m_resumable;
+    EvalBudget m_budget;
+
+    std::array<int64_t, 26> m_vars{};
+    uint32_t m_set = 0;
+    std::unordered_map<size_t, int64_t> m_array;
+    std::vector<std::pair<size_t, std::optional<int64_t>>> m_undo;  // `@` before the writes since the checkpoint
+    std::vector<size_t> m_returns;  // lines after the active GOSUBs
+    std::string m_output;
+    size_t m_target = 0;  // of the jump exec() returned
+    bool m_failed = false;  // the statement can't run at compile time
+
+    Checkpoint m_checkpoint;
+    size_t m_steps = 0;
+    size_t m_resume = 0;
+    bool m_finished = false;
+    const char* m_reason = "";  // why it stopped
+};
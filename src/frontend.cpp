@@ -0,0 +1,131 @@
+#include <algorithm>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "error.hpp"
+#include "frontend.hpp"
+#include "lexer.hpp"
+#include "parser.hpp"
+#include "thread_pool.hpp"
+
+FrontEnd::FrontEnd(std::string& code, size_t threads, bool int32, MemoryPool* mem_pool) {
+    size_t count = std::min(threads * 4, code.size() / MIN_CHUNK_SIZE);
+    if (threads > 1 && count > 1 && parse_chunks(code, threads, count, int32))
+        return;
+
+    // every job owns its lexer and parser (and so its arena, unless one is lent)
+    Lexer l{code};
+    auto tokens = l.gen_tokens();
+
+    m_parser = mem_pool ? std::make_unique<Parser>(tokens, *mem_pool) : std::make_unique<Parser>(tokens);
+    m_parser->set_int32(int32);
+    m_prog = m_parser->gen_prog();
+}
+
+bool FrontEnd::parse_chunks(const std::string& code, size_t threads, size_t count, bool int32) {
+    struct Chunk {
+        std::string_view text;
+        size_t line;  // of its first line, counting every newline before it
+        bool whole = false;  // every newline in it ended a line
+
+        std::unique_ptr<MemoryPool> mem_pool = std::make_unique<MemoryPool>();
+        std::unique_ptr<Parser> parser;
+        std::vector<NodeLine*> lines;
+
+        std::ostringstream lexer_warnings;
+        std::ostringstream warnings;
+        std::exception_ptr error;
+    };
+
+    std::vector<std::unique_ptr<Chunk>> chunks;
+    const char* begin = code.data();
+    const char* end = begin + code.size();
+    const char* from = begin;
+    size_t line = 1;
+
+    while (from < end) {
+        auto chunk = std::make_unique<Chunk>();
+        chunk->line = line;
+        chunk->parser = Parser::chunk(*chunk->mem_pool, int32);
+
+        // up to the first newline past the next count-th of the code, the rest for the last chunk
+        const char* cut = end;
+        if (chunks.size() + 1 < count) {
+            const char* target = begin + (chunks.size() + 1) * (code.size() / count);
+
+            for (const char* p = from; p < end;) {
+                auto nl = static_cast<const char*>(std::memchr(p, '\n', end - p));
+                if (!nl)
+                    break;
+
+                p = nl + 1;
+                line++;
+                if (nl >= target) {
+                    cut = p;
+                    break;
+                }
+            }
+        }
+
+        chunk->text = std::string_view(from, cut - from);
+        chunks.push_back(std::move(chunk));
+        from = cut;
+    }
+
+    {
+        ThreadPool pool{threads};
+
+        for (auto& chunk: chunks) {
+            pool.submit([chunk = chunk.get()] {
+                try {
+                    Error::set_sink(chunk->lexer_warnings);
+                    std::string text{chunk->text};
+                    Lexer l{text, chunk->line};
+                    auto tokens = l.gen_tokens();
+
+                    // the cr after the last token is on the line the lexer ended at
+                    size_t newlines = std::count(chunk->text.begin(), chunk->text.end(), '\n');
+                    chunk->whole = tokens.empty() ? newlines == 0 : tokens.back().line == chunk->line + newlines;
+
+                    Error::set_sink(chunk->warnings);
+                    chunk->parser->parse_lines(tokens, chunk->lines);
+                } catch (...) {
+                    chunk->error = std::current_exception();
+                }
+                Error::set_sink(std::cerr);
+            });
+        }
+
+        pool.wait();
+    }
+
+    for (size_t i = 0; i + 1 < chunks.size(); i++) {
+        if (!chunks[i]->whole)
+            return false;
+    }
+
+    // a serial run lexes the whole program before parsing any of it
+    for (auto& chunk: chunks)
+        Error::sink() << chunk->lexer_warnings.view();
+
+    m_parser = std::make_unique<Parser>(*chunks.front()->mem_pool);
+
+    for (auto& chunk: chunks) {
+        m_parser->merge(*chunk->parser, chunk->warnings.view());
+        if (chunk->error)
+            std::rethrow_exception(chunk->error);
+
+        m_prog.lines.insert(m_prog.lines.end(), chunk->lines.begin(), chunk->lines.end());
+        m_pools.push_back(std::move(chunk->mem_pool));
+    }
+
+    m_parser->check_targets();
+    m_prog.uses_array = m_parser->uses_array();
+    return true;
+}
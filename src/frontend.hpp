@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "mem_pool.hpp"
+#include "parser.hpp"
+
+constexpr size_t MIN_CHUNK_SIZE = 256 * 1024;  // bytes of source worth a thread of the front end
+
+/*
+    Lexes and parses a program. A big one with threads to spare is cut
+    after newlines into chunks, each lexed and parsed on a thread of its
+    own into an arena of its own. Lines only depend on each other through
+    their numbers, so the parser of the whole program merges the chunks in
+    order and checks row numbers and GOTO targets as it goes, with the same
+    warnings, errors and line numbers as a serial run. A string running
+    over a newline doesn't end its line there, which throws the count of
+    the chunks after it off; such a program is done again in one piece.
+*/
+class FrontEnd {
+public:
+    // the code is moved out, the pool (kept warm between compilations) is only used serially
+    FrontEnd(std::string& code, size_t threads, bool int32, MemoryPool* mem_pool = nullptr);
+
+    NodeProg& prog() { return m_prog; }
+    size_t unique_let() { return m_parser->get_unique_let(); }
+
+private:
+    bool parse_chunks(const std::string& code, size_t threads, size_t count, bool int32);  // false - do it serially
+
+    std::unique_ptr<Parser> m_parser;
+    std::vector<std::unique_ptr<MemoryPool>> m_pools;  // of the chunks, their nodes are the program
+    NodeProg m_prog;
+};
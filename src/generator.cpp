@@ -1,11 +1,24 @@
+#include <algorithm>
+#include <exception>
+#include <memory>
+#include <optional>
 #include <stdexcept>
 #include <format>
 #include <string>
+#include <string_view>
+#include <utility>
 #include <variant>
+#include <vector>
 
+#include "asm.hpp"
+#include "cfg.hpp"
 #include "error.hpp"
 #include "generator.hpp"
+#include "loops.hpp"
 #include "parser.hpp"
+#include "peephole.hpp"
+#include "profile.hpp"
+#include "thread_pool.hpp"
 
 void Generator::remove_extra_zeros(std::string& str) {
     while (true) {
@@ -22,55 +35,105 @@ void Generator::remove_extra_zeros(std::string& str) {
     }
 }
 
-int Generator::write_str_in_data(std::string& str) {
-    if (str.size() == 1 && str.at(0) == '\n') {
-        m_data << std::format(
-            "\tstr{} db 10, 0\n",
-            m_data_counter, str
-        );
-    } else {
-        for (int i = 0; i < str.length(); i++) {  // replace all nl to 10 (for asm)
-            if (str.at(i) == '\n') {
-                str.replace(i, 1, "\', 10, \'");
-            }
-        }
+Label Generator::line_label(std::string num) {
+    remove_extra_zeros(num);
 
-        m_data << std::format(
-        "\tstr{} db \'{}\', 0\n",
-            m_data_counter, str
-        );
+    try {
+        return {.kind = LabelKind::com, .id = std::stoull(num)};
+    } catch (const std::out_of_range&) {
+        Error::critical(m_line, std::format("Line number `{}` is too big!", num).c_str());
     }
+}
 
-    m_data << std::format(
-        "\tlen{} equ $ - str{}\n",
-        m_data_counter, m_data_counter
-    );
+Operand Generator::line_target(const std::string& num) {
+    Label target = line_label(num);
+    return m_line_slot ? mem(Reg::r14, (*m_line_slot)(target.id) * 8) : label(target);
+}
+
+Operand Generator::runtime(const char* name) {
+    if (!m_line_slot)
+        return label(named(name));
+
+    auto slot = std::find_if(std::begin(REPL_RUNTIME), std::end(REPL_RUNTIME), [name](const char* r) {
+        return std::string_view(r) == name;
+    });
+    return mem(Reg::r14, (slot - std::begin(REPL_RUNTIME)) * 8);
+}
+
+int64_t Generator::number(const std::string& num) {
+    return std::stoll(num);  // the parser has checked that it fits
+}
+
+void Generator::push_value(Operand value) {
+    if (value.width == Width::d && value.kind == OperandKind::reg) {  // the garbage above it goes along
+        emit(Op::push, reg(value.reg));
+    } else if (value.width == Width::d) {
+        emit(Op::mov, reg(Reg::rax, Width::d), value);
+        emit(Op::push, reg(Reg::rax));
+    } else {
+        emit(Op::push, value);
+    }
+}
+
+int Generator::write_str_in_data(std::string& str) {
+    m_data.push_back({
+        .kind = DataDef::Kind::bytes, 
+        .label = {.kind = LabelKind::str, .id = m_data_counter}, 
+        .bytes = str
+    });
 
     return m_data_counter++;
 }
 
 void Generator::print_number(bool last_print) {
-    if (last_print) {
-        m_output << "\tmov rdi, frmn\n";
-    } else {
-        m_output << "\tmov rdi, frm\n";
+    if (embedded()) {
+        emit(Op::pop, reg(Reg::rsi));
+        if (m_options.int32)  // the callback takes 64 bits
+            emit(Op::movsxd, reg(Reg::rsi), reg(Reg::rsi, Width::d));
+        emit(Op::call, runtime("rt_print_num"));
+
+        if (last_print) {
+            emit(Op::mov, reg(Reg::rsi), label(named("rt_nl")));
+            emit(Op::mov, reg(Reg::rdx), imm(1));
+            emit(Op::call, runtime("rt_print_text"));
+        }
+        return;
     }
 
-    m_output << "\tpop rsi\n";
-    m_output << "\txor eax, eax\n";
-    m_output << "\tcall printf\n";
+    emit(Op::mov, reg(Reg::rdi), label(named(last_print ? "frmn" : "frm")));
+    emit(Op::pop, reg(Reg::rsi));
+    emit(Op::_xor, reg(Reg::rax, Width::d), reg(Reg::rax, Width::d));
+    emit(Op::call, label(named("printf")));
 }
 
 void Generator::print_str(std::string& str, bool last_print) {
+    if (embedded()) {  // the text printf would print, and its new line
+        std::string text;
+        for (size_t i = 0; i < str.size() && str[i]; i++) {
+            text.push_back(str[i]);
+            if (str[i] == '%' && i + 1 < str.size() && str[i + 1] == '%')
+                i++;
+        }
+        if (last_print)
+            text.push_back('\n');
+
+        int str_index = write_str_in_data(text);
+
+        emit(Op::mov, reg(Reg::rsi), label({.kind = LabelKind::str, .id = static_cast<uint64_t>(str_index)}));
+        emit(Op::mov, reg(Reg::rdx), imm(text.size()));
+        emit(Op::call, runtime("rt_print_text"));
+        return;
+    }
+
     int str_index = write_str_in_data(str);
     
-    m_output << "\tmov rdi, str" << str_index << "\n";
-    m_output << "\txor eax, eax\n";
-    m_output << "\tcall printf\n";
+    emit(Op::mov, reg(Reg::rdi), label({.kind = LabelKind::str, .id = static_cast<uint64_t>(str_index)}));
+    emit(Op::_xor, reg(Reg::rax, Width::d), reg(Reg::rax, Width::d));
+    emit(Op::call, label(named("printf")));
 
     if (last_print) {
-        m_output << "\tmov rdi, 10\n";
-        m_output << "\tcall putchar\n";
+        emit(Op::mov, reg(Reg::rdi), imm(10));
+        emit(Op::call, label(named("putchar")));
     }
 }
 
@@ -80,6 +143,19 @@ void Generator::gen_fact(NodeFactor* fact, bool is_negative) {
         bool is_negative;
 
         void operator()(NodeVar& var) {
+            if (var.index) {
+                Operand elem = gen->gen_array_elem(var.index);
+
+                if (is_negative) {
+                    gen->emit(Op::mov, gen->val(Reg::rax), elem);
+                    gen->emit(Op::neg, gen->val(Reg::rax));
+                    gen->emit(Op::push, reg(Reg::rax));
+                } else {
+                    gen->push_value(elem);
+                }
+                return;
+            }
+
             if (!gen->m_vars.contains(var.name)) {
                 Error::critical(
                     gen->m_line, std::format("Var `{}` hasn't been initialized!", var.name).c_str()
@@ -89,30 +165,26 @@ void Generator::gen_fact(NodeFactor* fact, bool is_negative) {
             auto& v = gen->m_vars.at(var.name);
 
             if (is_negative) {
-                gen->m_output << "\tmov rax, " << gen->get_var_value(v.stack_loc) << "\n";
-                gen->m_output << "\tneg rax\n";
-                gen->m_output << "\tpush rax\n";
+                gen->emit(Op::mov, gen->val(Reg::rax), gen->get_var(v));
+                gen->emit(Op::neg, gen->val(Reg::rax));
+                gen->emit(Op::push, reg(Reg::rax));
             } else {
-                gen->m_output << "\tpush " << gen->get_var_value(v.stack_loc) << "\n";
+                gen->push_value(gen->get_var(v));
             }
         }
 
         void operator()(NodeNum& num) {
-            if (is_negative) {
-                num.num.insert(0, 1, '-');
-            }
-
-            gen->m_output << "\tmov rax, " << num.num << "\n";
-            gen->m_output << "\tpush rax\n";
+            gen->emit(Op::mov, reg(Reg::rax), imm(gen->number(is_negative ? "-" + num.num : num.num)));
+            gen->emit(Op::push, reg(Reg::rax));
         }
 
         void operator()(NodeTerm* term) {
             gen->gen_term(term);
             
             if (is_negative) {
-                gen->m_output << "\tpop rax\n";
-                gen->m_output << "\tneg rax\n";
-                gen->m_output << "\tpush rax\n";
+                gen->emit(Op::pop, reg(Reg::rax));
+                gen->emit(Op::neg, gen->val(Reg::rax));
+                gen->emit(Op::push, reg(Reg::rax));
             }
         }
 
@@ -120,9 +192,9 @@ void Generator::gen_fact(NodeFactor* fact, bool is_negative) {
             gen->gen_term_op(term_op);
 
             if (is_negative) {
-                gen->m_output << "\tpop rax\n";
-                gen->m_output << "\tneg rax\n";
-                gen->m_output << "\tpush rax\n";
+                gen->emit(Op::pop, reg(Reg::rax));
+                gen->emit(Op::neg, gen->val(Reg::rax));
+                gen->emit(Op::push, reg(Reg::rax));
             }
         }
     };
@@ -149,17 +221,40 @@ void Generator::gen_fact_op(NodeFactorOp* fact_op, bool is_negative) {
     f.is_negative = false;
     std::visit(f, fact_op->fact2);
 
-    m_output << "\tpop rbx\n";
-    m_output << "\tpop rax\n";
+    emit(Op::pop, reg(Reg::rbx));
+    emit(Op::pop, reg(Reg::rax));
 
-    if (fact_op->is_mul) {
-        m_output << "\timul rbx\n";
+    // non-negative and 32-bit: the product fits as well, and there is no sign to extend
+    bool narrow = m_ranges && m_ranges->narrow(fact_op);
+
+    if (!fact_op->is_mul && embedded()) {  // a trap would take the host down, the function returns the error
+        Width w = narrow ? Width::d : word();
+        emit(Op::test, reg(Reg::rbx, w), reg(Reg::rbx, w));
+        emit(Op::jz, label(fail_label("div_zero")));
+
+        if (!narrow) {  // the lowest value by -1: rdx is 0 only for it, rcx only for -1
+            emit(Op::mov, val(Reg::rdx), imm(m_options.int32 ? INT32_MIN : INT64_MIN));
+            emit(Op::_xor, val(Reg::rdx), val(Reg::rax));
+            emit(Op::mov, val(Reg::rcx), val(Reg::rbx));
+            emit(Op::add, val(Reg::rcx), imm(1));
+            emit(Op::_or, val(Reg::rdx), val(Reg::rcx));
+            emit(Op::jz, label(fail_label("div_overflow")));
+        }
+    }
+
+    if (fact_op->is_mul && (narrow || m_options.int32)) {
+        emit(Op::imul, reg(Reg::rax, Width::d), reg(Reg::rbx, Width::d));
+    } else if (fact_op->is_mul) {
+        emit(Op::imul, reg(Reg::rbx));
+    } else if (narrow) {
+        emit(Op::_xor, reg(Reg::rdx, Width::d), reg(Reg::rdx, Width::d));
+        emit(Op::div, reg(Reg::rbx, Width::d));
     } else {
-        m_output << "\tcqo\n";
-        m_output << "\tidiv rbx\n";
+        emit(m_options.int32 ? Op::cdq : Op::cqo);
+        emit(Op::idiv, val(Reg::rbx));
     }
 
-    m_output << "\tpush rax\n";
+    emit(Op::push, reg(Reg::rax));
 }
 
 void Generator::gen_term(NodeTerm* term) {
@@ -204,19 +299,20 @@ void Generator::gen_term_op(NodeTermOp* term_op) {
     std::visit(t, term_op->term);
     std::visit(t, term_op->term2);
 
-    m_output << "\tpop rsi\n";
-    m_output << "\tpop rdi\n";
-
-    if (term_op->is_add) {
-        m_output << "\tadd rdi, rsi\n";
-    } else {
-        m_output << "\tsub rdi, rsi\n";
-    }
-
-    m_output << "\tpush rdi\n";
+    emit(Op::pop, reg(Reg::rsi));
+    emit(Op::pop, reg(Reg::rdi));
+    emit(term_op->is_add ? Op::add : Op::sub, val(Reg::rdi), val(Reg::rsi));
+    emit(Op::push, reg(Reg::rdi));
 }
 
 void Generator::gen_expr(NodeExpr* expr) {
+    if (m_loops && m_use_derived) {
+        if (auto derived = m_loops->derived(expr)) {
+            push_value(get_var(derived->slot));
+            return;
+        }
+    }
+
     struct ExprVisitor {
         Generator* gen;
 
@@ -255,7 +351,7 @@ void Generator::gen_stat(NodeStat* stat) {
             for (auto& var: stat_print->exprs->list) {
                 bool last_print = false;
 
-                if (&var == &stat_print->exprs->list.back() && !gen->m_no_new_line) {
+                if (&var == &stat_print->exprs->list.back() && !gen->m_options.no_new_line) {
                     last_print = true;
                 }
 
@@ -266,107 +362,197 @@ void Generator::gen_stat(NodeStat* stat) {
         }
 
         void operator()(NodeStatLet* stat_let) {
+            if (stat_let->var.index) {
+                gen->gen_expr(stat_let->expr);
+                Operand elem = gen->gen_array_elem(stat_let->var.index);
+
+                gen->emit(Op::pop, reg(Reg::rbx));
+                gen->emit(Op::mov, elem, gen->val(Reg::rbx));
+                return;
+            }
+
             auto ident = stat_let->var.name;
+            gen->m_checked_index.erase(ident);
 
             if (gen->m_vars.contains(ident)) {
                 auto var = gen->m_vars.at(ident);
 
                 gen->gen_expr(stat_let->expr);
                 
-                gen->m_output << "\tpop rax\n";
-                gen->m_output << "\tmov " \
-                    << gen->get_var_value(var.stack_loc) \
-                    << ", rax\n";
+                gen->emit(Op::pop, reg(Reg::rax));
+                gen->emit(Op::mov, gen->get_var(var), gen->val(Reg::rax));
             } else {
-                gen->m_vars.insert({ident, {.stack_loc = gen->m_free_var_ptr++}});
+                auto var = gen->new_var(ident, gen->m_free_var_ptr);
+                gen->m_vars.insert({ident, var});
                 gen->gen_expr(stat_let->expr);
                 
-                gen->m_output << "\tpop rax\n";
-                gen->m_output << "\tmov " \
-                    << gen->get_var_value(gen->m_free_var_ptr - 1) \
-                    << ", rax\n";
+                gen->emit(Op::pop, reg(Reg::rax));
+                gen->emit(Op::mov, gen->get_var(var), gen->val(Reg::rax));
+            }
+
+            // an induction var moves the expressions derived from it
+            auto bumps = gen->m_loops && gen->m_use_derived ? gen->m_loops->bumps(stat_let) : nullptr;
+            for (size_t i = 0; bumps && i < bumps->size(); i++) {
+                auto derived = (*bumps)[i];
+
+                if (gen->m_options.int32) {  // all that's left of it in 32 bits
+                    gen->emit(Op::add, gen->get_var(derived->slot), imm(static_cast<int32_t>(derived->delta)));
+                } else if (derived->delta >= INT32_MIN && derived->delta <= INT32_MAX) {
+                    gen->emit(Op::add, gen->get_var(derived->slot), imm(derived->delta));
+                } else {
+                    gen->emit(Op::mov, reg(Reg::rax), imm(derived->delta));
+                    gen->emit(Op::add, gen->get_var(derived->slot), reg(Reg::rax));
+                }
             }
         }
 
         void operator()(const NodeStatIf* stat_if) {
+            if (auto decided = gen->decided(stat_if, gen->m_vars)) {  // no test, a THEN that never runs isn't there
+                gen->m_skip_counter++;
+                gen->m_if_site++;
+
+                if (*decided)
+                    gen->gen_stat(stat_if->then);
+                else
+                    gen->check_stat(stat_if->then);
+                return;
+            }
+
             gen->gen_expr(stat_if->expr);
             gen->gen_expr(stat_if->expr2);
 
-            std::string jump;  // jump for skip stat
+            Op jump;  // jump for skip stat
             bool reverse_reg = false;
 
             switch (stat_if->relop.type) {
-                case RelopType::eq:  jump = "jne"; break;
-                case RelopType::ne:  jump = "je";  break;
-                case RelopType::lt:  jump = "jle"; break;
-                case RelopType::lte: jump = "jl";  break;
+                case RelopType::eq:  jump = Op::jne; break;
+                case RelopType::ne:  jump = Op::je;  break;
+                case RelopType::lt:  jump = Op::jle; break;
+                case RelopType::lte: jump = Op::jl;  break;
 
-                case RelopType::gt:  jump = "jle"; reverse_reg = true; break;
-                case RelopType::gte: jump = "jl";  reverse_reg = true; break;
+                case RelopType::gt:  jump = Op::jle; reverse_reg = true; break;
+                case RelopType::gte: jump = Op::jl;  reverse_reg = true; break;
 
-                case RelopType::crazy: jump = "je"; break;  // plug
+                case RelopType::crazy: jump = Op::je; break;  // plug
             }
 
             if (!reverse_reg) {
-                gen->m_output << "\tpop rax\n";
-                gen->m_output << "\tpop rbx\n";
+                gen->emit(Op::pop, reg(Reg::rax));
+                gen->emit(Op::pop, reg(Reg::rbx));
             } else {
-                gen->m_output << "\tpop rbx\n";
-                gen->m_output << "\tpop rax\n";
+                gen->emit(Op::pop, reg(Reg::rbx));
+                gen->emit(Op::pop, reg(Reg::rax));
             }
 
-            gen->m_output << "\tcmp rax, rbx\n";
-            gen->m_output << "\t" << jump << " skip" << gen->m_skip_counter << "\n";
+            Label skip{.kind = LabelKind::skip, .id = gen->m_skip_counter++};
 
-            gen->gen_stat(stat_if->then);
+            gen->emit(Op::cmp, gen->val(Reg::rax), gen->val(Reg::rbx));
 
-            gen->m_output << "skip" << gen->m_skip_counter++ << ":\n";
+            // a THEN that never ran goes out of the way, a GOTO is a single jump either way
+            auto site = gen->m_plan ? gen->m_plan->if_site(gen->m_line, gen->m_if_site++) : nullptr;
+            if (site && !site->taken && site->not_taken && !gen->m_in_cold &&
+                !std::holds_alternative<NodeStatGoto*>(stat_if->then->com))
+            {
+                Label then{.kind = LabelKind::cold, .id = skip.id};
+
+                gen->emit(*invert_jump(jump), label(then));
+                gen->emit_label(skip);
+
+                gen->m_in_cold = true;
+                gen->emit_label(then);
+                gen->gen_loc(gen->m_line);
+                gen->gen_stat(stat_if->then);
+                gen->emit(Op::jmp, label(skip));
+                gen->m_in_cold = false;
+                return;
+            }
+
+            gen->emit(jump, label(skip));
+
+            if (gen->m_options.profile) {
+                Operand taken = mem(
+                    named("prof_br"), (gen->m_prof_site_base + gen->m_prof_sites.size()) * 8
+                );
+                gen->m_prof_sites.push_back({
+                    .line = gen->m_line, .is_if = true, .taken = taken, .entry = gen->m_prof_entry
+                });
+
+                gen->emit(Op::inc, taken);
+
+                Operand entry = std::exchange(gen->m_prof_entry, taken);
+                gen->gen_stat(stat_if->then);
+                gen->m_prof_entry = entry;
+            } else {
+                gen->gen_stat(stat_if->then);
+            }
+
+            gen->emit_label(skip);
         }
 
         void operator()(const NodeStatGoto* stat_goto) {
-            std::string line_num = std::get<1>(
-                std::get<1>(std::get<1>(stat_goto->expr->term)->fact)->body
-            ).num;
+            const std::string& line_num = jump_target(stat_goto->expr);
+
+            if (gen->m_options.profile) {  // every arrival here takes the edge
+                gen->m_prof_sites.push_back({
+                    .line = gen->m_line, .is_if = false, 
+                    .taken = gen->m_prof_entry, .entry = gen->m_prof_entry
+                });
+            }
 
-            gen->remove_extra_zeros(line_num);
-            gen->m_output << "\tjmp com" << line_num << "\n";
+            gen->emit(Op::jmp, gen->line_target(line_num));
         }
 
         void operator()(const NodeStatInput* stat_input) {
             for (auto& var: stat_input->var_list.list) {
+                if (var.index) {
+                    gen->emit(Op::call, gen->runtime("in_number"));
+                    gen->emit(Op::push, reg(Reg::rax));
+                    Operand elem = gen->gen_array_elem(var.index);
+
+                    gen->emit(Op::pop, reg(Reg::rbx));
+                    gen->emit(Op::mov, elem, gen->val(Reg::rbx));
+                    continue;
+                }
+
                 if (!gen->m_vars.contains(var.name))
                     Error::critical(gen->m_line, std::format("Var `{}` doesn't exist!", var.name).c_str());
                 
-                gen->m_output << "\tmov rdi, frm\n";
-                gen->m_output << "\tlea rsi, " \
-                    << gen->get_var_pointer(gen->m_vars.at(var.name).stack_loc) \
-                    << "\n";
-                gen->m_output << "\tcall scanf\n";
+                gen->emit(Op::call, gen->runtime("in_number"));
+                gen->emit(Op::mov, gen->get_var(gen->m_vars.at(var.name)), gen->val(Reg::rax));
+                gen->m_checked_index.erase(var.name);
             }
         }
 
         void operator()(const NodeStatGosub* stat_gosub) {
-            std::string line_num = std::get<1>(
-                std::get<1>(std::get<1>(stat_gosub->expr->term)->fact)->body
-            ).num;
+            if (auto body = gen->m_plan ? gen->m_plan->inlined(stat_gosub) : nullptr) {
+                gen->gen_inline(*body);
+                return;
+            }
 
-            gen->remove_extra_zeros(line_num);
+            const std::string& line_num = jump_target(stat_gosub->expr);
 
-            
-            gen->m_output << "\tmov rdi, [cntr]\n";
-            gen->m_output << "\tinc rdi\n";
-            gen->m_output << "\tmov [cntr], rdi\n";
-            gen->m_output << "\tcall com" << line_num << "\n";
+            gen->emit(Op::mov, reg(Reg::rdi), gen->gosub_depth());
+            gen->emit(Op::inc, reg(Reg::rdi));
+            gen->emit(Op::mov, gen->gosub_depth(), reg(Reg::rdi));
+            gen->emit(Op::call, gen->line_target(line_num));
         }
 
         void operator()(const NodeStatReturn* stat_return) {
-            gen->m_output << "\tmov rdi, [cntr]\n";
-            gen->m_output << "\ttest rdi, rdi\n";
-            gen->m_output << "\tjz skip" << gen->m_skip_counter << "\n";
-            gen->m_output << "\tdec rdi\n";
-            gen->m_output << "\tmov [cntr], rdi\n";
-            gen->m_output << "\tret\n";
-            gen->m_output << "skip" << gen->m_skip_counter++ << ":\n";
+            Label skip{.kind = LabelKind::skip, .id = gen->m_skip_counter++};
+
+            if (gen->m_cfg && gen->m_cfg->in_sub_only(gen->m_index)) {  // nothing to check, there is a GOSUB to go back to
+                gen->emit(Op::dec, gen->gosub_depth());
+                gen->emit(Op::ret);
+                return;
+            }
+
+            gen->emit(Op::mov, reg(Reg::rdi), gen->gosub_depth());
+            gen->emit(Op::test, reg(Reg::rdi), reg(Reg::rdi));
+            gen->emit(Op::jz, label(skip));
+            gen->emit(Op::dec, reg(Reg::rdi));
+            gen->emit(Op::mov, gen->gosub_depth(), reg(Reg::rdi));
+            gen->emit(Op::ret);
+            gen->emit_label(skip);
         }
 
         void operator()(const NodeStatClear* stat_clear) {
@@ -382,7 +568,7 @@ void Generator::gen_stat(NodeStat* stat) {
         }
 
         void operator()(const NodeStatEnd* stat_end) {
-            gen->m_output << "\tjmp exit\n";
+            gen->emit(Op::jmp, gen->runtime("exit"));
         }
 
         void operator()(const std::monostate& mono) {
@@ -393,63 +579,1402 @@ void Generator::gen_stat(NodeStat* stat) {
     std::visit(StatVisitor{.gen = this}, stat->com);
 }
 
-void Generator::gen_line(NodeLine* line) {
-    if (line->num.has_value()) {
-        std::string num = line->num.value().num;
-        remove_extra_zeros(num);
+void Generator::check_stat(NodeStat* stat) {
+    // in the order gen_stat meets them, so a dropped line fails like a generated one
+    ExprWalker walker{.on_var = [this](const NodeVar& var) {
+        if (var.index)
+            const_index(var.index);
+        else if (!m_vars.contains(var.name))
+            Error::critical(m_line, std::format("Var `{}` hasn't been initialized!", var.name).c_str());
+    }};
 
-        m_output << "com" << num << ":\n";
-    }
+    struct CheckVisitor {
+        Generator* gen;
+        ExprWalker& walker;
+
+        void operator()(NodeStatPrint* stat_print) {
+            for (auto& item: stat_print->exprs->list) {
+                if (auto expr = std::get_if<NodeExpr*>(&item))
+                    walker(*expr);
+            }
+        }
+
+        void operator()(NodeStatLet* stat_let) {
+            if (stat_let->var.index) {  // the value first, then the index
+                walker(stat_let->expr);
+                walker(stat_let->var);
+                return;
+            }
+
+            if (!gen->m_vars.contains(stat_let->var.name))
+                gen->m_vars.insert({stat_let->var.name, gen->new_var(stat_let->var.name, gen->m_free_var_ptr)});
+            walker(stat_let->expr);
+        }
+
+        void operator()(NodeStatIf* stat_if) {
+            walker(stat_if->expr);
+            walker(stat_if->expr2);
+            gen->check_stat(stat_if->then);
+        }
 
+        void operator()(NodeStatInput* stat_input) {
+            for (auto& var: stat_input->var_list.list) {
+                if (var.index)
+                    walker(var);
+                else if (!gen->m_vars.contains(var.name))
+                    Error::critical(gen->m_line, std::format("Var `{}` doesn't exist!", var.name).c_str());
+            }
+        }
+
+        void operator()(NodeStatGoto* stat_goto) {}  // the parser checks the targets
+        void operator()(NodeStatGosub* stat_gosub) {}
+        void operator()(NodeStatReturn* stat_return) {}
+        void operator()(NodeStatClear* stat_clear) {}
+        void operator()(NodeStatList* stat_list) {}
+        void operator()(NodeStatRun* stat_run) {}
+        void operator()(NodeStatEnd* stat_end) {}
+        void operator()(std::monostate& mono) {}
+    };
+
+    std::visit(CheckVisitor{.gen = this, .walker = walker}, stat->com);
+}
+
+void Generator::gen_line(NodeLine* line, size_t index) {
     m_line = line->line;
+    m_index = index;
+
+    if (m_cfg && !m_cfg->reachable(index)) {  // its vars stay, the lines below may use them
+        check_stat(line->stat);
+        return;
+    }
+
+    // lines that never ran in the profile go after the exit, falling between the two takes a jump
+    bool cold = m_plan && m_plan->cold(index);
+    bool cold_above = index > 0 && m_plan && m_plan->cold(index - 1);
+    Label start{.kind = LabelKind::line, .id = index};
+
+    if (cold != cold_above && index > 0 && m_cfg->reachable(index - 1) && m_cfg->falls(index - 1)) {
+        (cold_above ? m_cold : m_code).push_back({Op::jmp, label(start)});
+        (cold ? m_cold : m_code).push_back({Op::label, label(start)});
+    }
+
+    m_in_cold = cold;
+    if (m_resume == index)  // after the evaluated lines, in front of the entry code of a loop
+        emit_label(start);
+    gen_loc(line->line);
+
+    if (auto loop = m_loops ? m_loops->at_header(index) : nullptr) {
+        gen_loop_entry(*loop);
+        m_line = line->line;
+        gen_loc(m_line);
+    }
+
+    if (line->num.has_value() && (!m_cfg || m_cfg->is_target(index))) {
+        // where loops come back to and hot jumps go: start a fetch block
+        if (m_options.layout && m_cfg && !cold && (m_cfg->is_loop_head(index) || (m_plan && m_plan->hot(index))))
+            emit(Op::align, imm(16));
+
+        emit_label(line_label(line->num.value().num));
+    }
+
+    if (m_options.debug && line->num.has_value()) {
+        bool sub = m_cfg && m_cfg->is_sub(index);
+        emit_label({.kind = sub ? LabelKind::gosub : LabelKind::basic, .id = line_label(line->num.value().num).id});
+    }
+
+    if (m_options.profile)
+        gen_profile_line(index);
+
+    m_checked_index.clear();
+    m_if_site = 0;
     gen_stat(line->stat);
+
+    if (m_loops && m_loops->is_unrolled_latch(index))
+        emit_label({.kind = LabelKind::loop, .id = index});
+
+    m_in_cold = false;
 }
 
-std::string Generator::gen_asm() {
-    clear();
+void Generator::gen_loop_entry(const Loop& loop) {
+    // in front of the header label: the loop comes back to the label, so this runs once per entry,
+    // with the vars as the header has them and not as the lines the expressions are on
+    auto ranges = std::exchange(m_ranges, nullptr);
+    m_use_derived = false;
+    for (auto& derived: loop.derived) {
+        gen_expr(derived.expr);
+        emit(Op::pop, reg(Reg::rax));
+        emit(Op::mov, get_var(derived.slot), val(Reg::rax));
+    }
+    m_use_derived = true;
 
-    m_output << "\tpush rbp\n";
-    m_output << "\tmov rbp, rsp\n";
-    if (m_unique_let)
-        m_output << "\tsub rsp, " << (m_unique_let + 1) * 8 << "\n";
+    if (!loop.count_slot) {
+        m_ranges = ranges;
+        return;
+    }
 
-    // for print nums
-    m_data << "\tfrm db '%li', 0\n";
-    m_data << "\tfrmn db '%li', 10, 0\n";
+    /*
+        Iterations are the distance from the counter to the limit (one more
+        with <= and >=). When there are none, or it overflows, the loop as
+        written runs instead. An odd one goes first, then the body runs twice
+        per count without the test of the latch.
+    */
+    Label original = line_label(loop.body.front()->num.value().num);
+    Label pairs{.kind = LabelKind::loop, .id = loop.header};
+    Label done{.kind = LabelKind::loop, .id = loop.latch};
+    Operand count = get_var(loop.count_slot);
+
+    gen_expr(loop.limit);
+    m_ranges = ranges;
+
+    // of 32 bits with --int32 like the counter, so it overflows where the counter would
+    emit(Op::pop, reg(Reg::rax));
+    emit(Op::mov, val(Reg::rbx), get_var(m_vars.at(loop.counter)));
+
+    if (loop.step > 0) {
+        emit(Op::sub, val(Reg::rax), val(Reg::rbx));
+    } else {
+        emit(Op::sub, val(Reg::rbx), val(Reg::rax));
+        emit(Op::mov, reg(Reg::rax), reg(Reg::rbx));
+    }
+    emit(Op::jo, label(original));
+
+    if (loop.relop == RelopType::lte || loop.relop == RelopType::gte) {
+        emit(Op::add, val(Reg::rax), imm(1));
+        emit(Op::jo, label(original));
+    }
+
+    emit(Op::test, val(Reg::rax), val(Reg::rax));
+    emit(Op::jle, label(original));
+    emit(Op::mov, count, val(Reg::rax));
+    emit(Op::test, reg(Reg::rax), imm(1));
+    emit(Op::jz, label(pairs));
+
+    gen_loop_body(loop);
+    emit(Op::dec, count);
+    emit(Op::jz, label(done));
+
+    if (m_options.layout && !m_in_cold)
+        emit(Op::align, imm(16));
+    emit_label(pairs);
+    gen_loop_body(loop);
+    gen_loop_body(loop);
+    emit(Op::sub, count, imm(2));
+    emit(Op::jnz, label(pairs));
+    emit(Op::jmp, label(done));
+}
+
+void Generator::gen_loop_body(const Loop& loop) {  // without the latch
+    for (auto line: loop.body) {
+        m_line = line->line;
+        gen_loc(m_line);
+        m_checked_index.clear();
+        m_if_site = 0;
+        gen_stat(line->stat);
+    }
+}
+
+void Generator::gen_inline(const std::vector<NodeLine*>& body) {
+    // lines of a subroutine in place of its GOSUB: the RETURN would come back right here
+    size_t line = m_line;
+    size_t if_site = m_if_site;
+
+    m_use_derived = false;  // they may be part of a loop somewhere else
+    for (auto body_line: body) {
+        m_line = body_line->line;
+        gen_loc(m_line);
+        m_checked_index.clear();
+        m_if_site = 0;
+        gen_stat(body_line->stat);
+    }
+    m_use_derived = true;
+
+    m_line = line;
+    m_if_site = if_site;
+    m_checked_index.clear();
+    gen_loc(m_line);
+}
+
+void Generator::gen_eval_state(const PartialEval& eval) {
+    auto store = [this](Operand dest, int64_t value) {
+        if (value >= INT32_MIN && value <= INT32_MAX) {
+            emit(Op::mov, dest, imm(value));
+        } else {
+            emit(Op::mov, reg(Reg::rax), imm(value));
+            emit(Op::mov, dest, reg(Reg::rax));
+        }
+    };
+
+    for (auto [name, value]: eval.vars())
+        store(get_var(m_vars.at(std::string(1, name))), value);
+    for (auto [index, value]: eval.array())
+        store(mem(Reg::r15, index * word_size(), word()), value);
+}
+
+void Generator::gen_eval_output(const PartialEval& eval) {
+    // into the buffer of printf like the rest, so a crash later loses the same part of it
+    if (eval.output().empty())
+        return;
+
+    if (embedded()) {
+        m_data.push_back({.kind = DataDef::Kind::bytes, .label = named("eval_out"), .bytes = eval.output()});
+
+        emit(Op::mov, reg(Reg::rsi), label(named("eval_out")));
+        emit(Op::mov, reg(Reg::rdx), imm(eval.output().size()));
+        emit(Op::call, runtime("rt_print_text"));
+        return;
+    }
+
+    m_data.push_back({.kind = DataDef::Kind::bytes, .label = named("eval_frm"), .bytes = "%s"});
+    m_data.push_back({.kind = DataDef::Kind::bytes, .label = named("eval_out"), .bytes = eval.output()});
+
+    emit(Op::mov, reg(Reg::rdi), label(named("eval_frm")));
+    emit(Op::mov, reg(Reg::rsi), label(named("eval_out")));
+    emit(Op::_xor, reg(Reg::rax, Width::d), reg(Reg::rax, Width::d));
+    emit(Op::call, label(named("printf")));
+}
+
+std::optional<bool> Generator::decided(const NodeStatIf* stat_if, const std::unordered_map<std::string, Var>& vars) const {
+    // the profile counts every IF; a var read before its LET fails to compile, tested or not
+    if (!m_ranges || m_options.profile)
+        return std::nullopt;
+
+    bool declared = true;
+    ExprWalker walker{.on_var = [&](const NodeVar& var) { declared = declared && (var.index || vars.contains(var.name)); }};
+    walker(stat_if->expr);
+    walker(stat_if->expr2);
+
+    return declared ? m_ranges->decided(stat_if) : std::nullopt;
+}
+
+void Generator::declare_letters() {
+    for (char name = 'A'; name <= 'Z'; name++)
+        m_vars.insert({std::string(1, name), new_var(std::string(1, name), m_free_var_ptr)});
+}
+
+Generator::Var Generator::new_var(const std::string& name, size_t& free_var_ptr) const {
+    return {.stack_loc = free_var_ptr++, .reg = m_plan ? m_plan->reg(name) : Reg::none};
+}
+
+void Generator::declare_vars(NodeStat* stat, std::unordered_map<std::string, Var>& vars, size_t& free_var_ptr) {
+    if (auto stat_let = std::get_if<NodeStatLet*>(&stat->com)) {
+        if (!(*stat_let)->var.index && !vars.contains((*stat_let)->var.name))
+            vars.insert({(*stat_let)->var.name, new_var((*stat_let)->var.name, free_var_ptr)});
+    } else if (auto stat_if = std::get_if<NodeStatIf*>(&stat->com)) {
+        declare_vars((*stat_if)->then, vars, free_var_ptr);
+    }
+}
+
+void Generator::count_stat(NodeStat* stat, ShardStart& state) {
+    // allocates the same labels, strings, counters and vars as gen_stat, keep them in sync
+    struct CountVisitor {
+        Generator* gen;
+        ShardStart& state;
+
+        void operator()(NodeStatPrint* stat_print) {
+            for (auto& var: stat_print->exprs->list) {
+                if (std::holds_alternative<std::string>(var))
+                    state.data_counter++;
+            }
+        }
+
+        void operator()(NodeStatLet* stat_let) {
+            if (!stat_let->var.index && !state.vars.contains(stat_let->var.name))
+                state.vars.insert({stat_let->var.name, gen->new_var(stat_let->var.name, state.free_var_ptr)});
+        }
+
+        void operator()(NodeStatIf* stat_if) {
+            state.skip_counter++;
+            if (gen->m_options.profile)
+                state.prof_site++;
+
+            if (gen->decided(stat_if, state.vars) == false)
+                gen->declare_vars(stat_if->then, state.vars, state.free_var_ptr);
+            else
+                gen->count_stat(stat_if->then, state);
+        }
+
+        void operator()(NodeStatGoto* stat_goto) {
+            if (gen->m_options.profile)
+                state.prof_site++;
+        }
+
+        void operator()(NodeStatReturn* stat_return) {
+            state.skip_counter++;
+        }
+
+        void operator()(NodeStatInput* stat_input) {}
+
+        void operator()(NodeStatGosub* stat_gosub) {
+            if (auto body = gen->m_plan ? gen->m_plan->inlined(stat_gosub) : nullptr) {
+                for (auto line: *body)
+                    gen->count_stat(line->stat, state);
+            }
+        }
+
+        void operator()(NodeStatClear* stat_clear) {}
+        void operator()(NodeStatList* stat_list) {}
+        void operator()(NodeStatRun* stat_run) {}
+        void operator()(NodeStatEnd* stat_end) {}
+        void operator()(std::monostate& mono) {}
+    };
+
+    std::visit(CountVisitor{.gen = this, .state = state}, stat->com);
+}
+
+void Generator::count_loop_body(const Loop& loop, ShardStart& state) {  // the three copies of gen_loop_entry
+    for (int copy = 0; copy < 3; copy++) {
+        for (auto line: loop.body)
+            count_stat(line->stat, state);
+    }
+}
+
+void Generator::gen_lines_parallel() {
+    auto& lines = m_node_prog.lines;
+
+    size_t shard_count = std::min(m_options.threads * 4, lines.size() / MIN_SHARD_LINES);
+    size_t shard_lines = (lines.size() + shard_count - 1) / shard_count;
+
+    ShardStart state{
+        .data_counter = m_data_counter, .skip_counter = m_skip_counter, 
+        .prof_site = 0, .free_var_ptr = m_free_var_ptr, .vars = m_vars
+    };
+
+    std::vector<std::unique_ptr<Generator>> shards;
+    for (size_t i = 0; i < lines.size(); i++) {
+        if (i % shard_lines == 0) {
+            auto shard = std::unique_ptr<Generator>(new Generator(m_options));
+
+            shard->m_data_counter = state.data_counter;
+            shard->m_skip_counter = state.skip_counter;
+            shard->m_prof_site_base = state.prof_site;
+            shard->m_free_var_ptr = state.free_var_ptr;
+            shard->m_vars = state.vars;
+            shard->m_cfg = m_cfg;
+            shard->m_loops = m_loops;
+            shard->m_plan = m_plan;
+            shard->m_ranges = m_ranges;
+            shard->m_resume = m_resume;
+
+            shards.push_back(std::move(shard));
+        }
+
+        if (!m_cfg->reachable(i)) {
+            declare_vars(lines[i]->stat, state.vars, state.free_var_ptr);
+            continue;
+        }
+
+        if (auto loop = m_loops ? m_loops->at_header(i) : nullptr; loop && loop->count_slot)
+            count_loop_body(*loop, state);
+        count_stat(lines[i]->stat, state);
+    }
+
+    std::vector<std::exception_ptr> errors(shards.size());
+    std::ostream& sink = Error::sink();
+
+    {
+        ThreadPool pool{m_options.threads};
+
+        for (size_t s = 0; s < shards.size(); s++) {
+            pool.submit([&, s] {
+                Error::set_sink(sink);
+
+                size_t end = std::min(lines.size(), (s + 1) * shard_lines);
+                try {
+                    for (size_t i = s * shard_lines; i < end; i++)
+                        shards[s]->gen_line(lines[i], i);
+                } catch (...) {
+                    errors[s] = std::current_exception();
+                }
+            });
+        }
+
+        pool.wait();
+    }
+
+    for (auto& error: errors) {  // the first one in source order, like a serial run
+        if (error)
+            std::rethrow_exception(error);
+    }
+
+    for (auto& shard: shards) {
+        m_code.insert(m_code.end(), shard->m_code.begin(), shard->m_code.end());
+        m_cold.insert(m_cold.end(), shard->m_cold.begin(), shard->m_cold.end());
+        m_data.insert(m_data.end(), shard->m_data.begin(), shard->m_data.end());
+        m_prof_sites.insert(m_prof_sites.end(), shard->m_prof_sites.begin(), shard->m_prof_sites.end());
+    }
+
+    m_data_counter = state.data_counter;
+    m_skip_counter = state.skip_counter;
+    m_free_var_ptr = state.free_var_ptr;
+    m_vars = std::move(state.vars);
+}
+
+void Generator::gen_profile_line(size_t index) {
+    m_prof_entry = mem(named("prof_cnt"), index * 8);
+    emit(Op::inc, m_prof_entry);
+
+    if (!m_options.profile_cycles)
+        return;
+
+    // charge the cycles since the previous line start to that line
+    emit(Op::rdtsc);
+    emit(Op::shl, reg(Reg::rdx), imm(32));
+    emit(Op::_or, reg(Reg::rax), reg(Reg::rdx));
+    emit(Op::mov, reg(Reg::rcx), reg(Reg::rax));
+    emit(Op::sub, reg(Reg::rax), mem(named("prof_tsc")));
+    emit(Op::mov, reg(Reg::rdx), mem(named("prof_cur")));
+    emit(Op::add, mem(named("prof_cyc"), 0, Reg::rdx, 8), reg(Reg::rax));
+    emit(Op::mov, mem(named("prof_tsc")), reg(Reg::rcx));
+    emit(Op::mov, mem(named("prof_cur")), imm(index));
+}
+
+void Generator::gen_profile_report(AsmProgram& program) {
+    /*
+        Report format, a header and then one record per line:
+            tinyb-profile <PROFILE_VERSION> <source hash>
+            line <src line> num <basic num or -1> count <n> cycles <n>
+            branch <src line> (if|goto) taken <n> not-taken <n>
+    */
+    size_t lines = m_node_prog.lines.size();
+
+    auto bytes = [this](const char* name, std::string str) {
+        m_data.push_back({.kind = DataDef::Kind::bytes, .label = named(name), .bytes = std::move(str)});
+    };
 
-    m_data << "\tcntr dq 0\n";
+    bytes("prof_env", "TINYB_PROFILE");
+    bytes("prof_mode", "w");
+    bytes("prof_path", m_options.profile_path);
+    bytes("prof_head", std::format("tinyb-profile {} {}\n", PROFILE_VERSION, m_options.source_hash));
+    bytes("prof_fline", "line %li num %li count %lu cycles %lu\n");
+    bytes("prof_fif", "branch %li if taken %lu not-taken %lu\n");
+    bytes("prof_fgoto", "branch %li goto taken %lu not-taken %lu\n");
 
+    // cycles before the first line go to a spare slot
+    m_data.push_back({.kind = DataDef::Kind::quads, .label = named("prof_cur"), .quads = {imm(lines)}});
+
+    m_data.push_back({.kind = DataDef::Kind::quads, .label = named("prof_lines")});
     for (auto line: m_node_prog.lines) {
-        gen_line(line);
+        std::string num = line->num.has_value() ? line->num.value().num : "-1";
+        remove_extra_zeros(num);
+
+        m_data.push_back({.kind = DataDef::Kind::quads, .quads = {imm(line->line), imm(std::stoll(num))}});
+    }
+
+    auto address = [](Operand counter) {  // dq of a counter's address
+        Operand result = label(counter.label);
+        result.imm = counter.imm;
+        return result;
+    };
+
+    m_data.push_back({.kind = DataDef::Kind::quads, .label = named("prof_sites")});
+    for (auto& site: m_prof_sites) {
+        m_data.push_back({
+            .kind = DataDef::Kind::quads, 
+            .quads = {
+                imm(site.line), label(named(site.is_if ? "prof_fif" : "prof_fgoto")), 
+                address(site.taken), address(site.entry)
+            }
+        });
+    }
+
+    emit_label(named("prof_report"));
+    emit(Op::push, reg(Reg::r12));
+    emit(Op::push, reg(Reg::r13));
+    emit(Op::push, reg(Reg::r14));
+
+    if (m_options.profile_cycles) {
+        emit(Op::rdtsc);
+        emit(Op::shl, reg(Reg::rdx), imm(32));
+        emit(Op::_or, reg(Reg::rax), reg(Reg::rdx));
+        emit(Op::sub, reg(Reg::rax), mem(named("prof_tsc")));
+        emit(Op::mov, reg(Reg::rdx), mem(named("prof_cur")));
+        emit(Op::add, mem(named("prof_cyc"), 0, Reg::rdx, 8), reg(Reg::rax));
+    }
+
+    emit(Op::mov, reg(Reg::rdi), label(named("prof_env")));
+    emit(Op::call, label(named("getenv")));
+    emit(Op::test, reg(Reg::rax), reg(Reg::rax));
+    emit(Op::jnz, label(named("prof_open")));
+    emit(Op::mov, reg(Reg::rax), label(named("prof_path")));
+    emit_label(named("prof_open"));
+    emit(Op::mov, reg(Reg::rdi), reg(Reg::rax));
+    emit(Op::mov, reg(Reg::rsi), label(named("prof_mode")));
+    emit(Op::call, label(named("fopen")));
+    emit(Op::test, reg(Reg::rax), reg(Reg::rax));
+    emit(Op::jz, label(named("prof_done")));
+    emit(Op::mov, reg(Reg::r12), reg(Reg::rax));
+
+    emit(Op::mov, reg(Reg::rdi), reg(Reg::r12));
+    emit(Op::mov, reg(Reg::rsi), label(named("prof_head")));
+    emit(Op::_xor, reg(Reg::rax, Width::d), reg(Reg::rax, Width::d));
+    emit(Op::call, label(named("fprintf")));
+
+    emit(Op::_xor, reg(Reg::r13), reg(Reg::r13));
+    emit_label(named("prof_line_loop"));
+    emit(Op::cmp, reg(Reg::r13), imm(lines));
+    emit(Op::jae, label(named("prof_line_end")));
+    emit(Op::mov, reg(Reg::r14), reg(Reg::r13));
+    emit(Op::shl, reg(Reg::r14), imm(4));
+    emit(Op::mov, reg(Reg::rdi), reg(Reg::r12));
+    emit(Op::mov, reg(Reg::rsi), label(named("prof_fline")));
+    emit(Op::mov, reg(Reg::rdx), mem(named("prof_lines"), 0, Reg::r14));
+    emit(Op::mov, reg(Reg::rcx), mem(named("prof_lines"), 8, Reg::r14));
+    emit(Op::mov, reg(Reg::r8), mem(named("prof_cnt"), 0, Reg::r13, 8));
+    emit(Op::mov, reg(Reg::r9), mem(named("prof_cyc"), 0, Reg::r13, 8));
+    emit(Op::_xor, reg(Reg::rax, Width::d), reg(Reg::rax, Width::d));
+    emit(Op::call, label(named("fprintf")));
+    emit(Op::inc, reg(Reg::r13));
+    emit(Op::jmp, label(named("prof_line_loop")));
+    emit_label(named("prof_line_end"));
+
+    emit(Op::_xor, reg(Reg::r13), reg(Reg::r13));
+    emit_label(named("prof_site_loop"));
+    emit(Op::cmp, reg(Reg::r13), imm(m_prof_sites.size()));
+    emit(Op::jae, label(named("prof_site_end")));
+    emit(Op::mov, reg(Reg::r14), reg(Reg::r13));
+    emit(Op::shl, reg(Reg::r14), imm(5));
+    emit(Op::mov, reg(Reg::rdi), reg(Reg::r12));
+    emit(Op::mov, reg(Reg::rsi), mem(named("prof_sites"), 8, Reg::r14));
+    emit(Op::mov, reg(Reg::rdx), mem(named("prof_sites"), 0, Reg::r14));
+    emit(Op::mov, reg(Reg::rax), mem(named("prof_sites"), 16, Reg::r14));
+    emit(Op::mov, reg(Reg::rcx), mem(Reg::rax));
+    emit(Op::mov, reg(Reg::rax), mem(named("prof_sites"), 24, Reg::r14));
+    emit(Op::mov, reg(Reg::r8), mem(Reg::rax));
+    emit(Op::sub, reg(Reg::r8), reg(Reg::rcx));
+    emit(Op::_xor, reg(Reg::rax, Width::d), reg(Reg::rax, Width::d));
+    emit(Op::call, label(named("fprintf")));
+    emit(Op::inc, reg(Reg::r13));
+    emit(Op::jmp, label(named("prof_site_loop")));
+    emit_label(named("prof_site_end"));
+
+    emit(Op::mov, reg(Reg::rdi), reg(Reg::r12));
+    emit(Op::call, label(named("fclose")));
+    emit_label(named("prof_done"));
+    emit(Op::pop, reg(Reg::r14));
+    emit(Op::pop, reg(Reg::r13));
+    emit(Op::pop, reg(Reg::r12));
+    emit(Op::ret);
+
+    auto zero = [&program](const char* name, size_t qwords) {
+        program.bss.push_back({.kind = DataDef::Kind::zero, .label = named(name), .zero = qwords});
+    };
+
+    zero("prof_cnt", lines);
+    zero("prof_cyc", lines + 1);
+    zero("prof_br", m_prof_sites.size());
+    zero("prof_tsc", 1);
+}
+
+bool Generator::uses_input(NodeStat* stat) {
+    if (std::holds_alternative<NodeStatInput*>(stat->com))
+        return true;
+    if (auto stat_if = std::get_if<NodeStatIf*>(&stat->com))
+        return uses_input((*stat_if)->then);
+
+    return false;
+}
+
+void Generator::gen_input_map() {
+    // the input file is the first argument of the program: open, fstat and mmap it whole
+    emit(Op::cmp, mem(Reg::rbp, 8), imm(2));  // argc
+    emit(Op::jl, label(fail_label("in_usage")));
+    emit(Op::mov, reg(Reg::rax), imm(2));  // open
+    emit(Op::mov, reg(Reg::rdi), mem(Reg::rbp, 24));  // argv[1]
+    emit(Op::_xor, reg(Reg::rsi, Width::d), reg(Reg::rsi, Width::d));
+    emit(Op::syscall);
+    emit(Op::test, reg(Reg::rax), reg(Reg::rax));
+    emit(Op::jl, label(fail_label("in_open_fail")));
+    emit(Op::mov, reg(Reg::rbx), reg(Reg::rax));
+    emit(Op::mov, reg(Reg::rax), imm(5));  // fstat
+    emit(Op::mov, reg(Reg::rdi), reg(Reg::rbx));
+    emit(Op::mov, reg(Reg::rsi), label(named("in_stat")));
+    emit(Op::syscall);
+    emit(Op::test, reg(Reg::rax), reg(Reg::rax));
+    emit(Op::jl, label(fail_label("in_open_fail")));
+    emit(Op::mov, reg(Reg::rsi), mem(named("in_stat"), 48));  // st_size
+    emit(Op::test, reg(Reg::rsi), reg(Reg::rsi));
+    emit(Op::jz, label(named("in_mapped")));  // empty: in_pos == in_end, the end of input
+    emit(Op::mov, reg(Reg::r12), reg(Reg::rsi));
+    emit(Op::mov, reg(Reg::rax), imm(9));  // mmap
+    emit(Op::_xor, reg(Reg::rdi, Width::d), reg(Reg::rdi, Width::d));
+    emit(Op::mov, reg(Reg::rdx), imm(1));  // PROT_READ
+    emit(Op::mov, reg(Reg::r10), imm(2));  // MAP_PRIVATE
+    emit(Op::mov, reg(Reg::r8), reg(Reg::rbx));
+    emit(Op::_xor, reg(Reg::r9, Width::d), reg(Reg::r9, Width::d));
+    emit(Op::syscall);
+    emit(Op::cmp, reg(Reg::rax), imm(-4096));  // -errno
+    emit(Op::ja, label(fail_label("in_open_fail")));
+    emit(Op::mov, mem(named("in_pos")), reg(Reg::rax));
+    emit(Op::add, reg(Reg::rax), reg(Reg::r12));
+    emit(Op::mov, mem(named("in_end")), reg(Reg::rax));
+    emit_label(named("in_mapped"));
+    emit(Op::mov, reg(Reg::rax), imm(3));  // close, the mapping stays
+    emit(Op::mov, reg(Reg::rdi), reg(Reg::rbx));
+    emit(Op::syscall);
+}
+
+void Generator::gen_input_runtime(AsmProgram& program) {
+    /*
+        in_number returns the next number of the input in rax: whitespace is
+        skipped, then an optional sign and decimal digits are read. Anything
+        else, a number that doesn't fit in a var or the end of the input stops
+        the program with exit code 2 and a message on stderr.
+
+        in_pos and in_end are the unread part of the buffer, in_fill gets the
+        next part of the input into rsi and rdi (rsi == rdi at its end).
+    */
+    m_data.push_back({.kind = DataDef::Kind::quads, .label = named("in_pos"), .quads = {imm(0)}});
+    m_data.push_back({.kind = DataDef::Kind::quads, .label = named("in_end"), .quads = {imm(0)}});
+
+    // next byte into eax, or jump to `at_end` when the input is over
+    auto load_byte = [this](const char* have, Label at_end) {
+        emit(Op::cmp, reg(Reg::rsi), reg(Reg::rdi));
+        emit(Op::jb, label(named(have)));
+        emit(Op::call, label(named("in_fill")));
+        emit(Op::cmp, reg(Reg::rsi), reg(Reg::rdi));
+        emit(Op::jae, label(at_end));
+        emit_label(named(have));
+        emit(Op::movzx, reg(Reg::rax, Width::d), mem(Reg::rsi, 0, Width::b));
+    };
+
+    emit_label(named("in_number"));
+    emit(Op::push, reg(Reg::rbx));
+    emit(Op::push, reg(Reg::r12));
+    emit(Op::_xor, reg(Reg::r12, Width::d), reg(Reg::r12, Width::d));  // value
+    emit(Op::_xor, reg(Reg::rbx, Width::d), reg(Reg::rbx, Width::d));  // 1 - negative
+    emit(Op::mov, reg(Reg::rsi), mem(named("in_pos")));
+    emit(Op::mov, reg(Reg::rdi), mem(named("in_end")));
+
+    emit_label(named("in_skip"));
+    load_byte("in_skip_have", fail_label("in_eof"));
+    emit(Op::cmp, reg(Reg::rax, Width::d), imm(' '));
+    emit(Op::je, label(named("in_skip_next")));
+    emit(Op::cmp, reg(Reg::rax, Width::d), imm('\t'));
+    emit(Op::jb, label(named("in_sign")));
+    emit(Op::cmp, reg(Reg::rax, Width::d), imm('\r'));
+    emit(Op::ja, label(named("in_sign")));
+    emit_label(named("in_skip_next"));
+    emit(Op::inc, reg(Reg::rsi));
+    emit(Op::jmp, label(named("in_skip")));
+
+    emit_label(named("in_sign"));
+    emit(Op::cmp, reg(Reg::rax, Width::d), imm('-'));
+    emit(Op::je, label(named("in_minus")));
+    emit(Op::cmp, reg(Reg::rax, Width::d), imm('+'));
+    emit(Op::jne, label(named("in_first")));
+    emit(Op::jmp, label(named("in_sign_next")));
+    emit_label(named("in_minus"));
+    emit(Op::mov, reg(Reg::rbx, Width::d), imm(1));
+    emit_label(named("in_sign_next"));
+    emit(Op::inc, reg(Reg::rsi));
+    load_byte("in_sign_have", fail_label("in_bad"));
+
+    emit_label(named("in_first"));
+    emit(Op::sub, reg(Reg::rax, Width::d), imm('0'));
+    emit(Op::cmp, reg(Reg::rax, Width::d), imm(9));
+    emit(Op::ja, label(fail_label("in_bad")));
+    emit_label(named("in_digit"));  // value = value * 10 - digit, negative as the lowest value has no positive twin
+    emit(Op::imul, val(Reg::r12), imm(10));
+    emit(Op::jo, label(fail_label("in_bad")));
+    emit(Op::sub, val(Reg::r12), val(Reg::rax));
+    emit(Op::jo, label(fail_label("in_bad")));
+    emit(Op::inc, reg(Reg::rsi));
+    load_byte("in_digit_have", named("in_done"));
+    emit(Op::sub, reg(Reg::rax, Width::d), imm('0'));
+    emit(Op::cmp, reg(Reg::rax, Width::d), imm(9));
+    emit(Op::jbe, label(named("in_digit")));
+
+    emit_label(named("in_done"));
+    emit(Op::mov, mem(named("in_pos")), reg(Reg::rsi));
+    emit(Op::mov, mem(named("in_end")), reg(Reg::rdi));
+    emit(Op::test, reg(Reg::rbx), reg(Reg::rbx));
+    emit(Op::jnz, label(named("in_return")));
+    emit(Op::neg, val(Reg::r12));
+    emit(Op::jo, label(fail_label("in_bad")));
+    emit_label(named("in_return"));
+    emit(m_options.int32 ? Op::movsxd : Op::mov, reg(Reg::rax), val(Reg::r12));
+    emit(Op::pop, reg(Reg::r12));
+    emit(Op::pop, reg(Reg::rbx));
+    emit(Op::ret);
+
+    emit_label(named("in_fill"));
+    if (m_options.input_file) {  // everything is mapped already
+        emit(Op::mov, reg(Reg::rsi), mem(named("in_end")));
+        emit(Op::mov, reg(Reg::rdi), reg(Reg::rsi));
+        emit(Op::ret);
+    } else {
+        emit(Op::push, reg(Reg::rbp));
+        emit(Op::mov, reg(Reg::rbp), reg(Reg::rsp));
+        emit(Op::_and, reg(Reg::rsp), imm(-16));
+        emit(Op::_xor, reg(Reg::rdi, Width::d), reg(Reg::rdi, Width::d));
+        emit(Op::call, label(named("fflush")));  // prompts go out before the program waits
+        emit(Op::_xor, reg(Reg::rax, Width::d), reg(Reg::rax, Width::d));  // read
+        emit(Op::_xor, reg(Reg::rdi, Width::d), reg(Reg::rdi, Width::d));
+        emit(Op::mov, reg(Reg::rsi), label(named("in_buf")));
+        emit(Op::mov, reg(Reg::rdx), imm(INPUT_BUFFER_SIZE));
+        emit(Op::syscall);
+        emit(Op::mov, reg(Reg::rsi), label(named("in_buf")));
+        emit(Op::mov, reg(Reg::rdi), reg(Reg::rsi));
+        emit(Op::test, reg(Reg::rax), reg(Reg::rax));
+        emit(Op::jle, label(named("in_fill_done")));  // errors end the input too
+        emit(Op::add, reg(Reg::rdi), reg(Reg::rax));
+        emit_label(named("in_fill_done"));
+        emit(Op::mov, reg(Reg::rsp), reg(Reg::rbp));
+        emit(Op::pop, reg(Reg::rbp));
+        emit(Op::ret);
+
+        program.bss.push_back({
+            .kind = DataDef::Kind::zero, .label = named("in_buf"), .zero = INPUT_BUFFER_SIZE / 8
+        });
+    }
+
+    gen_fail("in_bad", "in_msg_bad", "INPUT: not a number\n");
+    gen_fail("in_eof", "in_msg_eof", "INPUT: end of input\n");
+
+    if (m_options.input_file) {
+        gen_fail("in_usage", "in_msg_usage", "usage: <program> <input file>\n");
+        gen_fail("in_open_fail", "in_msg_open", "INPUT: cannot read the input file\n");
+
+        program.bss.push_back({.kind = DataDef::Kind::zero, .label = named("in_stat"), .zero = 18});
+    }
+}
+
+// the only factor of an expression like `5`, `-5` or `I`, nullptr for anything longer
+static NodeFactor* single_factor(NodeExpr* expr, bool& is_negative) {
+    auto term = std::get_if<NodeTerm*>(&expr->term);
+    if (!term)
+        return nullptr;
+
+    auto fact = std::get_if<NodeFactor*>(&(*term)->fact);
+    if (!fact)
+        return nullptr;
+
+    is_negative = (*term)->is_negative;
+    return *fact;
+}
+
+std::optional<int64_t> Generator::const_index(NodeExpr* index) {
+    bool is_negative = false;
+    NodeFactor* fact = single_factor(index, is_negative);
+    if (!fact || !std::holds_alternative<NodeNum>(fact->body))
+        return std::nullopt;
+
+    const std::string& num = std::get<NodeNum>(fact->body).num;
+    int64_t i = number(is_negative ? "-" + num : num);
+
+    if (i < 0 || static_cast<uint64_t>(i) >= m_options.array_size)
+        Error::critical(m_line, std::format("Index {} is out of the `@` array!", i).c_str());
+    return i;
+}
+
+Operand Generator::gen_array_elem(NodeExpr* index) {
+    if (auto i = const_index(index))  // checked right here
+        return mem(Reg::r15, *i * word_size(), word());
+
+    bool is_negative = false;
+    NodeFactor* fact = single_factor(index, is_negative);
+
+    gen_expr(index);
+    emit(Op::pop, reg(Reg::rax));
+    if (m_options.int32)  // to an address, with the sign a negative one fails the check
+        emit(Op::movsxd, reg(Reg::rax), reg(Reg::rax, Width::d));
+
+    // a var checked earlier in the line still holds the same value
+    const NodeVar* var = fact && !is_negative ? std::get_if<NodeVar>(&fact->body) : nullptr;
+    if (var && var->index)
+        var = nullptr;
+
+    if (!var || !m_checked_index.contains(var->name)) {
+        emit(Op::cmp, reg(Reg::rax), imm(m_options.array_size));
+        emit(Op::jae, label(fail_label("array_bounds")));  // negative ones are huge unsigned
+
+        if (var)
+            m_checked_index.insert(var->name);
     }
 
-    m_output << "exit:\n";
+    Operand elem = mem(Reg::r15, Reg::rax, word_size());
+    elem.width = word();
+    return elem;
+}
+
+void Generator::gen_array_map() {
+    // r15 is the base of @ for the whole run, printf and the runtime keep it
+    emit(Op::mov, reg(Reg::rax), imm(9));  // mmap
+    emit(Op::_xor, reg(Reg::rdi, Width::d), reg(Reg::rdi, Width::d));
+    emit(Op::mov, reg(Reg::rsi), imm(m_options.array_size * word_size()));
+    emit(Op::mov, reg(Reg::rdx), imm(3));  // PROT_READ | PROT_WRITE
+    emit(Op::mov, reg(Reg::r10), imm(0x4022));  // MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE
+    emit(Op::mov, reg(Reg::r8), imm(-1));
+    emit(Op::_xor, reg(Reg::r9, Width::d), reg(Reg::r9, Width::d));
+    emit(Op::syscall);
+    emit(Op::cmp, reg(Reg::rax), imm(-4096));  // -errno
+    emit(Op::ja, label(fail_label("array_map_fail")));
+    emit(Op::mov, reg(Reg::r15), reg(Reg::rax));
+}
 
-    m_output << "\tmov rsp, rbp\n";
-    m_output << "\tpop rbp\n\n";
+void Generator::gen_div_runtime() {
+    gen_fail("div_zero", "div_msg_zero", "division by zero\n");
+    gen_fail("div_overflow", "div_msg_overflow", "division overflow\n");
+}
+
+void Generator::gen_array_runtime() {
+    gen_fail("array_bounds", "array_msg_bounds", "@: index out of range\n");
+    gen_fail("array_map_fail", "array_msg_map", "@: cannot map the array\n");
+}
 
-    m_output << "\tmov rax, 60\n";
-    m_output << "\tmov rdi, 0\n";
-    m_output << "\tsyscall\n";
+void Generator::gen_fail(const char* name, const char* msg, std::string text) {
+    // rt_error gets the message in rsi and its length in rdx, a function only the message for ctx->error
+    bool in_cold = std::exchange(m_in_cold, m_options.layout);
+
+    if (embedded() && text.ends_with('\n'))
+        text.pop_back();
+
+    emit_label(fail_label(name));
+    emit(Op::mov, reg(Reg::rsi), label(named(msg)));
+    if (!embedded())
+        emit(Op::mov, reg(Reg::rdx), imm(text.size()));
+    emit(Op::jmp, runtime("rt_error"));
+
+    m_in_cold = in_cold;
+
+    m_data.push_back({.kind = DataDef::Kind::bytes, .label = named(msg), .bytes = std::move(text)});
+}
+
+void Generator::gen_runtime_error() {
+    // the message goes to stderr and the program exits with code 2
+    emit_label(named("rt_error"));
+
+    if (embedded()) {  // or it is the error of the ctx, the vars stay as they were
+        emit(Op::mov, reg(Reg::rdi), mem(Reg::rbp, 16));
+        emit(Op::mov, mem(Reg::rdi, CTX_ERROR), reg(Reg::rsi));
+        emit(Op::mov, reg(Reg::rax, Width::d), imm(2));  // TINYB_ERROR
+        emit(Op::jmp, label(named("rt_return")));
+        return;
+    }
+
+    emit(Op::mov, reg(Reg::rbx), reg(Reg::rsi));
+    emit(Op::mov, reg(Reg::r12), reg(Reg::rdx));
+    emit(Op::_and, reg(Reg::rsp), imm(-16));
+    emit(Op::_xor, reg(Reg::rdi, Width::d), reg(Reg::rdi, Width::d));
+    emit(Op::call, label(named("fflush")));  // what the program printed comes first
+    emit(Op::mov, reg(Reg::rax), imm(1));  // write
+    emit(Op::mov, reg(Reg::rdi), imm(2));
+    emit(Op::mov, reg(Reg::rsi), reg(Reg::rbx));
+    emit(Op::mov, reg(Reg::rdx), reg(Reg::r12));
+    emit(Op::syscall);
+    emit(Op::mov, reg(Reg::rax), imm(60));
+    emit(Op::mov, reg(Reg::rdi), imm(2));
+    emit(Op::syscall);
+}
+
+void Generator::gen_asm(Emitter& out) {
+    clear();
 
-    std::string result = std::format(
-        "extern printf, putchar, scanf\n"
-        "section .data\n{}\n"
-        "section .text\n"
-        "\tglobal _start\n\n"
-        "_start:\n{}", 
-        m_data.str(), m_output.str()
+    bool input = std::any_of(
+        m_node_prog.lines.begin(), m_node_prog.lines.end(), 
+        [this](NodeLine* line) { return uses_input(line->stat); }
     );
 
-    return result;
+    AsmProgram program;
+    if (embedded()) {
+        program.entry = m_options.entry;
+        program.pic = true;
+    } else {
+        program.externs = {"printf", "putchar", "fflush"};
+    }
+    if (m_options.debug)
+        program.source = m_options.source_path;
+    if (m_options.profile)
+        program.externs.insert(program.externs.end(), {"getenv", "fopen", "fprintf", "fclose"});
+
+    std::optional<Cfg> cfg;
+    m_passes.run(Pass::cfg, [&] {
+        cfg.emplace(m_node_prog, !m_passes.enabled(Pass::unreachable));
+        m_cfg = &*cfg;
+        return cfg->size();
+    });
+
+    if (m_passes.enabled(Pass::unreachable)) {  // the walk of the graph found them, gen_line leaves them out
+        cfg->warn_unreachable();
+
+        size_t dropped = 0;
+        for (size_t i = 0; i < cfg->size(); i++)
+            dropped += !cfg->reachable(i);
+        m_passes.count(Pass::unreachable, dropped);
+    }
+
+    // their slots go after the vars; unrolling would throw the profile of the latch off
+    if (embedded())
+        m_unique_let = 26;
+
+    std::optional<Loops> loops;
+    if (m_passes.enabled(Pass::loops)) {
+        m_passes.run(Pass::loops, [&] {
+            loops.emplace(m_node_prog, *cfg, m_unique_let + 1, !m_options.profile);
+            return loops->changes();
+        });
+        m_loops = &*loops;
+
+        if (m_options.dump_loops)
+            loops->dump(m_node_prog, Error::sink());
+    }
+
+    std::optional<ProfilePlan> plan;
+    if (m_passes.enabled(Pass::profile) && m_options.profile_data) {
+        m_passes.run(Pass::profile, [&] {
+            plan.emplace(m_node_prog, *cfg, *m_options.profile_data);
+            return plan->changes();
+        });
+        m_plan = &*plan;
+
+        if (m_options.dump_profile)
+            plan->dump(m_node_prog, Error::sink());
+    }
+
+    if (embedded())
+        declare_letters();
+
+    // the run would make the profile and the registers it planned wrong
+    std::optional<PartialEval> eval;
+    if (m_passes.enabled(Pass::eval) && !m_options.profile && !m_plan) {
+        m_passes.run(Pass::eval, [&] {
+            std::vector<bool> resumable(m_node_prog.lines.size());
+            for (size_t i = 0; i < resumable.size(); i++)
+                resumable[i] = cfg->reachable(i);
+
+            for (size_t i = 0; m_loops && i < resumable.size(); i++) {
+                if (auto loop = m_loops->at_header(i))
+                    std::fill(resumable.begin() + i + 1, resumable.begin() + loop->latch + 1, false);
+            }
+
+            EvalBudget budget{
+                .steps = m_options.eval_steps, .memory = m_options.eval_memory, 
+                .array_size = m_options.array_size, .no_new_line = m_options.no_new_line, .int32 = m_options.int32
+            };
+            eval.emplace(m_node_prog, *cfg, resumable, budget);
+            return eval->steps();
+        });
+
+        if (m_options.dump_eval)
+            eval->dump(m_node_prog, Error::sink());
+        if (!eval->finished() && !eval->empty())
+            m_resume = eval->resume();
+    }
+
+    std::optional<Ranges> ranges;
+    if (m_passes.enabled(Pass::ranges) && !(eval && eval->finished())) {
+        m_passes.run(Pass::ranges, [&] {
+            ranges.emplace(m_node_prog, *cfg, m_options.int32);
+            return ranges->changes();
+        });
+        m_ranges = &*ranges;
+
+        if (m_options.dump_ranges)
+            ranges->dump(m_node_prog, Error::sink());
+    }
+
+    m_passes.run(Pass::codegen, [&] {
+        gen_prologue(m_unique_let + (m_loops ? m_loops->slots() : 0), input);
+        size_t body = m_code.size();
+        size_t body_data = m_data.size();
+
+        if (m_options.threads > 1 && m_node_prog.lines.size() >= 2 * MIN_SHARD_LINES) {
+            gen_lines_parallel();
+        } else {
+            for (size_t i = 0; i < m_node_prog.lines.size(); i++) {
+                gen_line(m_node_prog.lines[i], i);
+            }
+        }
+
+        // the last line may go on to the exit, which is somewhere else when either is cold
+        size_t last = m_node_prog.lines.size() - 1;
+        if (!m_node_prog.lines.empty() && cfg->reachable(last) && cfg->falls(last)) {
+            if (m_plan && m_plan->cold(last))
+                m_cold.push_back({Op::jmp, label(named("exit"))});
+            else if (m_options.layout)
+                m_code.push_back({Op::jmp, label(named("exit"))});
+        }
+
+        if (eval && eval->finished()) {  // the lines only had to compile, all they do is known
+            m_code.resize(body);
+            m_data.resize(body_data);
+            m_cold.clear();
+
+            gen_eval_output(*eval);
+            emit(Op::jmp, label(named("exit")));
+        } else if (m_resume) {  // goes in front of the lines
+            size_t end = m_code.size();
+
+            gen_eval_state(*eval);
+            gen_eval_output(*eval);
+            emit(Op::jmp, label({.kind = LabelKind::line, .id = *m_resume}));
+
+            std::rotate(m_code.begin() + body, m_code.begin() + end, m_code.end());
+        }
+
+        m_cfg = nullptr;
+        m_loops = nullptr;
+        m_plan = nullptr;
+        m_ranges = nullptr;
+
+        gen_epilogue(program, input);
+        return m_code.size();
+    });
+
+    if (m_passes.enabled(Pass::layout)) {
+        auto cold = std::find_if(m_code.begin(), m_code.end(), [](const Instr& in) { return in.op == Op::section; });
+        m_passes.count(Pass::layout, std::count_if(m_code.begin(), cold, [](const Instr& in) { return in.op == Op::align; })
+            + (cold == m_code.end() ? 0 : m_code.end() - cold - 1));
+    }
+
+    program.data = std::move(m_data);
+    program.text = std::move(m_code);
+
+    if (m_passes.enabled(Pass::peephole)) {
+        Peephole peephole{program.text};
+        m_passes.run(Pass::peephole, [&] {
+            peephole.run();
+            return peephole.rewrites();
+        });
+
+        if (m_options.peephole_stats)
+            peephole.print_stats(Error::sink());
+    }
+
+    if (m_options.pass_stats)
+        m_passes.print_stats(Error::sink());
+
+    print_asm(program, m_options.syntax, out);
+}
+
+void Generator::gen_prologue(size_t slots, bool input) {
+    if (embedded()) {
+        // the registers a C function keeps, then the ctx at [rbp+16] and the GOSUB depth at [rbp+8]
+        emit_label(named(m_options.entry.c_str()));
+        for (Reg r: {Reg::rbx, Reg::r12, Reg::r13, Reg::r14, Reg::r15})
+            emit(Op::push, reg(r));
+        emit(Op::push, reg(Reg::rdi));
+        emit(Op::_xor, reg(Reg::rax, Width::d), reg(Reg::rax, Width::d));
+        emit(Op::push, reg(Reg::rax));
+    } else {
+        emit_label(named("_start"));
+    }
+
+    emit(Op::push, reg(Reg::rbp));
+    emit(Op::mov, reg(Reg::rbp), reg(Reg::rsp));
+    if (slots)
+        emit(Op::sub, reg(Reg::rsp), imm(((slots + 1) * word_size() + 7) / 8 * 8));
+
+    if (embedded()) {
+        emit(Op::_xor, reg(Reg::r15, Width::d), reg(Reg::r15, Width::d));  // nothing to unmap yet
+        for (char name = 'A'; name <= 'Z'; name++) {  // with --int32 the low half of each, wrapped around
+            emit(Op::mov, val(Reg::rax), mem(Reg::rdi, CTX_VARS + (name - 'A') * 8, word()));
+            emit(Op::mov, get_var(m_vars.at(std::string(1, name))), val(Reg::rax));
+        }
+
+        if (m_options.emit == Emit::repl) {  // the table and the line to start at, past the mapping of `@`
+            emit(Op::mov, reg(Reg::r14), reg(Reg::rsi));
+            emit(Op::mov, reg(Reg::rbx), reg(Reg::rdx));
+        }
+
+        m_data.push_back({.kind = DataDef::Kind::bytes, .label = named("rt_nl"), .bytes = "\n"});
+    }
+
+    if (m_node_prog.uses_array)
+        gen_array_map();
+    if (input && m_options.input_file)
+        gen_input_map();
+
+    if (embedded())
+        return;
+
+    // for print nums
+    const char* frm = m_options.int32 ? "%d" : "%li";
+    m_data.push_back({.kind = DataDef::Kind::bytes, .label = named("frm"), .bytes = frm});
+    m_data.push_back({.kind = DataDef::Kind::bytes, .label = named("frmn"), .bytes = std::string(frm) + "\n"});
+
+    m_data.push_back({.kind = DataDef::Kind::quads, .label = named("cntr"), .quads = {imm(0)}});
+
+    if (m_options.profile_cycles) {
+        emit(Op::rdtsc);
+        emit(Op::shl, reg(Reg::rdx), imm(32));
+        emit(Op::_or, reg(Reg::rax), reg(Reg::rdx));
+        emit(Op::mov, mem(named("prof_tsc")), reg(Reg::rax));
+    }
+}
+
+void Generator::gen_epilogue(AsmProgram& program, bool input) {
+    // the exit and the profile report run once, so they are cold as well
+    m_in_cold = m_options.layout;
+    gen_loc(0);
+
+    emit_label(named("exit"));
+
+    if (embedded()) {
+        gen_embed_exit();
+    } else {
+        emit(Op::mov, reg(Reg::rsp), reg(Reg::rbp));
+        emit(Op::pop, reg(Reg::rbp));
+
+        if (m_options.profile)
+            emit(Op::call, label(named("prof_report")));
+
+        emit(Op::_xor, reg(Reg::rdi, Width::d), reg(Reg::rdi, Width::d));
+        emit(Op::call, label(named("fflush")));  // printf output is buffered when it isn't a terminal
+
+        emit(Op::mov, reg(Reg::rax), imm(60));
+        emit(Op::mov, reg(Reg::rdi), imm(0));
+        emit(Op::syscall);
+    }
+
+    if (m_options.profile)
+        gen_profile_report(program);
+    if (input || m_node_prog.uses_array || embedded())
+        gen_runtime_error();
+
+    m_in_cold = false;
+    gen_loc(0);
+    if (embedded())
+        gen_embed_runtime(input);
+    else if (input)
+        gen_input_runtime(program);
+    if (m_node_prog.uses_array)
+        gen_array_runtime();
+    if (embedded())
+        gen_div_runtime();
+
+    if (m_options.layout && !m_cold.empty())
+        m_code.push_back({Op::section, label(named(".text.unlikely"))});
+    m_code.insert(m_code.end(), m_cold.begin(), m_cold.end());
+    m_cold.clear();
+}
+
+void Generator::gen_embed_exit() {
+    // the vars go back to the ctx, then rt_return keeps the status in eax
+    emit(Op::mov, reg(Reg::rdi), mem(Reg::rbp, 16));
+    for (char name = 'A'; name <= 'Z'; name++) {
+        Operand var = get_var(m_vars.at(std::string(1, name)));
+        emit(m_options.int32 ? Op::movsxd : Op::mov, reg(Reg::rax), var);
+        emit(Op::mov, mem(Reg::rdi, CTX_VARS + (name - 'A') * 8), reg(Reg::rax));
+    }
+    emit(Op::_xor, reg(Reg::rax, Width::d), reg(Reg::rax, Width::d));  // TINYB_OK
+
+    emit_label(named("rt_return"));
+    if (m_node_prog.uses_array) {
+        emit(Op::test, reg(Reg::r15), reg(Reg::r15));
+        emit(Op::jz, label(named("rt_unmapped")));
+        emit(Op::mov, reg(Reg::rbx), reg(Reg::rax));
+        emit(Op::mov, reg(Reg::rax), imm(11));  // munmap
+        emit(Op::mov, reg(Reg::rdi), reg(Reg::r15));
+        emit(Op::mov, reg(Reg::rsi), imm(m_options.array_size * word_size()));
+        emit(Op::syscall);
+        emit(Op::mov, reg(Reg::rax), reg(Reg::rbx));
+        emit_label(named("rt_unmapped"));
+    }
+
+    emit(Op::mov, reg(Reg::rsp), reg(Reg::rbp));
+    emit(Op::pop, reg(Reg::rbp));
+    emit(Op::add, reg(Reg::rsp), imm(16));  // the GOSUB depth and the ctx
+    for (Reg r: {Reg::r15, Reg::r14, Reg::r13, Reg::r12, Reg::rbx})
+        emit(Op::pop, reg(r));
+    emit(Op::ret);
+}
+
+void Generator::gen_embed_runtime(bool input) {
+    /*
+        The helpers run on a frame of their own aligned to 16 bytes, the
+        frame of the program is where their rbp points and the ctx is over
+        it. The callbacks keep rbx, rbp and r12-r15 like any C function.
+    */
+    auto call_back = [this](int64_t offset) {
+        emit(Op::mov, reg(Reg::rax), mem(Reg::rbp));
+        emit(Op::mov, reg(Reg::rax), mem(Reg::rax, 16));
+        emit(Op::mov, reg(Reg::rdi), mem(Reg::rax, CTX_USER));
+        emit(Op::call, mem(Reg::rax, offset));
+    };
+
+    // the number in rsi, the text in rsi and its length in rdx
+    for (auto [name, offset]: {std::pair{"rt_print_num", CTX_PRINT_NUMBER}, std::pair{"rt_print_text", CTX_PRINT_TEXT}}) {
+        emit_label(named(name));
+        emit(Op::push, reg(Reg::rbp));
+        emit(Op::mov, reg(Reg::rbp), reg(Reg::rsp));
+        emit(Op::_and, reg(Reg::rsp), imm(-16));
+        call_back(offset);
+        emit(Op::mov, reg(Reg::rsp), reg(Reg::rbp));
+        emit(Op::pop, reg(Reg::rbp));
+        emit(Op::ret);
+    }
+
+    if (!input)
+        return;
+
+    // the next number into rax, the callback writes it into the slot rsi points to
+    emit_label(named("in_number"));
+    emit(Op::push, reg(Reg::rbp));
+    emit(Op::mov, reg(Reg::rbp), reg(Reg::rsp));
+    emit(Op::sub, reg(Reg::rsp), imm(16));
+    emit(Op::_and, reg(Reg::rsp), imm(-16));
+    emit(Op::mov, reg(Reg::rsi), reg(Reg::rsp));
+    call_back(CTX_INPUT_NUMBER);
+    emit(Op::mov, reg(Reg::rdx), reg(Reg::rax));
+    emit(Op::mov, reg(Reg::rax), mem(Reg::rsp));
+    emit(Op::mov, reg(Reg::rsp), reg(Reg::rbp));
+    emit(Op::pop, reg(Reg::rbp));
+    emit(Op::test, reg(Reg::rdx, Width::d), reg(Reg::rdx, Width::d));
+    emit(Op::jz, label(fail_label("in_eof")));  // rt_error unwinds the frame of the program
+    emit(Op::jl, label(fail_label("in_bad")));
+    if (m_options.int32) {  // the callback gives 64 bits, a var takes 32
+        emit(Op::movsxd, reg(Reg::rcx), reg(Reg::rax, Width::d));
+        emit(Op::cmp, reg(Reg::rcx), reg(Reg::rax));
+        emit(Op::jne, label(fail_label("in_bad")));
+    }
+    emit(Op::ret);
+
+    gen_fail("in_bad", "in_msg_bad", "INPUT: not a number\n");
+    gen_fail("in_eof", "in_msg_eof", "INPUT: end of input\n");
+}
+
+void Generator::stream_begin(Emitter& out) {
+    clear();
+    print_asm_head({"printf", "putchar", "fflush"}, m_options.debug ? m_options.source_path : "", m_options.syntax, out);
+
+    // the prologue needs the vars of the whole program, it comes at the end and jumps back here
+    emit_label(named("body"));
+
+    if (m_passes.enabled(Pass::peephole))
+        m_stream_peephole.emplace(m_code);
+}
+
+void Generator::stream_line(NodeLine* line, Emitter& out) {
+    m_stream_input = m_stream_input || uses_input(line->stat);
+
+    size_t start = m_code.size();
+    m_passes.run(Pass::codegen, [&] {
+        gen_line(line, m_stream_lines++);
+        return m_code.size() - start;
+    });
+
+    // the pieces are split where they would be without -g
+    m_stream_batch += std::count_if(m_code.begin() + start, m_code.end(), [](const Instr& in) { return !is_debug(in); });
+    if (m_stream_batch >= STREAM_BATCH)
+        flush_stream(out);
+}
+
+void Generator::stream_end(bool uses_array, Emitter& out) {
+    emit(Op::jmp, label(named("exit")));
+
+    m_node_prog.uses_array = uses_array;
+    gen_loc(0);
+    gen_prologue(m_free_var_ptr - 1, m_stream_input);
+    emit(Op::jmp, label(named("body")));
+
+    AsmProgram program;
+    gen_epilogue(program, m_stream_input);
+    flush_stream(out);
+    print_asm_bss(program.bss, m_options.syntax, out);
+
+    if (m_stream_peephole && m_options.peephole_stats)
+        m_stream_peephole->print_stats(Error::sink());
+    if (m_options.pass_stats)
+        m_passes.print_stats(Error::sink());
+    m_stream_peephole.reset();
+}
+
+void Generator::flush_stream(Emitter& out) {
+    // lines end at a statement boundary, nothing the peephole tracks goes on into the next piece
+    if (m_stream_peephole) {
+        m_passes.run(Pass::peephole, [this] {
+            size_t before = m_stream_peephole->rewrites();
+            m_stream_peephole->run();
+            return m_stream_peephole->rewrites() - before;
+        });
+    }
+
+    print_asm_piece(m_code, m_data, m_options.syntax, out);
+    m_code.clear();
+    m_data.clear();
+    m_stream_batch = 0;
+}
+
+void Generator::gen_repl_runtime(Emitter& out) {
+    clear();
+    m_node_prog.uses_array = true;
+    m_unique_let = 26;
+    declare_letters();
+
+    AsmProgram program{.entry = m_options.entry, .pic = true, .table = "tinyb_repl_runtime"};
+
+    gen_prologue(m_unique_let, true);
+    emit(Op::jmp, reg(Reg::rbx));
+    gen_epilogue(program, true);
+    gen_fail("rt_no_line", "rt_msg_no_line", "GOTO: no such line\n");
+
+    DataDef table{.kind = DataDef::Kind::quads, .label = named(program.table)};
+    for (const char* name: REPL_RUNTIME)
+        table.quads.push_back(label(named(name)));
+    m_data.push_back(std::move(table));
+
+    program.data = std::move(m_data);
+    program.text = std::move(m_code);
+
+    if (m_options.peephole)
+        Peephole{program.text}.run();
+
+    print_asm(program, m_options.syntax, out);
+}
+
+void Generator::gen_repl_lines(const std::vector<NodeLine*>& lines, const std::function<size_t(uint64_t)>& line_slot, Emitter& out) {
+    clear();
+    m_line_slot = &line_slot;
+    declare_letters();
+
+    AsmProgram program{.entry = "", .pic = true, .table = "tinyb_repl_lines"};
+    DataDef table{.kind = DataDef::Kind::quads, .label = named(program.table)};
+    m_data.push_back({.kind = DataDef::Kind::bytes, .label = named("rt_nl"), .bytes = "\n"});
+
+    for (size_t i = 0; i < lines.size(); i++) {
+        Label start{.kind = LabelKind::line, .id = i};
+        table.quads.push_back(label(start));
+        emit_label(start);
+
+        gen_line(lines[i], i);
+
+        if (lines[i]->num.has_value())
+            emit(Op::jmp, mem(Reg::r14, (line_slot(line_label(lines[i]->num->num).id) + 1) * 8));
+        else
+            emit(Op::jmp, runtime("exit"));
+    }
+
+    gen_array_runtime();
+    gen_div_runtime();
+    m_data.push_back(std::move(table));
+    m_line_slot = nullptr;
+
+    program.data = std::move(m_data);
+    program.text = std::move(m_code);
+
+    if (m_options.peephole)
+        Peephole{program.text}.run();
+
+    print_asm(program, m_options.syntax, out);
 }
 
 void Generator::clear() {
-    m_output.clear();
+    m_code.clear();
+    m_cold.clear();
     m_data.clear();
     m_vars.clear();
 
     m_data_counter = 1;
     m_skip_counter = 1;
     m_free_var_ptr = 1;
+
+    m_prof_sites.clear();
+    m_prof_entry = {};
+
+    m_resume.reset();
+    m_line_slot = nullptr;
+    m_stream_lines = 0;
+    m_stream_batch = 0;
+    m_stream_input = false;
 }
@@ -1,19 +1,156 @@
 #pragma once
 
 #include <cstddef>
-#include <sstream>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <optional>
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
+#include "asm.hpp"
+#include "cfg.hpp"
+#include "emitter.hpp"
+#include "eval.hpp"
+#include "loops.hpp"
 #include "parser.hpp"
+#include "passes.hpp"
+#include "peephole.hpp"
+#include "profile.hpp"
+#include "ranges.hpp"
+
+enum class Emit : uint8_t {
+    exe,    // a program of its own, _start to the exit syscall
+    obj,    // an object file with the C function of include/tinyb.h
+    shared, // the same linked into a shared library
+    repl,   // the runtime and the lines of --repl, see gen_repl_runtime
+    c       // a program of its own through C and the system compiler, see CGenerator
+};
+
+struct GenOptions {
+    bool no_new_line = false;
+    bool profile = false;         // count executions of lines and IF/GOTO edges
+    bool profile_cycles = false;  // also accumulate rdtsc cycles per line
+    std::string profile_path = "out.prof";  // TINYB_PROFILE overrides it at run time
+    size_t threads = 1;           // code generation threads for big programs
+    bool input_file = false;      // INPUT reads the file given as the first argument of the program
+    bool peephole = true;         // rewrite the emitted instructions with the peephole patterns
+    bool peephole_stats = false;  // report how often every pattern fired
+    size_t array_size = 1 << 24;  // elements of `@`, only the touched pages take memory
+    bool int32 = false;           // vars, `@` and arithmetic of 32 bits that wrap around
+    bool loops = true;            // strength reduction and unrolling of counted loops
+    bool dump_loops = false;      // print the loops found
+    bool ranges = true;           // 32-bit arithmetic and IFs decided by the value ranges of the vars
+    bool dump_ranges = false;     // print what the ranges decided
+    bool layout = true;           // align loop heads, put rarely run code in .text.unlikely
+    bool drop_unreachable = true; // leave out the lines no path gets to, the unreachable pass
+    std::string source_hash;      // written into the profile, it has to match for --profile-use
+    std::string profile_use;      // --profile-use file, the driver reads it into profile_data
+    std::shared_ptr<const Profile> profile_data;
+    bool use_profile = true;      // plan by profile_data, the profile pass
+    bool dump_profile = false;    // print what the profile decided
+    bool debug = false;           // DWARF lines of the source and a symbol for every numbered line
+    std::string source_path = "source.bas";  // named by the debug info
+    Syntax syntax = Syntax::nasm;  // of the assembly, and so the assembler run on it
+    size_t eval_steps = 1000000;  // lines the compiler may run the program for, 0 - not at all
+    size_t eval_memory = 1 << 20; // bytes of output and state the run may keep
+    bool dump_eval = false;       // print where the run stopped
+    bool pass_stats = false;      // print the time and changes of every pass
+    Emit emit = Emit::exe;
+    std::string entry = "tinyb_run";  // name of the C function with --emit=obj|shared
+};
+
+constexpr size_t MIN_SHARD_LINES = 2048;
+constexpr size_t STREAM_BATCH = 16 * 1024;
+constexpr size_t INPUT_BUFFER_SIZE = 64 * 1024;
+constexpr size_t MAX_ARRAY_SIZE = 1 << 28;  // element offsets stay 32-bit displacements
+
+// offsets into the tinyb_ctx of include/tinyb.h
+constexpr int64_t CTX_VARS = 0;
+constexpr int64_t CTX_USER = 208;
+constexpr int64_t CTX_PRINT_NUMBER = 216;
+constexpr int64_t CTX_PRINT_TEXT = 224;
+constexpr int64_t CTX_INPUT_NUMBER = 232;
+constexpr int64_t CTX_ERROR = 240;
+
+// the first slots of the --repl table, a pair of slots for every line number follows them
+constexpr const char* REPL_RUNTIME[] = {"exit", "rt_error", "rt_print_num", "rt_print_text", "in_number", "rt_no_line"};
+constexpr size_t REPL_SLOTS = std::size(REPL_RUNTIME);
 
 class Generator {
 public:
-    explicit Generator(NodeProg& node_prog, size_t unique_let, bool no_new_line) 
-        : m_node_prog(std::move(node_prog)), m_unique_let(unique_let), m_no_new_line(no_new_line) {}
+    explicit Generator(NodeProg& node_prog, size_t unique_let, GenOptions options) 
+        : m_node_prog(std::move(node_prog)), m_unique_let(unique_let), m_options(std::move(options)), m_passes(m_options) {}
+
+    // shard worker, or a program streamed through stream_begin/line/end
+    explicit Generator(GenOptions options) : m_options(std::move(options)), m_passes(m_options) {}
+
+    void gen_asm(Emitter& out);
+
+    /*
+        A program generated as it is parsed, a line at a time, for inputs too
+        big to keep. There is no control flow graph, so every line is kept and
+        labeled, and no loop or profile optimizations. The code goes to `out`
+        in pieces of about STREAM_BATCH instructions.
+    */
+    void stream_begin(Emitter& out);
+    void stream_line(NodeLine* line, Emitter& out);
+    void stream_end(bool uses_array, Emitter& out);
+
+    /*
+        The code of --repl is in pieces that only know each other through a
+        table of addresses (r14 points to it): the runtime goes first, the
+        code of every line number and the code that comes after it go into
+        the pair of slots `line_slot` gives the number. A line ends with a
+        jump through the second slot of its pair, a GOTO or GOSUB goes
+        through the first one of its target, so lines can be compiled and
+        replaced one at a time.
 
-    std::string gen_asm();
+        The runtime is the C function of the options, called with the ctx,
+        the table and the code to start at. It exports tinyb_repl_runtime,
+        the addresses of REPL_RUNTIME, and uses `@` and INPUT whether or not
+        any line does. The lines of a batch go into a shared library of
+        their own that exports tinyb_repl_lines, their code in their order;
+        a line without a number ends the run.
+    */
+    void gen_repl_runtime(Emitter& out);
+    void gen_repl_lines(const std::vector<NodeLine*>& lines, const std::function<size_t(uint64_t)>& line_slot, Emitter& out);
 private:
+    void flush_stream(Emitter& out);
+    size_t m_stream_lines = 0;
+    size_t m_stream_batch = 0;  // instructions of the piece, without the -g markers
+    bool m_stream_input = false;  // some line has INPUT
+    std::optional<Peephole> m_stream_peephole;  // over m_code, its stats add up over the pieces
+
+    void gen_prologue(size_t slots, bool input);
+    void gen_epilogue(AsmProgram& program, bool input);  // exit, profile report and runtime
+
+    /*
+        With --emit=obj|shared the program is a C function of the ctx in
+        include/tinyb.h. It starts with the vars the ctx has and writes them
+        back when it ends, prints and reads through the callbacks of the ctx
+        and returns TINYB_OK, or TINYB_ERROR with ctx->error set. Everything
+        it changes is on its stack or in its own mapping of `@`, so it can run
+        on any number of threads at once.
+    */
+    bool embedded() const { return m_options.emit != Emit::exe; }
+    void gen_embed_runtime(bool input);  // the callbacks, called with the stack aligned
+    void gen_embed_exit();
+
+    // GOSUBs active: a global of the program, a slot over the frame of the function
+    inline Operand gosub_depth() {
+        return embedded() ? mem(Reg::rbp, 8) : mem(named("cntr"));
+    }
+
+    void declare_letters();  // A to Z in slots 1 to 26, all of them set by the host
+    const std::function<size_t(uint64_t)>* m_line_slot = nullptr;  // while the lines of --repl are generated
+
+    Operand line_target(const std::string& num);  // of GOTO and GOSUB
+    Operand runtime(const char* name);  // a routine of REPL_RUNTIME, through the table in the lines of --repl
+
     void remove_extra_zeros(std::string& str);
 
     void gen_fact_op(NodeFactorOp* fact_op, bool is_negative);
@@ -24,38 +161,128 @@ private:
     void gen_expr(NodeExpr* expr);
     
     void gen_stat(NodeStat* stat);
-    void gen_line(NodeLine* line);
+    void check_stat(NodeStat* stat);  // the errors of gen_stat and the vars it declares, without the code
+    void gen_line(NodeLine* line, size_t index);
+
+    void gen_loop_entry(const Loop& loop);
+    void gen_loop_body(const Loop& loop);
+    bool m_use_derived = true;  // off while the entry code computes them, and in inlined subroutines
+
+    void gen_inline(const std::vector<NodeLine*>& body);
 
-    inline std::string get_var_pointer(size_t stack_loc) {
-        std::stringstream var_pointer;
-        var_pointer << "[rbp-" << stack_loc * 8 << "]";
-        return var_pointer.str();
+    void gen_eval_state(const PartialEval& eval);   // vars and `@` as the run left them
+    void gen_eval_output(const PartialEval& eval);  // what it printed
+    std::optional<size_t> m_resume;  // line the code starts at after the evaluated ones
+    std::vector<Instr> m_cold;  // rarely run code, in a section of its own
+    bool m_in_cold = false;     // emit goes there
+    size_t m_if_site = 0;       // IFs of the current line so far, to find their counts in the profile
+
+    struct Var {
+        size_t stack_loc;
+        Reg reg = Reg::none;  // kept there instead, as the profile decided
+    };
+    Var new_var(const std::string& name, size_t& free_var_ptr) const;
+
+    // a value is 64 bits, or the low 32 of a register with --int32 (the rest is garbage until
+    // it leaves the program: an index of `@`, the callbacks of a ctx)
+    inline Width word() const { return m_options.int32 ? Width::d : Width::q; }
+    inline int64_t word_size() const { return m_options.int32 ? 4 : 8; }
+    inline Operand val(Reg r) const { return reg(r, word()); }
+
+    inline Operand get_var(size_t stack_loc) {
+        return mem(Reg::rbp, -static_cast<int64_t>(stack_loc) * word_size(), word());
+    }
+
+    inline Operand get_var(const Var& var) {
+        return var.reg != Reg::none ? val(var.reg) : get_var(var.stack_loc);
+    }
+
+    void push_value(Operand value);  // a var or an element of `@`, there is no push of a dword
+
+    inline void emit(Op op, Operand a = {}, Operand b = {}) {
+        (m_in_cold ? m_cold : m_code).push_back({op, a, b});
+    }
+
+    inline void emit_label(Label l) {
+        (m_in_cold ? m_cold : m_code).push_back({Op::label, label(l)});
     }
 
-    inline std::string get_var_value(size_t stack_loc) {
-        return "QWORD " + get_var_pointer(stack_loc);
+    inline void gen_loc(size_t line) {  // what follows comes from this source line, for the debug info
+        if (m_options.debug)
+            emit(Op::loc, imm(line));
     }
 
+    Label line_label(std::string num);
+    int64_t number(const std::string& num);
+
     int write_str_in_data(std::string& str);
     void print_number(bool last_print);
     void print_str(std::string& str, bool last_print);
 
+    void gen_profile_line(size_t index);
+    void gen_profile_report(AsmProgram& program);
+
+    bool uses_input(NodeStat* stat);
+    void gen_input_map();
+    void gen_input_runtime(AsmProgram& program);
+
+    Operand gen_array_elem(NodeExpr* index);  // address of @(index), valid until rax changes
+    std::optional<int64_t> const_index(NodeExpr* index);  // checked against the array, nullopt - not a constant
+    void gen_array_map();
+    void gen_array_runtime();
+    void gen_div_runtime();  // errors of a division with --emit=obj|shared and --repl
+    std::unordered_set<std::string> m_checked_index;  // vars already bounds checked in this line
+
+    void gen_fail(const char* name, const char* msg, std::string text);
+    void gen_runtime_error();
+
     size_t m_line = 1;
+    size_t m_index = 0;  // of the line in the program
 
-    std::stringstream m_output;
-    std::stringstream m_data;
+    std::vector<Instr> m_code;
+    std::vector<DataDef> m_data;
 
     size_t m_data_counter = 1;
     size_t m_skip_counter = 1;
 
     size_t m_unique_let = 0;
     size_t m_free_var_ptr = 1;
-    struct Var { size_t stack_loc; };
     std::unordered_map<std::string, Var> m_vars;
 
-    bool m_no_new_line = false;
+    GenOptions m_options;
+    PassManager m_passes;
+
+    struct ProfSite {
+        size_t line;
+        bool is_if;         // false - goto
+        Operand taken;      // counter of the taken edge
+        Operand entry;      // counter of reaching the branch
+    };
+    std::vector<ProfSite> m_prof_sites;
+    size_t m_prof_site_base = 0;
+    Operand m_prof_entry;  // counter of whatever reached the current stat
+
+    // what a shard of lines starts with, so every shard prints exactly what a serial run would
+    struct ShardStart {
+        size_t data_counter;
+        size_t skip_counter;
+        size_t prof_site;
+        size_t free_var_ptr;
+        std::unordered_map<std::string, Var> vars;
+    };
+    void count_stat(NodeStat* stat, ShardStart& state);
+    void count_loop_body(const Loop& loop, ShardStart& state);
+    void declare_vars(NodeStat* stat, std::unordered_map<std::string, Var>& vars, size_t& free_var_ptr);
+    void gen_lines_parallel();
 
     NodeProg m_node_prog;
+    const Cfg* m_cfg = nullptr;  // of m_node_prog, while gen_asm runs
+    const Loops* m_loops = nullptr;
+    const ProfilePlan* m_plan = nullptr;  // with --profile-use
+    const Ranges* m_ranges = nullptr;
+
+    // what the ranges say of an IF the code generated with `vars` would test
+    std::optional<bool> decided(const NodeStatIf* stat_if, const std::unordered_map<std::string, Var>& vars) const;
 
     void clear();
 };
\ No newline at end of file
@@ -1,18 +1,18 @@
 #include "lexer.hpp"
 #include "error.hpp"
+#include "scan.hpp"
 
-#include <cctype>
 #include <format>
+#include <optional>
 #include <string>
+#include <string_view>
 #include <utility>
 #include <vector>
 
 Token Lexer::tokenize_alpha() {
-    std::string buf;
-    
-    while (peek().has_value() && std::isalpha(peek().value())) {
-        buf.push_back(consume());
-    }
+    size_t size = span(scan::alpha);
+    std::string_view buf(m_code.data() + m_index, size);
+    m_index += size;
 
     if      (buf == "PRINT")  return {.type = TokenType::print, .line=m_line};
     else if (buf == "IF")     return {.type = TokenType::_if, .line=m_line};
@@ -26,15 +26,13 @@ Token Lexer::tokenize_alpha() {
     else if (buf == "LIST")   return {.type = TokenType::list, .line=m_line};
     else if (buf == "RUN")    return {.type = TokenType::run, .line=m_line};
     else if (buf == "END")    return {.type = TokenType::end, .line=m_line};
-    else                      return {.type = TokenType::var, .line=m_line, .var = buf};
+    else                      return {.type = TokenType::var, .line=m_line, .var = std::string(buf)};
 }
 
 Token Lexer::tokenize_digit() {
-    std::string buf;
-
-    while (peek().has_value() && std::isdigit(peek().value())) {
-        buf.push_back(consume());
-    }
+    size_t size = span(scan::digits);
+    std::string buf = m_code.substr(m_index, size);
+    m_index += size;
 
     return {.type = TokenType::num, .line=m_line, .var = buf};
 }
@@ -43,21 +41,19 @@ Token Lexer::tokenize_str() {
     std::string buf;
     consume();  // skip first double quotes
 
-    while (peek().has_value() && peek().value() != '"') {
-        if (peek().value() == '\\' && peek(1).has_value()) {  // escape sequence
-            switch (peek(1).value()) {
-                case 'n':
-                    buf.push_back('\n');
-                    break;
-                case 't':
-                    buf.push_back('\t');
-                    break;
-                default:
-                    buf.push_back(consume());
-                    continue;
-            }
-            consume();
-            consume();
+    for (;;) {
+        size_t size = span(scan::str_text);
+        buf.append(m_code, m_index, size);
+        m_index += size;
+
+        if (!peek().has_value() || peek().value() == '"')
+            break;
+
+        // escape sequence, a backslash before anything else stays
+        std::optional<char> next = peek(1);
+        if (next == 'n' || next == 't') {
+            buf.push_back(next == 'n' ? '\n' : '\t');
+            m_index += 2;
         } else {
             buf.push_back(consume());
         }
@@ -67,46 +63,46 @@ Token Lexer::tokenize_str() {
 }
 
 void Lexer::remove_comments() {
-    while (peek().has_value() && peek().value() != '\n') {
+    m_index += span(scan::to_newline);
+    m_index--;  // so that the lexer doesn't miss cr
+}
+
+void Lexer::gen_token(std::vector<Token>& result) {
+    char c = peek().value();
+
+    if (scan::is_alpha(c)) {
+        result.push_back(tokenize_alpha());
+    } else if (scan::is_digit(c)) {
+        result.push_back(tokenize_digit());
+    } else {
+        switch (c) {
+            case '(': result.push_back({.type = TokenType::open_paren, .line=m_line}); break;
+            case ')': result.push_back({.type = TokenType::close_paren, .line=m_line}); break;
+            case '>': result.push_back({.type = TokenType::gt, .line=m_line}); break;
+            case '<': result.push_back({.type = TokenType::lt, .line=m_line}); break;
+            case '=': result.push_back({.type = TokenType::eq, .line=m_line}); break;
+            case '+': result.push_back({.type = TokenType::plus, .line=m_line}); break;
+            case '-': result.push_back({.type = TokenType::minus, .line=m_line}); break;
+            case '*': result.push_back({.type = TokenType::mul, .line=m_line}); break;
+            case '/': result.push_back({.type = TokenType::div, .line=m_line}); break;
+            case ',': result.push_back({.type = TokenType::com, .line=m_line}); break;
+            case '@': result.push_back({.type = TokenType::at, .line=m_line}); break;
+            case '\n': result.push_back({.type = TokenType::cr, .line=m_line++}); break;
+            case '"': result.push_back(tokenize_str()); break;
+            case '\'': remove_comments(); break;
+            case ' ': m_index += span(scan::spaces) - 1; break;  // the last one is consumed below
+            default: Error::warning(m_line, "Non-standard character!"); break;
+        }
         consume();
     }
-
-    m_index--;  // so that the lexer doesn't miss cr
 }
 
 std::vector<Token> Lexer::gen_tokens() {
     std::vector<Token> result;
-    std::string buf;
-
-    while (true) {
-        auto c = peek();
-        if (!c.has_value()) break;
+    result.reserve(m_code.size() / LEXER_BYTES_PER_TOKEN);  // no moves of what is there as it grows
 
-        if (std::isalpha(c.value())) {
-            result.push_back(tokenize_alpha());
-        } else if (std::isdigit(c.value())) {
-            result.push_back(tokenize_digit());
-        } else {
-            switch (c.value()) {
-                case '(': result.push_back({.type = TokenType::open_paren, .line=m_line}); break;
-                case ')': result.push_back({.type = TokenType::close_paren, .line=m_line}); break;
-                case '>': result.push_back({.type = TokenType::gt, .line=m_line}); break;
-                case '<': result.push_back({.type = TokenType::lt, .line=m_line}); break;
-                case '=': result.push_back({.type = TokenType::eq, .line=m_line}); break;
-                case '+': result.push_back({.type = TokenType::plus, .line=m_line}); break;
-                case '-': result.push_back({.type = TokenType::minus, .line=m_line}); break;
-                case '*': result.push_back({.type = TokenType::mul, .line=m_line}); break;
-                case '/': result.push_back({.type = TokenType::div, .line=m_line}); break;
-                case ',': result.push_back({.type = TokenType::com, .line=m_line}); break;
-                case '\n': result.push_back({.type = TokenType::cr, .line=m_line++}); break;
-                case '"': result.push_back(tokenize_str()); break;
-                case '\'': remove_comments();
-                case ' ': break;
-                default: Error::warning(m_line, "Non-standard character!"); break;
-            }
-            consume();
-        }
-    }
+    while (peek().has_value())
+        gen_token(result);
     
     if (result.size() != 0)
         result.push_back({.type=TokenType::cr, .line=m_line});
@@ -116,12 +112,55 @@ std::vector<Token> Lexer::gen_tokens() {
     return result;
 }
 
+bool Lexer::next_line(std::vector<Token>& tokens) {
+    tokens.clear();
+
+    // the lines before are lexed, their text can go
+    m_code.erase(0, m_index);
+    m_index = 0;
+
+    while (peek().has_value()) {
+        gen_token(tokens);
+
+        if (!tokens.empty() && tokens.back().type == TokenType::cr)
+            return true;
+    }
+
+    if (tokens.size() != 0)
+        tokens.push_back({.type=TokenType::cr, .line=m_line});
+
+    return tokens.size() != 0;
+}
+
+template <typename Scan>
+size_t Lexer::span(Scan scan) {
+    size_t i = m_index;
+    for (;;) {
+        i += scan(m_code.data() + i, m_code.data() + m_code.size());
+        if (i < m_code.size() || !read_more())
+            return i - m_index;
+    }
+}
+
+bool Lexer::read_more() {
+    if (!m_input || !*m_input)
+        return false;
+
+    size_t size = m_code.size();
+    m_code.resize(size + LEXER_READ_SIZE);
+    m_input->read(m_code.data() + size, LEXER_READ_SIZE);
+    m_code.resize(size + m_input->gcount());
+
+    return m_code.size() > size;
+}
+
 std::optional<char> Lexer::peek(int offset) {
-    if (m_index + offset >= m_code.length()) {
-        return {};
-    } else {
-        return m_code.at(m_index + offset);
+    while (m_index + offset >= m_code.length()) {
+        if (!read_more())
+            return {};
     }
+
+    return m_code.at(m_index + offset);
 }
 
 char Lexer::consume() {
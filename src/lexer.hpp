@@ -1,15 +1,19 @@
 #pragma once
 
+#include <istream>
 #include <string>
 #include <vector>
 #include <optional>
 
+constexpr size_t LEXER_READ_SIZE = 64 * 1024;
+constexpr size_t LEXER_BYTES_PER_TOKEN = 8;  // about the fewest of ordinary programs
+
 enum class TokenType {
     print, _if, then, _goto, input, let, 
     gosub, _return, clear, list, run, end,
     num, var, cr, open_paren, close_paren,
     eq, gt, lt, plus, minus, div, mul, com, 
-    str, none
+    at, str, none
 };
 
 struct Token {
@@ -20,13 +24,25 @@ struct Token {
 
 class Lexer {
 public:
-    Lexer(std::string& code) : m_code(std::move(code)) {}
+    // `line` - the number of the first one, when the code is a chunk of a program (see FrontEnd)
+    Lexer(std::string& code, size_t line = 1) : m_line(line), m_code(std::move(code)) {}
+
+    // reads the source as it goes, only the line being lexed stays in memory
+    explicit Lexer(std::istream& input) : m_input(&input) {}
 
     std::vector<Token> gen_tokens();
+    bool next_line(std::vector<Token>& tokens);  // tokens up to and with the next cr, false at the end
 
 private:
     std::optional<char> peek(int offset = 0);
     char consume();
+    bool read_more();
+
+    // length of the run from m_index a scan:: function finds, reading on while it reaches the end
+    template <typename Scan>
+    size_t span(Scan scan);
+
+    void gen_token(std::vector<Token>& result);
 
     Token tokenize_alpha();
     Token tokenize_digit();
@@ -37,4 +53,5 @@ private:
     size_t m_line = 1;
     size_t m_index = 0;
     std::string m_code;
+    std::istream* m_input = nullptr;
 };
\ No newline at end of file
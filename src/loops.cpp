@@ -0,0 +1,559 @@
+#include <algorithm>
+#include <cstdint>
+#include <format>
+#include <functional>
+#include <limits>
+#include <optional>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <variant>
+#include <vector>
+
+#include "cfg.hpp"
+#include "loops.hpp"
+#include "parser.hpp"
+
+constexpr size_t MAX_DERIVED = 8;        // slots of one loop
+constexpr size_t MIN_DERIVED_COST = 2;   // operations a derived expression saves
+constexpr size_t MAX_UNROLL_LINES = 8;   // body of an unrolled loop, it is emitted three times
+
+static int64_t wrap_add(int64_t a, int64_t b) {  // the generated code wraps around
+    return static_cast<int64_t>(static_cast<uint64_t>(a) + static_cast<uint64_t>(b));
+}
+
+static int64_t wrap_mul(int64_t a, int64_t b) {
+    return static_cast<int64_t>(static_cast<uint64_t>(a) * static_cast<uint64_t>(b));
+}
+
+// sum of scale * iv over the induction vars, plus a constant, plus (when !known) something invariant
+struct Linear {
+    std::unordered_map<std::string, int64_t> scale{};
+    int64_t constant = 0;
+    bool known = true;
+};
+
+static Linear scaled(Linear l, int64_t by) {
+    for (auto& [iv, scale]: l.scale)
+        scale = wrap_mul(scale, by);
+    std::erase_if(l.scale, [](const auto& item) { return item.second == 0; });
+
+    l.constant = wrap_mul(l.constant, by);
+    return l;
+}
+
+static Linear sum(Linear a, const Linear& b) {
+    for (auto& [iv, scale]: b.scale)
+        a.scale[iv] = wrap_add(a.scale[iv], scale);
+    std::erase_if(a.scale, [](const auto& item) { return item.second == 0; });
+
+    a.constant = wrap_add(a.constant, b.constant);
+    a.known = a.known && b.known;
+    return a;
+}
+
+// an expression as a Linear, nullopt when it isn't one or reads a var the loop changes otherwise
+struct Linearize {
+    const std::unordered_set<std::string>& ivs;
+    const std::unordered_set<std::string>& changed;
+
+    using Result = std::optional<Linear>;
+
+    Result operator()(std::monostate) { return {}; }
+
+    Result operator()(const NodeVar& var) {
+        if (var.index)  // the loop may write the array
+            return {};
+        if (ivs.contains(var.name))
+            return Linear{.scale = {{var.name, 1}}};
+        if (changed.contains(var.name))
+            return {};
+
+        return Linear{.known = false};
+    }
+
+    Result operator()(const NodeNum& num) {
+        try {
+            return Linear{.constant = std::stoll(num.num)};
+        } catch (const std::out_of_range&) {
+            return {};
+        }
+    }
+
+    Result operator()(const NodeFactor* fact) { return std::visit(*this, fact->body); }
+
+    Result operator()(const NodeFactorOp* fact_op) {
+        Result a = std::visit(*this, fact_op->fact);
+        Result b = std::visit(*this, fact_op->fact2);
+        if (!a || !b)
+            return {};
+
+        if (!fact_op->is_mul) {  // only by a constant that can't fault, or the entry code could
+            if (!a->scale.empty() || !b->scale.empty() || !b->known || b->constant == 0 || b->constant == -1)
+                return {};
+            if (!a->known)
+                return Linear{.known = false};
+
+            return Linear{.constant = a->constant / b->constant};
+        }
+
+        if (a->scale.empty() && a->known)
+            return scaled(*b, a->constant);
+        if (b->scale.empty() && b->known)
+            return scaled(*a, b->constant);
+        if (a->scale.empty() && b->scale.empty())
+            return Linear{.known = false};
+
+        return {};
+    }
+
+    Result operator()(const NodeTerm* term) {
+        Result result = std::visit(*this, term->fact);
+        if (result && term->is_negative)
+            result = scaled(*result, -1);
+
+        return result;
+    }
+
+    Result operator()(const NodeTermOp* term_op) {
+        Result a = std::visit(*this, term_op->term);
+        Result b = std::visit(*this, term_op->term2);
+        if (!a || !b)
+            return {};
+
+        return sum(*a, term_op->is_add ? *b : scaled(*b, -1));
+    }
+
+    Result operator()(const NodeExpr* expr) { return std::visit(*this, expr->term); }
+};
+
+void for_each_stat(const NodeStat* stat, const std::function<void(const NodeStat*)>& f) {
+    f(stat);
+    if (auto stat_if = std::get_if<NodeStatIf*>(&stat->com))
+        for_each_stat((*stat_if)->then, f);
+}
+
+void stat_exprs(const NodeStat* stat, std::vector<NodeExpr*>& exprs) {
+    std::vector<NodeExpr*> top;
+
+    for_each_stat(stat, [&top](const NodeStat* s) {
+        if (auto stat_print = std::get_if<NodeStatPrint*>(&s->com)) {
+            for (auto& item: (*stat_print)->exprs->list) {
+                if (auto expr = std::get_if<NodeExpr*>(&item))
+                    top.push_back(*expr);
+            }
+        } else if (auto stat_if = std::get_if<NodeStatIf*>(&s->com)) {
+            top.push_back((*stat_if)->expr);
+            top.push_back((*stat_if)->expr2);
+        } else if (auto stat_let = std::get_if<NodeStatLet*>(&s->com)) {
+            top.push_back((*stat_let)->expr);
+            if ((*stat_let)->var.index)
+                top.push_back((*stat_let)->var.index);
+        } else if (auto stat_input = std::get_if<NodeStatInput*>(&s->com)) {
+            for (auto& var: (*stat_input)->var_list.list) {
+                if (var.index)
+                    top.push_back(var.index);
+            }
+        }
+    });
+
+    for (auto expr: top) {
+        exprs.push_back(expr);
+
+        ExprWalker walker{.on_var = [&exprs](const NodeVar& var) {
+            if (var.index)
+                exprs.push_back(var.index);
+        }};
+        walker(expr);
+    }
+}
+
+static const NodeVar* single_var(const NodeExpr* expr) {  // `V` and nothing else
+    auto term = std::get_if<NodeTerm*>(&expr->term);
+    if (!term || (*term)->is_negative)
+        return nullptr;
+
+    auto fact = std::get_if<NodeFactor*>(&(*term)->fact);
+    if (!fact)
+        return nullptr;
+
+    auto var = std::get_if<NodeVar>(&(*fact)->body);
+    return var && !var->index ? var : nullptr;
+}
+
+Loops::Loops(const NodeProg& prog, const Cfg& cfg, size_t first_slot, bool unroll) : m_first_slot(first_slot) {
+    // the generator gives a var its slot at the first LET, reachable or not
+    for (size_t i = 0; i < prog.lines.size(); i++) {
+        for_each_stat(prog.lines[i]->stat, [this, i](const NodeStat* s) {
+            if (auto stat_let = std::get_if<NodeStatLet*>(&s->com); stat_let && !(*stat_let)->var.index)
+                m_first_let.emplace((*stat_let)->var.name, i);
+        });
+    }
+
+    // lowest and highest line jumping to every line
+    std::vector<size_t> jump_min(cfg.size(), std::numeric_limits<size_t>::max());
+    std::vector<size_t> jump_max(cfg.size(), 0);
+
+    for (size_t i = 0; i < cfg.size(); i++) {
+        if (!cfg.reachable(i))
+            continue;
+
+        auto add = [&](size_t target) {
+            jump_min[target] = std::min(jump_min[target], i);
+            jump_max[target] = std::max(jump_max[target], i);
+        };
+        std::for_each(cfg.gotos(i).begin(), cfg.gotos(i).end(), add);
+        std::for_each(cfg.gosubs(i).begin(), cfg.gosubs(i).end(), add);
+    }
+
+    for (size_t i = 0; i < cfg.size(); i++) {
+        if (!cfg.reachable(i))
+            continue;
+
+        // the latch: GOTO back, or IF ... THEN GOTO back
+        const NodeStat* jump = prog.lines[i]->stat;
+        if (auto stat_if = std::get_if<NodeStatIf*>(&jump->com))
+            jump = (*stat_if)->then;
+
+        auto stat_goto = std::get_if<NodeStatGoto*>(&jump->com);
+        if (!stat_goto)
+            continue;
+
+        size_t header = cfg.index_of(jump_target((*stat_goto)->expr));
+        if (header > i)
+            continue;
+
+        Loop loop{.header = header, .latch = i, .entered = jump_min[header] >= header && jump_max[header] <= i};
+        if (find_loop(prog, cfg, loop, unroll))
+            m_loops.push_back(std::move(loop));
+    }
+
+    for (size_t l = 0; l < m_loops.size(); l++) {
+        Loop& loop = m_loops[l];
+
+        if (!loop.derived.empty() || loop.count_slot)
+            m_header[loop.header] = l;
+        if (loop.count_slot)
+            m_latch[loop.latch] = l;
+
+        for (auto& derived: loop.derived) {
+            m_derived[derived.expr] = &derived;
+            for (auto copy: derived.copies)
+                m_derived[copy] = &derived;
+
+            for (auto& iv: loop.ivs) {
+                if (iv.name == derived.iv)
+                    m_bumps[iv.update].push_back(&derived);
+            }
+        }
+    }
+}
+
+bool Loops::find_loop(const NodeProg& prog, const Cfg& cfg, Loop& loop, bool unroll) {
+    std::unordered_set<std::string> changed;
+    std::unordered_set<std::string> not_iv;
+    std::unordered_map<std::string, std::vector<InductionVar>> updates;
+
+    for (size_t i = loop.header; i <= loop.latch; i++) {
+        if (!cfg.reachable(i) || (i > loop.header && cfg.is_target(i)))
+            return false;
+        if (!cfg.gosubs(i).empty())  // the subroutine may change anything
+            return false;
+
+        for_each_stat(prog.lines[i]->stat, [&](const NodeStat* s) {
+            if (auto stat_let = std::get_if<NodeStatLet*>(&s->com)) {
+                const NodeVar& var = (*stat_let)->var;
+                if (var.index)
+                    return;
+
+                changed.insert(var.name);
+
+                std::unordered_set<std::string> self{var.name};
+                auto step = Linearize{.ivs = self, .changed = {}}((*stat_let)->expr);
+
+                if (step && step->known && step->constant != 0 && step->scale.size() == 1 && step->scale[var.name] == 1)
+                    updates[var.name].push_back({.name = var.name, .step = step->constant, .line = i, .update = *stat_let});
+                else
+                    not_iv.insert(var.name);
+            } else if (auto stat_input = std::get_if<NodeStatInput*>(&s->com)) {
+                for (auto& var: (*stat_input)->var_list.list) {
+                    if (!var.index) {
+                        changed.insert(var.name);
+                        not_iv.insert(var.name);
+                    }
+                }
+            }
+        });
+    }
+
+    std::unordered_set<std::string> ivs;
+    for (auto& [name, list]: updates) {
+        if (list.size() == 1 && !not_iv.contains(name)) {
+            ivs.insert(name);
+            loop.ivs.push_back(list.front());
+        }
+    }
+
+    if (loop.ivs.empty())
+        return false;
+    if (!loop.entered)  // nowhere to put the entry code
+        return true;
+
+    std::sort(loop.ivs.begin(), loop.ivs.end(), [](const InductionVar& a, const InductionVar& b) {
+        return a.line < b.line;
+    });
+
+    std::vector<NodeExpr*> exprs;
+    for (size_t i = loop.header; i <= loop.latch; i++) {
+        if (auto stat_let = std::get_if<NodeStatLet*>(&prog.lines[i]->stat->com); stat_let && ivs.contains((*stat_let)->var.name))
+            continue;  // an update itself
+
+        stat_exprs(prog.lines[i]->stat, exprs);
+    }
+
+    std::unordered_map<std::string, size_t> written;  // expression -> derived
+    for (auto expr: exprs) {
+        std::string text = expr_str(expr);
+        if (auto same = written.find(text); same != written.end()) {
+            loop.derived[same->second].copies.push_back(expr);
+            continue;
+        }
+
+        if (loop.derived.size() == MAX_DERIVED)
+            break;
+
+        bool declared = true;
+        ExprWalker walker{.on_var = [&](const NodeVar& var) {
+            declared = declared && (var.index || declared_before(var.name, loop.header));
+        }};
+        walker(expr);
+
+        if (!declared || walker.cost < MIN_DERIVED_COST)
+            continue;
+
+        auto linear = Linearize{.ivs = ivs, .changed = changed}(expr);
+        if (!linear || linear->scale.size() != 1)
+            continue;
+
+        auto& [iv, scale] = *linear->scale.begin();
+        auto update = std::find_if(loop.ivs.begin(), loop.ivs.end(), [&iv](const InductionVar& v) {
+            return v.name == iv;
+        });
+
+        written[text] = loop.derived.size();
+        loop.derived.push_back({
+            .expr = expr, .iv = iv, .scale = scale, .delta = wrap_mul(scale, update->step),
+            .slot = m_first_slot + m_slots++
+        });
+    }
+
+    find_counter(prog, loop, changed, unroll);
+
+    return true;
+}
+
+void Loops::find_counter(
+    const NodeProg& prog, Loop& loop, const std::unordered_set<std::string>& changed, bool unroll
+) {
+    auto stat_if = std::get_if<NodeStatIf*>(&prog.lines[loop.latch]->stat->com);
+    if (!stat_if)
+        return;
+
+    RelopType relop = (*stat_if)->relop.type;
+    NodeExpr* counter = (*stat_if)->expr;
+    NodeExpr* limit = (*stat_if)->expr2;
+
+    auto find_iv = [&loop](const NodeExpr* expr) -> const InductionVar* {
+        const NodeVar* var = single_var(expr);
+        for (auto& iv: loop.ivs) {
+            if (var && iv.name == var->name)
+                return &iv;
+        }
+        return nullptr;
+    };
+
+    const InductionVar* iv = find_iv(counter);
+    if (!iv) {  // `limit relop counter`
+        std::swap(counter, limit);
+        iv = find_iv(counter);
+
+        switch (relop) {
+            case RelopType::lt:  relop = RelopType::gt; break;
+            case RelopType::lte: relop = RelopType::gte; break;
+            case RelopType::gt:  relop = RelopType::lt; break;
+            case RelopType::gte: relop = RelopType::lte; break;
+            default: break;
+        }
+    }
+
+    if (!iv || (iv->step != 1 && iv->step != -1))
+        return;
+
+    // once per iteration, before the test
+    if (iv->line == loop.latch || !std::holds_alternative<NodeStatLet*>(prog.lines[iv->line]->stat->com))
+        return;
+
+    switch (relop) {
+        case RelopType::ne:  break;
+        case RelopType::lt:
+        case RelopType::lte: if (iv->step != 1) return; break;
+        case RelopType::gt:
+        case RelopType::gte: if (iv->step != -1) return; break;
+        default: return;
+    }
+
+    bool declared = declared_before(iv->name, loop.header);
+    ExprWalker walker{.on_var = [&](const NodeVar& var) {
+        declared = declared && !var.index && declared_before(var.name, loop.header);
+    }};
+    walker(limit);
+
+    std::unordered_set<std::string> none;
+    auto linear = Linearize{.ivs = none, .changed = changed}(limit);
+    if (!declared || !linear)
+        return;
+
+    // the only way out is the test of the latch
+    bool straight = true;
+    for (size_t i = loop.header; i < loop.latch; i++) {
+        for_each_stat(prog.lines[i]->stat, [&straight](const NodeStat* s) {
+            straight = straight && !std::holds_alternative<NodeStatGoto*>(s->com)
+                && !std::holds_alternative<NodeStatGosub*>(s->com)
+                && !std::holds_alternative<NodeStatReturn*>(s->com)
+                && !std::holds_alternative<NodeStatEnd*>(s->com);
+        });
+    }
+    if (!straight)
+        return;
+
+    loop.counted = true;
+    loop.counter = iv->name;
+    loop.step = iv->step;
+    loop.relop = relop;
+    loop.limit = limit;
+    loop.body.assign(prog.lines.begin() + loop.header, prog.lines.begin() + loop.latch);
+
+    if (unroll && loop.latch - loop.header <= MAX_UNROLL_LINES)
+        loop.count_slot = m_first_slot + m_slots++;
+}
+
+bool Loops::declared_before(const std::string& var, size_t line) const {
+    auto first = m_first_let.find(var);
+    return first != m_first_let.end() && first->second < line;
+}
+
+const Loop* Loops::at_header(size_t line) const {
+    auto loop = m_header.find(line);
+    return loop == m_header.end() ? nullptr : &m_loops[loop->second];
+}
+
+size_t Loops::changes() const {
+    size_t changes = 0;
+    for (auto& loop: m_loops)
+        changes += loop.derived.size() + loop.counted;
+
+    return changes;
+}
+
+bool Loops::is_unrolled_latch(size_t line) const {
+    return m_latch.contains(line);
+}
+
+const DerivedExpr* Loops::derived(const NodeExpr* expr) const {
+    auto derived = m_derived.find(expr);
+    return derived == m_derived.end() ? nullptr : derived->second;
+}
+
+const std::vector<const DerivedExpr*>* Loops::bumps(const NodeStatLet* update) const {
+    auto bumps = m_bumps.find(update);
+    return bumps == m_bumps.end() ? nullptr : &bumps->second;
+}
+
+void Loops::dump(const NodeProg& prog, std::ostream& out) const {
+    auto name = [&prog](size_t i) {  // BASIC line number, or source line
+        auto& num = prog.lines[i]->num;
+        return num.has_value() ? num->num : std::format("#{}", prog.lines[i]->line);
+    };
+
+    static const char* relops[] = {"=", "<>", ">", ">=", "<", "<="};
+
+    for (auto& loop: m_loops) {
+        out << std::format(
+            "loops: {}..{} (lines {}-{}){}\n", name(loop.header), name(loop.latch),
+            prog.lines[loop.header]->line, prog.lines[loop.latch]->line,
+            loop.entered ? "" : ", jumped into from outside"
+        );
+
+        for (auto& iv: loop.ivs)
+            out << std::format("loops:   induction {} step {:+} at {}\n", iv.name, iv.step, name(iv.line));
+
+        for (auto& derived: loop.derived) {
+            out << std::format(
+                "loops:   derived `{}` = {} * {} + invariant, step {:+}{}\n",
+                expr_str(derived.expr), derived.scale, derived.iv, derived.delta,
+                derived.copies.empty() ? "" : std::format(", written {} times", derived.copies.size() + 1)
+            );
+        }
+
+        if (loop.counted) {
+            out << std::format(
+                "loops:   counted while {} {} {}{}\n", loop.counter, relops[static_cast<size_t>(loop.relop)],
+                expr_str(loop.limit), loop.count_slot ? ", unrolled by 2" : ""
+            );
+        }
+    }
+}
+
+struct ExprPrinter {
+    std::string& out;
+
+    void operator()(std::monostate) {}
+    void operator()(const NodeNum& num) { out += num.num; }
+
+    void operator()(const NodeVar& var) {
+        out += var.name;
+        if (var.index) {
+            out += "(";
+            (*this)(var.index);
+            out += ")";
+        }
+    }
+
+    void operator()(const NodeFactor* fact) {
+        bool parens = !std::holds_alternative<NodeVar>(fact->body) && !std::holds_alternative<NodeNum>(fact->body);
+
+        if (parens)
+            out += "(";
+        std::visit(*this, fact->body);
+        if (parens)
+            out += ")";
+    }
+
+    void operator()(const NodeFactorOp* fact_op) {
+        std::visit(*this, fact_op->fact);
+        out += fact_op->is_mul ? " * " : " / ";
+        std::visit(*this, fact_op->fact2);
+    }
+
+    void operator()(const NodeTerm* term) {
+        if (term->is_negative)
+            out += "-";
+        std::visit(*this, term->fact);
+    }
+
+    void operator()(const NodeTermOp* term_op) {
+        std::visit(*this, term_op->term);
+        out += term_op->is_add ? " + " : " - ";
+        std::visit(*this, term_op->term2);
+    }
+
+    void operator()(const NodeExpr* expr) { std::visit(*this, expr->term); }
+};
+
+std::string expr_str(const NodeExpr* expr) {
+    std::string result;
+    ExprPrinter{.out = result}(expr);
+    return result;
+}
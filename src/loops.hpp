@@ -0,0 +1,136 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <variant>
+#include <vector>
+
+#include "cfg.hpp"
+#include "parser.hpp"
+
+// a var the loop changes only by `LET V = V + step`
+struct InductionVar {
+    std::string name;
+    int64_t step;
+    size_t line;  // of the update
+    const NodeStatLet* update;
+};
+
+// an expression of the loop equal to scale * iv plus something the loop doesn't change
+struct DerivedExpr {
+    NodeExpr* expr;
+    std::vector<NodeExpr*> copies{};  // the same expression written again in the loop
+    std::string iv;
+    int64_t scale;
+    int64_t delta;  // scale * step, added to the slot with every update of iv
+    size_t slot;
+};
+
+struct Loop {
+    size_t header;
+    size_t latch;  // jumps back to the header
+    bool entered;  // from above only, by falling into the header: it can have entry code
+    std::vector<InductionVar> ivs{};
+    std::vector<DerivedExpr> derived{};
+
+    // counted loop: the body is straight and the latch is `IF counter relop limit THEN GOTO header`
+    bool counted = false;
+    std::string counter{};
+    int64_t step = 0;                // of the counter, 1 or -1
+    RelopType relop = RelopType::ne; // as if the counter was on the left
+    NodeExpr* limit = nullptr;
+    std::vector<NodeLine*> body{};   // header..latch - 1
+    size_t count_slot = 0;           // iterations left, when the loop is unrolled
+};
+
+/*
+    Innermost loops of a program with induction vars: lines header..latch
+    where the latch goes back to the header, nothing jumps into the lines after
+    the header and nothing inside calls a subroutine.
+
+    When the header is entered from above only, by falling into it, code put
+    in front of its label runs once every time the loop is entered. Derived
+    expressions get a stack slot of their own after first_slot, set there and
+    bumped with their induction var. Counted loops get their trip count
+    computed there and may be unrolled by 2.
+*/
+class Loops {
+public:
+    Loops(const NodeProg& prog, const Cfg& cfg, size_t first_slot, bool unroll);
+
+    size_t slots() const { return m_slots; }  // stack slots taken after first_slot
+    size_t changes() const;  // derived expressions and counted loops
+
+    const Loop* at_header(size_t line) const;
+    bool is_unrolled_latch(size_t line) const;
+    const DerivedExpr* derived(const NodeExpr* expr) const;
+    const std::vector<const DerivedExpr*>* bumps(const NodeStatLet* update) const;
+
+    void dump(const NodeProg& prog, std::ostream& out) const;
+private:
+    bool find_loop(const NodeProg& prog, const Cfg& cfg, Loop& loop, bool unroll);
+    void find_counter(
+        const NodeProg& prog, Loop& loop, const std::unordered_set<std::string>& changed, bool unroll
+    );
+    bool declared_before(const std::string& var, size_t line) const;
+
+    std::vector<Loop> m_loops;
+    std::unordered_map<std::string, size_t> m_first_let;  // line declaring every var
+    size_t m_first_slot;
+    size_t m_slots = 0;
+
+    std::unordered_map<size_t, size_t> m_header;  // line -> loop
+    std::unordered_map<size_t, size_t> m_latch;   // line -> unrolled loop
+    std::unordered_map<const NodeExpr*, const DerivedExpr*> m_derived;
+    std::unordered_map<const NodeStatLet*, std::vector<const DerivedExpr*>> m_bumps;
+};
+
+// the expression as it could be written in the source
+std::string expr_str(const NodeExpr* expr);
+
+// calls on_var for every var of an expression, array indices included, and counts its operations
+struct ExprWalker {
+    std::function<void(const NodeVar&)> on_var = [](const NodeVar&) {};
+    size_t cost = 0;
+
+    void operator()(std::monostate) {}
+    void operator()(const NodeNum&) {}
+
+    void operator()(const NodeVar& var) {
+        on_var(var);
+        if (var.index)
+            (*this)(var.index);
+    }
+
+    void operator()(const NodeFactor* fact) { std::visit(*this, fact->body); }
+
+    void operator()(const NodeFactorOp* fact_op) {
+        cost += fact_op->is_mul ? 3 : 20;  // about their latency
+        std::visit(*this, fact_op->fact);
+        std::visit(*this, fact_op->fact2);
+    }
+
+    void operator()(const NodeTerm* term) {
+        cost += term->is_negative;
+        std::visit(*this, term->fact);
+    }
+
+    void operator()(const NodeTermOp* term_op) {
+        cost++;
+        std::visit(*this, term_op->term);
+        std::visit(*this, term_op->term2);
+    }
+
+    void operator()(const NodeExpr* expr) { std::visit(*this, expr->term); }
+};
+
+// the statement and the one after THEN, if it is an IF
+void for_each_stat(const NodeStat* stat, const std::function<void(const NodeStat*)>& f);
+
+// expressions of a statement, array indices inside them included
+void stat_exprs(const NodeStat* stat, std::vector<NodeExpr*>& exprs);
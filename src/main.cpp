@@ -1,46 +1,43 @@
 #include <cstdlib>
+#include <filesystem>
 #include <iostream>
-#include <fstream>
-#include <sstream>
 
-#include "./lexer.hpp"
-#include "./parser.hpp"
-#include "generator.hpp"
+#include "cache.hpp"
+#include "driver.hpp"
+#include "options.hpp"
+#include "repl.hpp"
+#include "server.hpp"
 
 int main(int argc, char* argv[]) {
-    if (argc < 2) {
-        std::cerr << "Incorrect usage. Correct usage is...\n";
-        std::cerr << "tinyb <file.bas>\n";
+    Options options;
+    if (!parse_options(argc, argv, options)) {
+        print_usage();
         return EXIT_FAILURE;
     }
 
-    bool no_new_line = false;
-    if (argc > 2 && std::string(argv[2]) == "no-nl") {
-        no_new_line = true;
+    if (options.repl) {
+        Repl repl{options};
+        return repl.run();
     }
 
-    std::fstream input(argv[1], std::ios::in);
-    std::stringstream code_stream;
-    code_stream << input.rdbuf();
-    input.close();
+    Cache cache{
+        options.cache_dir.empty() ? Cache::default_dir() : std::filesystem::path(options.cache_dir), 
+        options.cache_size
+    };
 
-    std::string code = code_stream.str();
+    if (options.connect)
+        return run_client(options);
 
-    Lexer l{code};
-    auto tokens = l.gen_tokens();
-
-    Parser p{tokens};
-    auto node_prog = p.gen_prog();
-
-    std::fstream output("out.asm", std::ios::out);
-
-    Generator g{node_prog, p.get_unique_let(), no_new_line};
-    output << g.gen_asm();
-    output.close();
+    if (options.serve) {
+        Server server{options, cache};
+        return server.run();
+    }
 
-    int result;
-    result = system("nasm -felf64 out.asm");
-    result = system("ld -o out out.o -lc --dynamic-linker /lib64/ld-linux-x86-64.so.2");
+    if (options.inputs.empty()) {  // only --cache-stats
+        cache.print_stats(std::cout);
+        return EXIT_SUCCESS;
+    }
 
-    return EXIT_SUCCESS;
-}
\ No newline at end of file
+    Driver driver{options, cache};
+    return driver.run();
+}
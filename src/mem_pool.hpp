@@ -6,48 +6,107 @@
 #include <cstddef>
 #include <cstdlib>
 #include <stdexcept>
+#include <type_traits>
+#include <vector>
 
 constexpr size_t DEFAULT_POOL_SIZE = 1024 * 1024 * 4;
 
 class MemoryPool {
 public:
-    explicit MemoryPool(size_t size = DEFAULT_POOL_SIZE) 
-        : m_size(size), m_mem(nullptr), m_offset(nullptr) 
-    { 
-        if (m_size == 0) 
+    explicit MemoryPool(size_t size = DEFAULT_POOL_SIZE)
+        : m_size(size), m_mem(nullptr), m_offset(nullptr)
+    {
+        if (m_size == 0)
             throw std::runtime_error("memory pool size = 0");
 
-        m_mem = static_cast<std::byte*>(std::malloc(m_size));
-
-        if (!m_mem)
-            throw std::bad_alloc();
-
-        m_offset = m_mem;
+        add_block();
     }
     ~MemoryPool() {
-        std::free(m_mem); 
+        destroy();
+
+        for (auto block: m_blocks)
+            std::free(block);
     }
 
+    MemoryPool(MemoryPool& copy) = delete;
+    MemoryPool(MemoryPool&& copy) = delete;
+
     template<typename T>
     T* alloc() {
-        /* 
-            ONLY FOR OBJECT WITHOUT ARGS ON CONSTRUCTION! 
-            DESTRUCTION IS NOT A CALLED!
+        /*
+            ONLY FOR OBJECT WITHOUT ARGS ON CONSTRUCTION!
+            Destructors are called by reset() or when the pool dies.
         */
 
         void* ptr = m_offset;
         size_t space = m_size - static_cast<size_t>(m_offset - m_mem);
 
-        if (std::align(alignof(T), sizeof(T), ptr, space) == nullptr)
-            throw std::bad_alloc();
+        if (std::align(alignof(T), sizeof(T), ptr, space) == nullptr) {
+            next_block();  // big programs simply get more blocks
+
+            ptr = m_offset;
+            space = m_size;
+
+            if (std::align(alignof(T), sizeof(T), ptr, space) == nullptr)
+                throw std::bad_alloc();
+        }
 
         T* tptr = reinterpret_cast<T*>(ptr);
         m_offset = reinterpret_cast<std::byte*>(reinterpret_cast<uintptr_t>(tptr) + sizeof(T));
 
-        return new (tptr) T;
+        new (tptr) T;
+
+        if constexpr (!std::is_trivially_destructible_v<T>)
+            m_dtors.push_back({tptr, [](void* obj) { static_cast<T*>(obj)->~T(); }});
+
+        return tptr;
+    }
+
+    // frees every object but keeps the blocks, so the next program starts warm
+    void reset() {
+        destroy();
+
+        m_block = 0;
+        m_mem = m_blocks.front();
+        m_offset = m_mem;
     }
 private:
+    void add_block() {
+        m_mem = static_cast<std::byte*>(std::malloc(m_size));
+
+        if (!m_mem)
+            throw std::bad_alloc();
+
+        m_blocks.push_back(m_mem);
+        m_block = m_blocks.size() - 1;
+        m_offset = m_mem;
+    }
+
+    void next_block() {
+        if (m_block + 1 == m_blocks.size()) {
+            add_block();
+        } else {
+            m_mem = m_blocks[++m_block];
+            m_offset = m_mem;
+        }
+    }
+
+    void destroy() {
+        for (auto it = m_dtors.rbegin(); it != m_dtors.rend(); it++)
+            it->dtor(it->obj);
+
+        m_dtors.clear();
+    }
+
+    struct Dtor {
+        void* obj;
+        void (*dtor)(void*);
+    };
+
     std::byte* m_mem;
     std::byte* m_offset;
     size_t m_size;
+    size_t m_block = 0;
+    std::vector<std::byte*> m_blocks;
+    std::vector<Dtor> m_dtors;
 };
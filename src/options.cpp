@@ -0,0 +1,274 @@
+#include <algorithm>
+#include <format>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+#include "options.hpp"
+
+void print_usage() {
+    std::cerr << "Incorrect usage. Correct usage is...\n";
+    std::cerr << "tinyb <file.bas>... [options]\n";
+    std::cerr << "tinyb --repl [options]\n\n";
+    std::cerr << "options:\n";
+    std::cerr << "\t-o <path>            output executable (default `out`), directory for many inputs\n";
+    std::cerr << "\t-j <n>               compile up to n programs at once, or lex, parse and\n";
+    std::cerr << "\t                     generate code of a single big program on n threads\n";
+    std::cerr << "\t--stream             compile a line at a time in memory bounded by the longest line,\n";
+    std::cerr << "\t                     without the optimizations needing the whole program\n";
+    std::cerr << "\t--no-nl              don't end PRINT with a new line (also `no-nl`)\n";
+    std::cerr << "\t--profile            count executions of every line and branch\n";
+    std::cerr << "\t--profile=cycles     same, plus rdtsc cycles spent on every line\n";
+    std::cerr << "\t--profile-generate   same as --profile, the report feeds --profile-use\n";
+    std::cerr << "\t--profile-use=<file> lay out code, inline subroutines and keep vars in registers\n";
+    std::cerr << "\t                     by the counts of a --profile-generate run of this source\n";
+    std::cerr << "\t--dump-profile       print what --profile-use decided\n";
+    std::cerr << "\t--input-file         INPUT reads the file named by the first argument of\n";
+    std::cerr << "\t                     the program (mapped into memory) instead of stdin\n";
+    std::cerr << "\t--int32              vars, `@` and arithmetic of 32 bits that wrap around, numbers\n";
+    std::cerr << "\t                     outside of them don't compile\n";
+    std::cerr << "\t-O0, -O1, -O2        optimization level: no optional passes, the ones linear in the size of\n";
+    std::cerr << "\t                     the program (unreachable, profile, ranges, layout, peephole), all of\n";
+    std::cerr << "\t                     them (default)\n";
+    std::cerr << "\t--passes=<a,b,...>   run exactly these optional passes (unreachable, loops, profile, eval,\n";
+    std::cerr << "\t                     ranges, layout, peephole), empty - none; later options change the set\n";
+    std::cerr << "\t--pass-stats         print the time and changes of every pass\n";
+    std::cerr << "\t--no-peephole        emit the code of the stack machine as is\n";
+    std::cerr << "\t--peephole-stats     print how often every peephole pattern fired\n";
+    std::cerr << "\t--array-size=<n>     elements of the `@` array (default 16777216)\n";
+    std::cerr << "\t--no-loops           no strength reduction or unrolling of loops\n";
+    std::cerr << "\t--dump-loops         print the loops, induction vars and derived expressions\n";
+    std::cerr << "\t--no-ranges          no 32-bit arithmetic or IFs decided by the ranges of the vars\n";
+    std::cerr << "\t--dump-ranges        print what the ranges decided\n";
+    std::cerr << "\t--eval-steps=<n>     run the program at compile time for up to n lines (default\n";
+    std::cerr << "\t                     1000000), until an INPUT, and compile what is left\n";
+    std::cerr << "\t--eval-memory=<KiB>  output and vars the run may keep (default 1024)\n";
+    std::cerr << "\t--no-eval            same as --eval-steps=0\n";
+    std::cerr << "\t--dump-eval          print where the run stopped\n";
+    std::cerr << "\t-g                   DWARF line info and a symbol for every numbered line,\n";
+    std::cerr << "\t                     so perf and gdb show BASIC lines\n";
+    std::cerr << "\t--assembler=<name>   `nasm` (default) or `gas`, GNU as is usually faster\n";
+    std::cerr << "\t--keep-temps         leave the assembly and the object (<output>.asm, <output>.o)\n";
+    std::cerr << "\t--emit=<kind>        `exe` (default), `obj` or `shared`: an object file (`out.o`) or\n";
+    std::cerr << "\t                     shared library (`out.so`) with the C function of include/tinyb.h,\n";
+    std::cerr << "\t                     or `c`: the program as C built by `cc -O2` (kept as <output>.c)\n";
+    std::cerr << "\t--entry=<symbol>     name of that function (default `tinyb_run`)\n";
+    std::cerr << "\t--no-layout          no alignment of loop heads, no separate section for cold code\n";
+    std::cerr << "\t--cache              reuse executables of identical earlier compilations\n";
+    std::cerr << "\t--cache-dir=<dir>    cache location (implies --cache)\n";
+    std::cerr << "\t--cache-size=<MiB>   evict least recently used entries above this size\n";
+    std::cerr << "\t--cache-stats        print cache statistics\n";
+    std::cerr << "\t--repl               edit and run a program interactively, RUN compiles only the\n";
+    std::cerr << "\t                     lines changed since the last one (LIST, CLEAR)\n";
+    std::cerr << "\t--serve[=<socket>]   run a compile server (-j sets how many requests at once)\n";
+    std::cerr << "\t--connect[=<socket>] compile through a running server\n";
+}
+
+std::string Options::cache_flags() const {
+    return std::format(
+        "no_new_line={} profile={} profile_cycles={} profile_path={} input_file={} peephole={} array_size={} "
+        "int32={} drop_unreachable={} loops={} ranges={} layout={} use_profile={} debug={} source_path={} syntax={} eval_steps={} eval_memory={} "
+        "emit={} entry={}",
+        gen.no_new_line, gen.profile, gen.profile_cycles, gen.profile ? gen.profile_path : "", gen.input_file, gen.peephole, 
+        gen.array_size, gen.int32, gen.drop_unreachable, gen.loops, gen.ranges, gen.layout, gen.use_profile, gen.debug, gen.debug ? gen.source_path : "",
+        static_cast<int>(gen.syntax), gen.eval_steps, gen.eval_memory, static_cast<int>(gen.emit), gen.entry
+    );
+}
+
+static bool is_symbol(const std::string& name) {  // a C identifier
+    auto alpha = [](char c) { return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_'; };
+    auto alnum = [&alpha](char c) { return alpha(c) || (c >= '0' && c <= '9'); };
+
+    return !name.empty() && alpha(name.front()) && std::all_of(name.begin(), name.end(), alnum);
+}
+
+bool parse_gen_option(const std::string& arg, GenOptions& gen) {
+    if (arg == "no-nl" || arg == "--no-nl") {
+        gen.no_new_line = true;
+    } else if (arg == "--profile" || arg == "--profile-generate") {
+        gen.profile = true;
+    } else if (arg == "--profile=cycles") {
+        gen.profile = true;
+        gen.profile_cycles = true;
+    } else if (arg == "--input-file") {
+        gen.input_file = true;
+    } else if (arg == "--int32") {
+        gen.int32 = true;
+    } else if (arg.size() == 3 && arg.starts_with("-O")) {
+        return set_opt_level(gen, arg[2] - '0');
+    } else if (arg.starts_with("--passes=")) {
+        return set_passes(gen, std::string_view(arg).substr(arg.find('=') + 1));
+    } else if (arg == "--pass-stats") {
+        gen.pass_stats = true;
+    } else if (arg == "--no-peephole") {
+        gen.peephole = false;
+    } else if (arg == "--peephole-stats") {
+        gen.peephole_stats = true;
+    } else if (arg == "--no-loops") {
+        gen.loops = false;
+    } else if (arg == "--dump-loops") {
+        gen.dump_loops = true;
+    } else if (arg == "--no-ranges") {
+        gen.ranges = false;
+    } else if (arg == "--dump-ranges") {
+        gen.dump_ranges = true;
+    } else if (arg == "--no-layout") {
+        gen.layout = false;
+    } else if (arg == "-g") {
+        gen.debug = true;
+    } else if (arg == "--assembler=nasm") {
+        gen.syntax = Syntax::nasm;
+    } else if (arg == "--assembler=gas") {
+        gen.syntax = Syntax::gas;
+    } else if (arg == "--emit=exe") {
+        gen.emit = Emit::exe;
+    } else if (arg == "--emit=obj") {
+        gen.emit = Emit::obj;
+    } else if (arg == "--emit=shared") {
+        gen.emit = Emit::shared;
+    } else if (arg == "--emit=c") {
+        gen.emit = Emit::c;
+    } else if (arg.starts_with("--entry=")) {
+        gen.entry = arg.substr(arg.find('=') + 1);
+        return is_symbol(gen.entry);
+    } else if (arg.starts_with("--profile-use=")) {
+        gen.profile_use = arg.substr(arg.find('=') + 1);
+        return !gen.profile_use.empty();
+    } else if (arg == "--dump-profile") {
+        gen.dump_profile = true;
+    } else if (arg == "--no-eval") {
+        gen.eval_steps = 0;
+    } else if (arg == "--dump-eval") {
+        gen.dump_eval = true;
+    } else if (arg.starts_with("--eval-steps=")) {
+        try {
+            gen.eval_steps = std::stoull(arg.substr(arg.find('=') + 1));
+        } catch (const std::exception&) {
+            return false;
+        }
+    } else if (arg.starts_with("--eval-memory=")) {
+        try {
+            gen.eval_memory = std::stoull(arg.substr(arg.find('=') + 1)) * 1024;
+        } catch (const std::exception&) {
+            return false;
+        }
+    } else if (arg.starts_with("--array-size=")) {
+        try {
+            gen.array_size = std::stoull(arg.substr(arg.find('=') + 1));
+        } catch (const std::exception&) {
+            return false;
+        }
+        return gen.array_size > 0 && gen.array_size <= MAX_ARRAY_SIZE;
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+bool parse_options(int argc, char* argv[], Options& options) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+
+        if (arg == "-o" || arg == "-j") {
+            if (i + 1 >= argc) {
+                std::cerr << "Option `" << arg << "` needs a value\n";
+                return false;
+            }
+            arg += argv[++i];
+        }
+
+        if (arg.starts_with("-o")) {
+            options.output = arg.substr(2);
+        } else if (arg.starts_with("-j")) {
+            try {
+                options.jobs = std::stoull(arg.substr(2));
+            } catch (const std::exception&) {
+                std::cerr << "Invalid job count `" << arg << "`\n";
+                return false;
+            }
+        } else if (arg.starts_with("--array-size=") && !parse_gen_option(arg, options.gen)) {
+            std::cerr << std::format("Invalid array size `{}` (1 to {} elements)\n", arg, MAX_ARRAY_SIZE);
+            return false;
+        } else if (arg.starts_with("--passes=") && !parse_gen_option(arg, options.gen)) {
+            std::cerr << std::format("Invalid pass list `{}` (loops, profile, eval, ranges, layout, peephole)\n", arg);
+            return false;
+        } else if (parse_gen_option(arg, options.gen)) {
+            options.gen_args.push_back(arg);
+        } else if (arg == "--serve" || arg.starts_with("--serve=")) {
+            options.serve = true;
+            if (auto eq = arg.find('='); eq != std::string::npos)
+                options.socket = arg.substr(eq + 1);
+        } else if (arg == "--connect" || arg.starts_with("--connect=")) {
+            options.connect = true;
+            if (auto eq = arg.find('='); eq != std::string::npos)
+                options.socket = arg.substr(eq + 1);
+        } else if (arg == "--repl") {
+            options.repl = true;
+        } else if (arg == "--stream") {
+            options.stream = true;
+        } else if (arg == "--keep-temps") {
+            options.keep_temps = true;
+        } else if (arg == "--cache") {
+            options.cache = true;
+        } else if (arg.starts_with("--cache-dir=")) {
+            options.cache = true;
+            options.cache_dir = arg.substr(arg.find('=') + 1);
+        } else if (arg.starts_with("--cache-size=")) {
+            try {
+                options.cache_size = std::stoull(arg.substr(arg.find('=') + 1)) * 1024 * 1024;
+            } catch (const std::exception&) {
+                std::cerr << "Invalid cache size `" << arg << "`\n";
+                return false;
+            }
+        } else if (arg == "--cache-stats") {
+            options.cache_stats = true;
+        } else if (arg.starts_with("-")) {
+            std::cerr << "Unknown option `" << arg << "`\n";
+            return false;
+        } else {
+            options.inputs.push_back(arg);
+        }
+    }
+
+    if (options.gen.profile && !options.gen.profile_use.empty()) {
+        std::cerr << "`--profile-use` can't be combined with `--profile`\n";
+        return false;
+    }
+
+    if (options.stream && (options.gen.profile || !options.gen.profile_use.empty() || options.cache ||
+                           options.serve || options.connect))
+    {
+        std::cerr << "`--stream` can't be combined with profiles, the cache or the compile server\n";
+        return false;
+    }
+
+    // they are about the build itself, which is the server's
+    if (options.connect && (options.keep_temps || options.jobs != 1 || options.cache || options.cache_stats ||
+                            options.cache_size != DEFAULT_CACHE_SIZE))
+    {
+        std::cerr << "`--connect` can't be combined with `--keep-temps`, `-j` or the cache options\n";
+        return false;
+    }
+
+    if (options.gen.emit != Emit::exe && (options.gen.profile || options.gen.input_file || options.stream)) {
+        std::cerr << "`--emit` other than `exe` can't be combined with `--profile`, `--input-file` or `--stream`\n";
+        return false;
+    }
+
+    if (options.repl && (options.gen.emit != Emit::exe || options.gen.profile || !options.gen.profile_use.empty() ||
+                         options.gen.input_file || options.stream || options.serve || options.connect))
+    {
+        std::cerr << "`--repl` can't be combined with `--emit`, profiles, `--input-file`, `--stream` or the compile server\n";
+        return false;
+    }
+
+    if (options.repl)
+        return options.inputs.empty();
+
+    if (options.serve)
+        return options.inputs.empty() && !options.connect;
+
+    return !options.inputs.empty() || options.cache_stats;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "cache.hpp"
+#include "generator.hpp"
+
+struct Options {
+    std::vector<std::string> inputs;
+    std::string output;  // executable, or directory for many inputs
+    size_t jobs = 1;
+    bool stream = false;  // read, generate and write a line at a time
+    bool keep_temps = false;  // leave <output>.asm and <output>.o by the executable
+    GenOptions gen;
+    std::vector<std::string> gen_args;  // what set `gen`, forwarded by --connect
+
+    bool repl = false;  // edit and run a program a line at a time
+
+    bool serve = false;
+    bool connect = false;
+    std::string socket;  // empty - default_socket_path()
+
+    bool cache = false;
+    bool cache_stats = false;
+    std::string cache_dir;  // empty - Cache::default_dir()
+    uintmax_t cache_size = DEFAULT_CACHE_SIZE;
+
+    std::string cache_flags() const;  // everything that changes the produced binary
+};
+
+bool parse_options(int argc, char* argv[], Options& options);
+bool parse_gen_option(const std::string& arg, GenOptions& gen);
+void print_usage();
@@ -1,6 +1,9 @@
+#include <charconv>
+#include <cstdint>
 #include <format>
 #include <optional>
 #include <stdexcept>
+#include <string_view>
 #include <utility>
 #include <variant>
 
@@ -8,7 +11,43 @@
 #include "parser.hpp"
 #include "lexer.hpp"
 
-NodeFactor* Parser::parse_factor() {
+static bool starts_factor(TokenType type) {
+    return type == TokenType::num || type == TokenType::var || 
+           type == TokenType::open_paren || type == TokenType::at;
+}
+
+NodeVar Parser::parse_array() {  // @(expr)
+    consume();
+
+    if (!peek().has_value() || peek().value().type != TokenType::open_paren)
+        Error::critical(m_line, "Array `@` needs an index in parens!");
+
+    consume();
+    auto index = parse_expr();
+
+    if (!peek().has_value() || peek().value().type != TokenType::close_paren)
+        Error::critical(m_line, "Expression was not closed by close paren!");
+
+    consume();
+    m_uses_array = true;
+
+    return NodeVar{.name = "@", .index = index};
+}
+
+void Parser::check_number(const std::string& num, bool is_negative) {
+    // here and not in the back ends, so a literal is checked whatever code it ends up in (or not)
+    uint64_t magnitude = 0;
+    auto [end, error] = std::from_chars(num.data(), num.data() + num.size(), magnitude);
+    std::string text = is_negative ? "-" + num : num;
+
+    if (error != std::errc() || magnitude > static_cast<uint64_t>(INT64_MAX) + is_negative)
+        Error::critical(m_line, std::format("Number `{}` doesn't fit in 64 bits!", text).c_str());
+
+    if (m_int32 && magnitude > static_cast<uint64_t>(INT32_MAX) + is_negative)
+        Error::critical(m_line, std::format("Number `{}` doesn't fit in 32 bits!", text).c_str());
+}
+
+NodeFactor* Parser::parse_factor(bool is_negative) {
     if (!peek().has_value())
         Error::critical(m_line, "Expression is empty!");
 
@@ -18,8 +57,14 @@ NodeFactor* Parser::parse_factor() {
         case TokenType::var:
             fact->body = NodeVar{.name = consume().var.value()};
             break;
-        case TokenType::num:
-            fact->body = NodeNum{.num = consume().var.value()};
+        case TokenType::num: {
+            auto num = consume().var.value();
+            check_number(num, is_negative);
+            fact->body = NodeNum{.num = std::move(num)};
+            break;
+        }
+        case TokenType::at:
+            fact->body = parse_array();
             break;
         case TokenType::open_paren:
             consume();
@@ -52,7 +97,7 @@ NodeFactor* Parser::parse_factor() {
     return fact;
 }
 
-NodeTerm* Parser::parse_term() {
+NodeTerm* Parser::parse_term(bool is_negative) {
     if (!peek().has_value()) 
         Error::critical(m_line, "Expression is empty!");
 
@@ -65,11 +110,8 @@ NodeTerm* Parser::parse_term() {
 
         if (peek().value().type == TokenType::mul || peek().value().type == TokenType::div) {
             fact_op_exits = true;
-        } else if (peek().value().type == TokenType::num || \
-                   peek().value().type == TokenType::var || \
-                   peek().value().type == TokenType::open_paren) 
-        {
-            first_fact = parse_factor();
+        } else if (starts_factor(peek().value().type)) {
+            first_fact = parse_factor(is_negative && term->fact.index() == 0);
 
             if (!peek().has_value() || peek().value().type == TokenType::cr) {
                 term->fact = first_fact;
@@ -135,7 +177,7 @@ NodeExpr* Parser::parse_expr() {
                 term_op_exits = true;
             } else {  // unary minus or plus
                 auto op = consume();
-                auto term = parse_term();
+                auto term = parse_term(op.type == TokenType::minus);
 
                 if (op.type == TokenType::minus) {
                     term->is_negative = true;
@@ -145,10 +187,7 @@ NodeExpr* Parser::parse_expr() {
                 
                 continue;
             }
-        } else if (peek().value().type == TokenType::num || \
-                   peek().value().type == TokenType::var || \
-                   peek().value().type == TokenType::open_paren) 
-        {
+        } else if (starts_factor(peek().value().type)) {
             first_term = parse_term();
 
             if (!peek().has_value() || peek().value().type == TokenType::cr) {
@@ -270,11 +309,13 @@ NodeVarList Parser::parse_var_list() {  // var list used only command INPUT
 
     while (peek().has_value() && peek().value().type != TokenType::cr) {
         if (peek().value().type == TokenType::var) {
-            var_list.list.emplace_back(consume().var.value());
+            var_list.list.push_back(NodeVar{.name = consume().var.value()});
+        } else if (peek().value().type == TokenType::at) {
+            var_list.list.push_back(parse_array());
         } else if (peek().value().type == TokenType::com) {
             consume();
         } else {
-            Error::critical(m_line, "Command `INPUT` accepts only vars!");
+            Error::critical(m_line, "Command `INPUT` accepts only vars and `@` elements!");
         }
     }
 
@@ -308,7 +349,10 @@ NodeExpr* Parser::parse_const_expr() {
         Error::critical(m_line, "Expression (for `GOTO` and `GOSUB`) is not constant!");
 
     long long num = std::stoi(std::get<1>(fact->body).num);
-    m_goto_num.insert({num, m_line});
+    if (m_chunk)
+        m_targets.push_back({num, m_line});
+    else
+        m_goto_num.insert({num, m_line});
 
     if (peek().has_value() && peek().value().type != TokenType::cr)
         Error::critical(m_line, "Chars after expression!");
@@ -336,15 +380,19 @@ NodeStatGosub* Parser::parse_stat_gosub() {
 NodeStatLet* Parser::parse_stat_let() {
     auto stat_let = m_mem_pool.alloc<NodeStatLet>();
 
-    if (!peek().has_value() || peek().value().type != TokenType::var)
-        Error::critical(m_line, "Var name must be a single english capital letter!");
+    if (peek().has_value() && peek().value().type == TokenType::at) {
+        stat_let->var = parse_array();
+    } else {
+        if (!peek().has_value() || peek().value().type != TokenType::var)
+            Error::critical(m_line, "Var name must be a single english capital letter!");
 
-    std::string var_name = consume().var.value();
-    if (var_name.length() != 1 || !std::isupper(var_name.at(0)))
-        Error::critical(m_line, "Var name must be a single english capital letter!");
+        std::string var_name = consume().var.value();
+        if (var_name.length() != 1 || !std::isupper(var_name.at(0)))
+            Error::critical(m_line, "Var name must be a single english capital letter!");
     
-    m_unique_let.insert(var_name.at(0));
-    stat_let->var = NodeVar{.name = var_name};
+        m_unique_let.insert(var_name.at(0));
+        stat_let->var = NodeVar{.name = var_name};
+    }
 
     if (!peek().has_value() || peek().value().type != TokenType::eq)
         Error::critical(m_line, "Operator `=` is missing!");
@@ -366,10 +414,7 @@ NodeStatPrint* Parser::parse_stat_print() {
     stat_print->exprs = expr_list;
 
     while (peek().has_value() && peek().value().type != TokenType::cr) {
-        if (peek().value().type == TokenType::num || \
-            peek().value().type == TokenType::var || \
-            peek().value().type == TokenType::open_paren) 
-        {
+        if (starts_factor(peek().value().type)) {
             expr_list->list.push_back(parse_expr());
         }
         else if (peek().value().type == TokenType::str) {
@@ -409,15 +454,15 @@ NodeStat* Parser::parse_stat() {
         case TokenType::end:     node_stat->com = m_mem_pool.alloc<NodeStatEnd>(); break;
         case TokenType::clear:   
             node_stat->com = m_mem_pool.alloc<NodeStatClear>();
-            Error::warning(m_line, "command `CLEAR` is not implemented!");
+            Error::warning(m_line, "command `CLEAR` does nothing in a program, it only works typed in `--repl`!");
             break;
         case TokenType::list:    
             node_stat->com = m_mem_pool.alloc<NodeStatList>(); 
-            Error::warning(m_line, "command `LIST` is not implemented!");
+            Error::warning(m_line, "command `LIST` does nothing in a program, it only works typed in `--repl`!");
             break;
         case TokenType::run:     
             node_stat->com = m_mem_pool.alloc<NodeStatRun>(); 
-            Error::warning(m_line, "command `RUN` is not implemented!");
+            Error::warning(m_line, "command `RUN` does nothing in a program, it only works typed in `--repl`!");
             break;
         case TokenType::cr:      
             return nullptr;
@@ -438,8 +483,14 @@ NodeLine* Parser::parse_line() {
         auto token = consume();
         line->num = NodeNum{.num = token.var.value()};
 
+        long long num = std::stoi(line->num->num);
+        if (m_chunk) {
+            auto warnings = static_cast<size_t>(Error::sink().tellp());
+            m_row_nums.push_back({.num = num, .line = m_line, .warnings = warnings});
+        }
+
         int old_size = m_unique_str_num.size();
-        m_unique_str_num.insert(std::stoi(line->num->num));
+        m_unique_str_num.insert(num);
 
         if (m_unique_str_num.size() == old_size) {
             Error::critical(m_line, "Row number is not unique!");
@@ -469,6 +520,7 @@ NodeProg Parser::gen_prog() {
 
     m_index = 0;
     m_unique_let.clear();
+    m_uses_array = false;
 
     while (peek().has_value()) {
         if (auto line = parse_line()) 
@@ -478,10 +530,54 @@ NodeProg Parser::gen_prog() {
     }
 
     check_correct_goto();
+    prog.uses_array = m_uses_array;
 
     return prog;
 }
 
+void Parser::parse_lines(std::vector<Token>& tokens, std::vector<NodeLine*>& lines) {
+    m_tokens.swap(tokens);
+    m_index = 0;
+
+    while (peek().has_value()) {
+        if (auto line = parse_line())
+            lines.push_back(line);
+        else if (peek().has_value())
+            consume();
+    }
+}
+
+void Parser::check_targets() {
+    check_correct_goto();
+}
+
+std::unique_ptr<Parser> Parser::chunk(MemoryPool& mem_pool, bool int32) {
+    auto parser = std::make_unique<Parser>(mem_pool);
+    parser->m_chunk = true;
+    parser->m_int32 = int32;
+    parser->m_line = 0;  // until its first statement, the line the chunk before ended at
+    return parser;
+}
+
+void Parser::merge(const Parser& chunk, std::string_view warnings) {
+    for (auto& row: chunk.m_row_nums) {
+        if (!m_unique_str_num.insert(row.num).second) {
+            Error::sink() << warnings.substr(0, row.warnings);
+            Error::critical(row.line ? row.line : m_line, "Row number is not unique!");
+        }
+    }
+    Error::sink() << warnings;
+
+    for (auto& target: chunk.m_targets)  // inserted in the order a serial run would have
+        m_goto_num.insert(target);
+
+    m_unique_let.insert(chunk.m_unique_let.begin(), chunk.m_unique_let.end());
+    m_uses_array |= chunk.m_uses_array;
+
+    if (chunk.m_line)
+        m_line = chunk.m_line;
+}
+
 std::optional<Token> Parser::peek(int offset) {
     if (m_index + offset >= m_tokens.size()) {
         return {};
@@ -1,18 +1,23 @@
 #pragma once
 
 #include <cstddef>
+#include <memory>
 #include <optional>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <unordered_set>
+#include <utility>
 #include <variant>
 #include <vector>
 
 #include "lexer.hpp"
 #include "mem_pool.hpp"
 
+struct NodeExpr;
 struct NodeVar {
     std::string name;
+    NodeExpr* index = nullptr;  // element of the `@` array
 };
 
 struct NodeNum {
@@ -109,15 +114,38 @@ struct NodeLine {
 
 struct NodeProg {
     std::vector<NodeLine*> lines;
+    bool uses_array = false;
 };
 
 class Parser {
 public:
-    Parser(std::vector<Token>& tokens) : m_tokens(std::move(tokens)), m_mem_pool() {}
+    Parser(std::vector<Token>& tokens) 
+        : m_own_pool(std::make_unique<MemoryPool>()), m_mem_pool(*m_own_pool), m_tokens(std::move(tokens)) {}
+
+    // nodes go to a pool that outlives the parser (e.g. kept warm between compilations)
+    Parser(std::vector<Token>& tokens, MemoryPool& mem_pool) 
+        : m_mem_pool(mem_pool), m_tokens(std::move(tokens)) {}
+
+    // nodes of a streamed program, the caller resets the pool after every line
+    explicit Parser(MemoryPool& mem_pool) : m_mem_pool(mem_pool) {}
 
     NodeProg gen_prog();
     inline size_t get_unique_let() { return m_unique_let.size(); }
 
+    // streaming: the lines of one source line, GOTO and GOSUB targets are checked by check_targets()
+    void parse_lines(std::vector<Token>& tokens, std::vector<NodeLine*>& lines);
+    void check_targets();
+    inline bool uses_array() const { return m_uses_array; }
+    inline void set_int32(bool int32) { m_int32 = int32; }  // number literals have to fit in 32 bits
+
+    // a chunk of whole lines of a bigger program, parsed by parse_lines() on a thread of its own: row
+    // numbers and GOTO targets are kept in order for the parser of the whole program to merge()
+    static std::unique_ptr<Parser> chunk(MemoryPool& mem_pool, bool int32);
+
+    // the next chunk, checked against the ones before; its warnings (what the sink got while it was
+    // parsed) go on up to where a serial run would have stopped
+    void merge(const Parser& chunk, std::string_view warnings);
+
 private:
     void clear();
 
@@ -126,8 +154,10 @@ private:
 
     void check_correct_goto();
 
-    NodeFactor* parse_factor();
-    NodeTerm* parse_term();
+    NodeVar parse_array();
+    void check_number(const std::string& num, bool is_negative);
+    NodeFactor* parse_factor(bool is_negative = false);  // a unary minus before it makes the literal negative
+    NodeTerm* parse_term(bool is_negative = false);
     NodeExpr* parse_expr();
     NodeRelop parse_relop();
     NodeVarList parse_var_list();
@@ -143,12 +173,25 @@ private:
 
     NodeLine* parse_line();
 
-    MemoryPool m_mem_pool;
+    std::unique_ptr<MemoryPool> m_own_pool;
+    MemoryPool& m_mem_pool;
     std::vector<Token> m_tokens;
     size_t m_index = 0;
     size_t m_line = 1;
 
     std::unordered_set<char> m_unique_let;
+    bool m_uses_array = false;
+    bool m_int32 = false;
     std::unordered_set<long long> m_unique_str_num;
     std::unordered_map<long long, long long> m_goto_num;  // (goto num, line num in code)
+
+    struct RowNum {
+        long long num;
+        size_t line;      // of an error about it, 0 - the one the chunk before ended at
+        size_t warnings;  // of the chunk's, how much came before it
+    };
+
+    bool m_chunk = false;
+    std::vector<RowNum> m_row_nums;
+    std::vector<std::pair<long long, long long>> m_targets;  // like m_goto_num, in order
 };
\ No newline at end of file
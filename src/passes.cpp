@@ -0,0 +1,135 @@
+#include <algorithm>
+#include <format>
+#include <string>
+
+#include "generator.hpp"
+#include "passes.hpp"
+
+// what the changes of every pass are
+static constexpr const char* PASS_CHANGES[] = {
+    "lines",
+    "unreachable lines dropped",
+    "derived expressions and counted loops",
+    "vars in registers, inlined GOSUBs and cold lines",
+    "lines run at compile time",
+    "32-bit operations and decided IFs",
+    "instructions",
+    "aligned heads and cold instructions",
+    "rewrites",
+};
+static_assert(std::size(PASS_CHANGES) == PASS_COUNT);
+
+std::optional<Pass> pass_named(std::string_view name) {
+    auto it = std::find(std::begin(PASS_NAMES), std::end(PASS_NAMES), name);
+    if (it == std::end(PASS_NAMES))
+        return std::nullopt;
+    return static_cast<Pass>(it - std::begin(PASS_NAMES));
+}
+
+bool is_required(Pass pass) {
+    return pass == Pass::cfg || pass == Pass::codegen;
+}
+
+bool pass_enabled(const GenOptions& options, Pass pass) {
+    switch (pass) {
+        case Pass::unreachable: return options.drop_unreachable;
+        case Pass::loops:       return options.loops;
+        case Pass::profile:     return options.use_profile;
+        case Pass::eval:        return options.eval_steps > 0;
+        case Pass::ranges:      return options.ranges;
+        case Pass::layout:      return options.layout;
+        case Pass::peephole:    return options.peephole;
+        default:                return true;
+    }
+}
+
+void set_pass(GenOptions& options, Pass pass, bool enabled) {
+    switch (pass) {
+        case Pass::unreachable: options.drop_unreachable = enabled; break;
+        case Pass::loops:       options.loops = enabled; break;
+        case Pass::profile:     options.use_profile = enabled; break;
+        case Pass::ranges:      options.ranges = enabled; break;
+        case Pass::layout:      options.layout = enabled; break;
+        case Pass::peephole:    options.peephole = enabled; break;
+        case Pass::eval:
+            if (!enabled)
+                options.eval_steps = 0;
+            else if (options.eval_steps == 0)
+                options.eval_steps = GenOptions{}.eval_steps;
+            break;
+        default:
+            break;
+    }
+}
+
+bool set_opt_level(GenOptions& options, int level) {
+    if (level < 0 || level > 2)
+        return false;
+
+    for (size_t p = 0; p < PASS_COUNT; p++) {
+        auto pass = static_cast<Pass>(p);
+        bool linear = pass == Pass::unreachable || pass == Pass::profile || pass == Pass::ranges ||
+                      pass == Pass::layout || pass == Pass::peephole;
+        set_pass(options, pass, level == 2 || (level == 1 && linear));
+    }
+
+    return true;
+}
+
+bool set_passes(GenOptions& options, std::string_view list) {
+    std::array<bool, PASS_COUNT> chosen{};
+
+    while (!list.empty()) {
+        size_t comma = std::min(list.find(','), list.size());
+        auto pass = pass_named(list.substr(0, comma));
+        if (!pass)
+            return false;
+
+        chosen[static_cast<size_t>(*pass)] = true;
+        list.remove_prefix(std::min(comma + 1, list.size()));
+    }
+
+    for (size_t p = 0; p < PASS_COUNT; p++)
+        set_pass(options, static_cast<Pass>(p), chosen[p]);
+
+    return true;
+}
+
+PassManager::PassManager(const GenOptions& options) {
+    for (size_t p = 0; p < PASS_COUNT; p++)
+        m_enabled[p] = pass_enabled(options, static_cast<Pass>(p));
+}
+
+void PassManager::count(Pass pass, size_t changes) {
+    auto& stat = m_stats[static_cast<size_t>(pass)];
+    stat.changes += changes;
+    stat.ran = true;
+}
+
+void PassManager::print_stats(std::ostream& out) const {
+    uint64_t total = 0;
+
+    for (size_t p = 0; p < PASS_COUNT; p++) {
+        const Stat& stat = m_stats[p];
+        total += stat.ns;
+
+        std::string time;
+        if (!m_enabled[p])
+            time = "off";
+        else if (!stat.ran)
+            time = "not run";  // nothing to do, or ruled out by another option
+        else if (static_cast<Pass>(p) == Pass::unreachable)
+            time = "in cfg";
+        else if (static_cast<Pass>(p) == Pass::layout)
+            time = "in codegen";
+        else
+            time = std::format("{} us", stat.ns / 1000);
+
+        if (stat.ran)
+            out << std::format("passes: {:<11} {:>10} {:>9} {}\n", PASS_NAMES[p], time, stat.changes, PASS_CHANGES[p]);
+        else
+            out << std::format("passes: {:<11} {:>10}\n", PASS_NAMES[p], time);
+    }
+
+    out << std::format("passes: {:<11} {:>7} us\n", "total", total / 1000);
+}
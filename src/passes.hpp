@@ -0,0 +1,69 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <optional>
+#include <ostream>
+#include <string_view>
+
+struct GenOptions;
+
+// in the order Generator::gen_asm runs them
+enum class Pass : uint8_t { cfg, unreachable, loops, profile, eval, ranges, codegen, layout, peephole };
+
+constexpr const char* PASS_NAMES[] = {
+    "cfg", "unreachable", "loops", "profile", "eval", "ranges", "codegen", "layout", "peephole"
+};
+constexpr size_t PASS_COUNT = std::size(PASS_NAMES);
+
+std::optional<Pass> pass_named(std::string_view name);
+bool is_required(Pass pass);  // cfg and codegen, there is no program without them
+
+// the optional passes are switched by the options that have always done it (`loops`, `eval_steps`...)
+bool pass_enabled(const GenOptions& options, Pass pass);
+void set_pass(GenOptions& options, Pass pass, bool enabled);
+bool set_opt_level(GenOptions& options, int level);  // -O<level>, false - no such level
+bool set_passes(GenOptions& options, std::string_view list);  // --passes=<a,b,...>, exactly those run
+
+/*
+    The pipeline between the parser and the printed assembly. -O0 runs only
+    the required passes, -O1 adds the ones linear in the size of the program
+    (dropping unreachable lines, the profile plan, the value ranges, code
+    layout, the peephole), -O2 (the default) adds the loop optimizations and
+    the compile-time run of the program. A pass records the time it took and
+    how many changes it made, which --pass-stats prints; unreachable is found
+    by the walk that builds the cfg and layout is done while the code is
+    generated, their time is in those.
+*/
+class PassManager {
+public:
+    explicit PassManager(const GenOptions& options);
+
+    bool enabled(Pass pass) const { return m_enabled[static_cast<size_t>(pass)]; }
+
+    // runs the pass, `body` returns the changes it made
+    template <typename Body>
+    void run(Pass pass, Body&& body) {
+        auto start = std::chrono::steady_clock::now();
+        size_t changes = body();
+        auto& stat = m_stats[static_cast<size_t>(pass)];
+        stat.ns += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        stat.changes += changes;
+        stat.ran = true;
+    }
+    void count(Pass pass, size_t changes);  // of a pass done inside another one
+
+    void print_stats(std::ostream& out) const;
+private:
+    struct Stat {
+        uint64_t ns = 0;
+        size_t changes = 0;
+        bool ran = false;
+    };
+
+    std::array<bool, PASS_COUNT> m_enabled{};
+    std::array<Stat, PASS_COUNT> m_stats{};
+};
@@ -0,0 +1,635 @@
+#include <algorithm>
+#include <cstdint>
+#include <format>
+#include <iterator>
+#include <limits>
+#include <optional>
+#include <ostream>
+
+#include "peephole.hpp"
+
+/*
+    The generator evaluates expressions on the stack, so most of its code is
+    pushes immediately popped into a register. The patterns below rewrite such
+    sequences into register moves and fold them into the instructions using them.
+
+    With --int32 the values are 32 bits wide in the same registers, a
+    32-bit write clears the high half, so a 64-bit move of such a value is
+    a 32-bit move of what it was loaded from, and a 32-bit read of a 64-bit
+    load reads its low half.
+
+    Liveness is scanned forward from an instruction over a short window. com,
+    skip, loop, line and cold labels start a statement and no scratch register
+    or flag crosses a statement, so they (and jumps and GOSUB calls to them)
+    end a value's life. The callee-saved r12-r15 are never scratch.
+    Runtime error exits don't come back and read no register, so a branch to
+    one is skipped. Anything else the scan doesn't understand keeps the value
+    alive.
+*/
+
+constexpr size_t LIVENESS_WINDOW = 64;
+constexpr size_t MAX_PASSES = 16;
+
+const Peephole::Pattern Peephole::s_patterns[] = {
+    {"push-pop",      &Peephole::push_pop},       // push X; pop R       -> mov R, X
+    {"push-op-pop",   &Peephole::push_op_pop},    // push X; I; pop R    -> I; mov R, X
+    {"fold-load",     &Peephole::fold_load},      // mov R, X; op D, R   -> op D, X
+    {"forward-move",  &Peephole::forward_move},   // mov R, X; mov D, R  -> mov D, X
+    {"store-reload",  &Peephole::store_reload},   // mov M, R; mov R2, M -> mov M, R; mov R2, R
+    {"load-op-store", &Peephole::load_op_store},  // mov R, M; op R; mov M, R -> op M
+    {"load-cmp",      &Peephole::load_cmp},       // mov R, M; cmp R, Y  -> cmp M, Y
+    {"self-move",     &Peephole::self_move},      // mov R, R            -> nothing
+    {"jump-to-next",  &Peephole::jump_to_next},   // jmp L; L:           -> L:
+    {"branch-invert", &Peephole::branch_invert},  // jcc L; jmp L2; L:   -> jncc L2; L:
+    {"zero-idiom",    &Peephole::zero_idiom},     // mov R, 0            -> xor R, R
+};
+
+static bool is_barrier(Op op) {
+    return op == Op::label || is_jump(op) || op == Op::call || op == Op::ret || op == Op::syscall ||
+           op == Op::align || op == Op::section;
+}
+
+static bool is_boundary(const Label& l) {  // start of a statement
+    return l.kind == LabelKind::com || l.kind == LabelKind::skip || l.kind == LabelKind::loop ||
+           l.kind == LabelKind::line || l.kind == LabelKind::cold;
+}
+
+static bool is_qreg(const Operand& o) {
+    return o.kind == OperandKind::reg && o.width == Width::q;
+}
+
+static bool is_wreg(const Operand& o) {  // of a whole value, 64 bits or 32 with --int32
+    return o.kind == OperandKind::reg && (o.width == Width::q || o.width == Width::d);
+}
+
+static bool is_reg(const Operand& o, Reg r) {
+    return o.kind == OperandKind::reg && o.reg == r;
+}
+
+static bool addresses(const Operand& o, Reg r) {
+    return o.kind == OperandKind::mem && (o.reg == r || o.index == r);
+}
+
+static bool mentions(const Operand& o, Reg r) {
+    return is_reg(o, r) || addresses(o, r);
+}
+
+static bool fits_imm32(int64_t value) {
+    return value >= std::numeric_limits<int32_t>::min() && value <= std::numeric_limits<int32_t>::max();
+}
+
+// x read at 32 bits instead of 64: the low half of a register or a little endian memory operand
+static std::optional<Operand> narrowed(Operand x) {
+    switch (x.kind) {
+        case OperandKind::reg:
+        case OperandKind::mem:
+            if (x.width != Width::q)
+                return std::nullopt;
+            x.width = Width::d;
+            return x;
+        case OperandKind::imm:
+            if (!fits_imm32(x.imm))
+                return std::nullopt;
+            return x;
+        default:
+            return std::nullopt;
+    }
+}
+
+static bool reads(const Instr& in, Reg r) {
+    switch (in.op) {
+        case Op::mov:
+        case Op::movzx:
+        case Op::movsxd:
+            return addresses(in.a, r) || mentions(in.b, r);
+        case Op::lea:
+            return addresses(in.b, r);
+        case Op::pop:
+            return addresses(in.a, r);
+        case Op::_xor:
+        case Op::sub:
+            if (in.a.kind == OperandKind::reg && in.a == in.b)  // zeroing idiom
+                return false;
+            return mentions(in.a, r) || mentions(in.b, r);
+        case Op::imul:
+            if (in.b.kind == OperandKind::none)
+                return r == Reg::rax || mentions(in.a, r);
+            return mentions(in.a, r) || mentions(in.b, r);
+        case Op::idiv:
+        case Op::div:
+            return r == Reg::rax || r == Reg::rdx || mentions(in.a, r);
+        case Op::cqo:
+        case Op::cdq:
+            return r == Reg::rax;
+        case Op::rdtsc:
+        case Op::label:
+        case Op::nop:
+        case Op::align:
+            return false;
+        default:
+            return mentions(in.a, r) || mentions(in.b, r);
+    }
+}
+
+static bool writes(const Instr& in, Reg r) {
+    switch (in.op) {
+        case Op::imul:
+            if (in.b.kind == OperandKind::none)
+                return r == Reg::rax || r == Reg::rdx;
+            return is_reg(in.a, r);
+        case Op::idiv:
+        case Op::div:
+        case Op::rdtsc:
+            return r == Reg::rax || r == Reg::rdx;
+        case Op::cqo:
+        case Op::cdq:
+            return r == Reg::rdx;
+        case Op::mov: case Op::movzx: case Op::movsxd: case Op::lea: case Op::pop:
+        case Op::add: case Op::sub: case Op::neg: case Op::inc: case Op::dec:
+        case Op::_xor: case Op::_and: case Op::_or: case Op::shl:
+            return is_reg(in.a, r);
+        default:
+            return false;
+    }
+}
+
+static bool writes_memory(const Instr& in) {
+    switch (in.op) {
+        case Op::mov: case Op::pop:
+        case Op::add: case Op::sub: case Op::neg: case Op::inc: case Op::dec:
+        case Op::_xor: case Op::_and: case Op::_or: case Op::shl:
+            return in.a.kind == OperandKind::mem;
+        case Op::push: case Op::call:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static bool writes_flags(Op op) {  // all of them, inc and dec keep CF
+    switch (op) {
+        case Op::add: case Op::sub: case Op::imul: case Op::idiv: case Op::div: case Op::neg:
+        case Op::_xor: case Op::_and: case Op::_or: case Op::shl: case Op::cmp: case Op::test:
+            return true;
+        default:
+            return false;
+    }
+}
+
+size_t Peephole::next(size_t i) const {  // -g symbols and lines are no code, the patterns see through them
+    do {
+        i++;
+    } while (i < m_code.size() && (m_code[i].op == Op::nop || is_debug(m_code[i])));
+
+    return i;
+}
+
+void Peephole::kill(size_t i) {
+    m_code[i].op = Op::nop;
+}
+
+bool Peephole::reg_live(size_t i, Reg r) const {
+    if (r == Reg::rsp || r == Reg::rbp || r >= Reg::r12)  // r12-r14 may hold vars, r15 is the base of @
+        return true;
+
+    size_t seen = 0;
+    for (size_t j = next(i); j < m_code.size(); j = next(j)) {
+        if (++seen > LIVENESS_WINDOW)
+            return true;
+
+        const Instr& in = m_code[j];
+
+        if (in.op == Op::label)
+            return !is_boundary(in.a.label);
+        if (in.op == Op::section)  // what follows isn't what runs next
+            return true;
+
+        if (in.op == Op::call) {
+            if (in.a.kind == OperandKind::label && in.a.label.kind != LabelKind::named)  // GOSUB, the subroutine starts a statement
+                return false;
+
+            switch (r) {  // a C function, by name or a pointer: reads the arguments, clobbers the other scratch registers
+                case Reg::rdi: case Reg::rsi: case Reg::rdx: case Reg::rcx:
+                case Reg::r8: case Reg::r9: case Reg::rax:
+                    return true;
+                case Reg::r10: case Reg::r11:
+                    return false;
+                default:
+                    continue;
+            }
+        }
+
+        if (is_jump(in.op)) {
+            if (!is_boundary(in.a.label) && in.a.label.kind != LabelKind::fail)
+                return true;
+            if (in.op == Op::jmp)
+                return false;
+            continue;
+        }
+
+        if (in.op == Op::ret || in.op == Op::syscall || reads(in, r))
+            return true;
+        if (writes(in, r))
+            return false;
+    }
+
+    return true;
+}
+
+bool Peephole::flags_live(size_t i) const {
+    size_t seen = 0;
+    for (size_t j = next(i); j < m_code.size(); j = next(j)) {
+        if (++seen > LIVENESS_WINDOW)
+            return true;
+
+        const Instr& in = m_code[j];
+
+        if (in.op == Op::label)
+            return !is_boundary(in.a.label);
+        if (in.op == Op::jmp)
+            return !is_boundary(in.a.label);
+        if (is_jump(in.op) || in.op == Op::ret || in.op == Op::syscall || in.op == Op::section)
+            return true;
+        if (in.op == Op::call || writes_flags(in.op))
+            return false;
+    }
+
+    return true;
+}
+
+bool Peephole::push_pop(size_t i) {
+    size_t j = next(i);
+    if (m_code[i].op != Op::push || j == m_code.size() || m_code[j].op != Op::pop)
+        return false;
+
+    Operand x = m_code[i].a;
+    Operand r = m_code[j].a;
+
+    if (!is_qreg(r))
+        return false;
+
+    if (x == r) {
+        kill(i);
+        kill(j);
+    } else {
+        m_code[j] = {Op::mov, r, x};
+        kill(i);
+    }
+
+    return true;
+}
+
+bool Peephole::push_op_pop(size_t i) {
+    size_t j = next(i);
+    size_t k = j < m_code.size() ? next(j) : j;
+
+    if (m_code[i].op != Op::push || k == m_code.size() || m_code[k].op != Op::pop)
+        return false;
+
+    Operand x = m_code[i].a;
+    Operand r = m_code[k].a;
+    Instr in = m_code[j];
+
+    if (!is_qreg(r) || is_barrier(in.op) || in.op == Op::push || in.op == Op::pop)
+        return false;
+    if (mentions(in.a, Reg::rsp) || mentions(in.b, Reg::rsp))
+        return false;
+
+    // read x after the instruction, if it doesn't change x
+    bool keeps_x = !(x.reg != Reg::none && writes(in, x.reg))
+        && !(x.index != Reg::none && writes(in, x.index))
+        && !(x.kind == OperandKind::mem && writes_memory(in));
+
+    if (keeps_x) {
+        m_code[i] = in;
+        m_code[j] = {Op::mov, r, x};
+    } else if (!reads(in, r.reg) && !writes(in, r.reg)) {  // or move it before
+        m_code[i] = {Op::mov, r, x};
+        m_code[j] = in;
+    } else {
+        return false;
+    }
+
+    kill(k);
+    return true;
+}
+
+bool Peephole::fold_load(size_t i) {
+    const Instr& load = m_code[i];
+    if (load.op != Op::mov || !is_wreg(load.a))
+        return false;
+
+    Reg r = load.a.reg;
+    Width w = load.a.width;
+    Operand x = load.b;
+
+    if (x.kind == OperandKind::imm) {
+        if (!fits_imm32(x.imm))
+            return false;
+    } else if (x.kind != OperandKind::mem || addresses(x, r)) {
+        return false;
+    }
+
+    // the first instruction touching r, a few instructions away at most
+    size_t j = next(i);
+    for (size_t n = 0;; n++, j = next(j)) {
+        if (n == 3 || j == m_code.size() || is_barrier(m_code[j].op))
+            return false;
+
+        const Instr& in = m_code[j];
+        if (mentions(in.a, r) || mentions(in.b, r) || reads(in, r) || writes(in, r))
+            break;
+
+        // and x has to read the same in there
+        if (x.kind == OperandKind::mem && (writes_memory(in)
+            || (x.reg != Reg::none && writes(in, x.reg)) || (x.index != Reg::none && writes(in, x.index))))
+            return false;
+    }
+
+    Instr folded = m_code[j];
+    bool fits = false;
+    bool overwrites = false;  // the use writes r, what was loaded dies in it
+
+    switch (folded.op) {
+        case Op::mov:
+        case Op::add: case Op::sub: case Op::_and: case Op::_or: case Op::_xor: case Op::cmp:
+            if (!is_wreg(folded.b) || folded.b.reg != r || mentions(folded.a, r)
+                || (x.kind != OperandKind::imm && folded.a.kind != OperandKind::reg))
+                break;
+
+            if (folded.b.width == w) {
+                folded.b = x;
+                fits = true;
+            } else if (w == Width::q && folded.b.width == Width::d) {
+                if (auto low = narrowed(x)) {
+                    folded.b = *low;
+                    fits = true;
+                }
+            } else if (w == Width::d && folded.op == Op::mov && folded.a.kind == OperandKind::reg) {  // the high half is 0 either way
+                folded.a.width = Width::d;
+                folded.b = x;
+                fits = true;
+            }
+            break;
+        case Op::movsxd:
+            if (w == Width::d && is_reg(folded.b, r) && x.kind == OperandKind::mem && folded.a.kind == OperandKind::reg) {
+                folded.b = x;
+                fits = true;
+                overwrites = is_reg(folded.a, r);
+            }
+            break;
+        case Op::push:
+            if (w == Width::q && is_qreg(folded.a) && folded.a.reg == r) {
+                folded.a = x;
+                fits = true;
+            }
+            break;
+        default:
+            break;
+    }
+
+    if (!fits || (!overwrites && reg_live(j, r)))
+        return false;
+
+    m_code[j] = folded;
+    kill(i);
+
+    return true;
+}
+
+bool Peephole::forward_move(size_t i) {
+    size_t j = next(i);
+    if (j == m_code.size())
+        return false;
+
+    const Instr& first = m_code[i];
+    Instr& second = m_code[j];
+
+    if (first.op != Op::mov || !is_wreg(first.a) || second.op != Op::mov || !is_wreg(second.b) || second.b.reg != first.a.reg)
+        return false;
+
+    Reg r = first.a.reg;
+    Operand x = first.b;
+    Operand d = second.a;
+
+    if (addresses(d, r) || is_reg(d, r))
+        return false;
+
+    if (second.b.width != first.a.width) {
+        if (first.a.width == Width::q) {
+            auto low = narrowed(x);
+            if (!low)
+                return false;
+            x = *low;
+        } else if (d.kind == OperandKind::reg) {  // the high half is 0 either way
+            d.width = Width::d;
+        } else {
+            return false;
+        }
+    }
+    if (d.kind == OperandKind::mem) {  // no memory to memory moves, immediates are 32 bit
+        if (x.kind == OperandKind::mem || x.kind == OperandKind::label)
+            return false;
+        if (x.kind == OperandKind::imm && !fits_imm32(x.imm))
+            return false;
+    }
+
+    if (reg_live(j, r))
+        return false;
+
+    second.a = d;
+    second.b = x;
+    kill(i);
+
+    return true;
+}
+
+bool Peephole::store_reload(size_t i) {
+    size_t j = next(i);
+    if (j == m_code.size())
+        return false;
+
+    const Instr& store = m_code[i];
+    Instr& load = m_code[j];
+
+    if (store.op != Op::mov || store.a.kind != OperandKind::mem || !is_wreg(store.b))
+        return false;
+    if (load.op != Op::mov || !is_wreg(load.a) || load.a.width != store.b.width || !(load.b == store.a))
+        return false;
+
+    if (load.a == store.b)
+        kill(j);
+    else
+        load.b = store.b;
+
+    return true;
+}
+
+bool Peephole::load_op_store(size_t i) {
+    size_t j = next(i);
+    size_t k = j < m_code.size() ? next(j) : j;
+
+    if (k == m_code.size())
+        return false;
+
+    const Instr& load = m_code[i];
+    const Instr& in = m_code[j];
+    const Instr& store = m_code[k];
+
+    bool from_reg = is_wreg(load.b) && load.b.width == load.a.width && load.b.reg != load.a.reg;  // a var kept in a register
+    if (load.op != Op::mov || !is_wreg(load.a) || (load.b.kind != OperandKind::mem && !from_reg))
+        return false;
+
+    Reg r = load.a.reg;
+    Operand m = load.b;
+
+    if (addresses(m, r) || store.op != Op::mov || !(store.a == m) || !(store.b == load.a))
+        return false;
+    if (!(in.a == load.a))
+        return false;
+
+    switch (in.op) {
+        case Op::inc: case Op::dec: case Op::neg:
+            break;
+        case Op::add: case Op::sub: case Op::_and: case Op::_or: case Op::_xor: case Op::shl:
+            if ((in.b.kind == OperandKind::mem && !from_reg) || mentions(in.b, r))
+                return false;
+            break;
+        default:
+            return false;
+    }
+
+    if (reg_live(k, r))
+        return false;
+
+    m_code[i] = {in.op, m, in.b};
+    kill(j);
+    kill(k);
+
+    return true;
+}
+
+bool Peephole::load_cmp(size_t i) {
+    size_t j = next(i);
+    if (j == m_code.size())
+        return false;
+
+    const Instr& load = m_code[i];
+    Instr& cmp = m_code[j];
+
+    bool from_reg = is_wreg(load.b) && load.b.width == load.a.width && load.b.reg != load.a.reg;  // a var kept in a register
+    if (load.op != Op::mov || !is_wreg(load.a) || (load.b.kind != OperandKind::mem && !from_reg))
+        return false;
+    if (cmp.op != Op::cmp || !(cmp.a == load.a) || cmp.b.kind == OperandKind::mem)
+        return false;
+
+    Reg r = load.a.reg;
+    if (mentions(cmp.b, r) || reg_live(j, r))
+        return false;
+
+    cmp.a = load.b;
+    kill(i);
+
+    return true;
+}
+
+bool Peephole::self_move(size_t i) {
+    const Instr& in = m_code[i];
+    if (in.op != Op::mov || !is_qreg(in.a) || !(in.a == in.b))
+        return false;
+
+    kill(i);
+    return true;
+}
+
+bool Peephole::jump_to_next(size_t i) {
+    const Instr& jump = m_code[i];
+    if (!is_jump(jump.op) || jump.a.kind != OperandKind::label)
+        return false;
+
+    for (size_t j = next(i); j < m_code.size() && (m_code[j].op == Op::label || m_code[j].op == Op::align); j = next(j)) {
+        if (m_code[j].a.label == jump.a.label) {
+            kill(i);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool Peephole::branch_invert(size_t i) {
+    size_t j = next(i);
+    size_t k = j < m_code.size() ? next(j) : j;
+
+    if (k == m_code.size() || m_code[j].op != Op::jmp || m_code[k].op != Op::label)
+        return false;
+    if (m_code[j].a.kind != OperandKind::label)  // a jump through the --repl table has no conditional form
+        return false;
+
+    Instr& jump = m_code[i];
+    if (!(jump.a == m_code[k].a))
+        return false;
+
+    auto inverse = invert_jump(jump.op);
+    if (!inverse)
+        return false;
+
+    jump = {*inverse, m_code[j].a};
+    kill(j);
+
+    return true;
+}
+
+bool Peephole::zero_idiom(size_t i) {
+    Instr& in = m_code[i];
+    if (in.op != Op::mov || !is_wreg(in.a) || !(in.b == imm(0)) || flags_live(i))
+        return false;
+
+    Operand r = reg(in.a.reg, Width::d);  // writing the low half clears the high one
+    in = {Op::_xor, r, r};
+
+    return true;
+}
+
+void Peephole::run() {
+    m_before += m_code.size();
+    m_hits.resize(std::size(s_patterns), 0);
+
+    size_t passes = 0;
+    bool changed = true;
+    while (changed && passes < MAX_PASSES) {
+        changed = false;
+        passes++;
+
+        for (size_t i = 0; i < m_code.size(); i++) {
+            for (size_t p = 0; p < std::size(s_patterns) && m_code[i].op != Op::nop; p++) {
+                if ((this->*s_patterns[p].apply)(i)) {
+                    m_hits[p]++;
+                    changed = true;
+                }
+            }
+        }
+
+        std::erase_if(m_code, [](const Instr& in) { return in.op == Op::nop; });
+    }
+
+    m_passes = std::max(m_passes, passes);
+    m_after += m_code.size();
+}
+
+size_t Peephole::rewrites() const {
+    size_t rewrites = 0;
+    for (size_t hits: m_hits)
+        rewrites += hits;
+
+    return rewrites;
+}
+
+void Peephole::print_stats(std::ostream& out) const {
+    for (size_t p = 0; p < m_hits.size(); p++)
+        out << std::format("peephole: {:<14} {}\n", s_patterns[p].name, m_hits[p]);
+
+    out << std::format(
+        "peephole: {} -> {} instructions in {} passes\n", m_before, m_after, m_passes
+    );
+}
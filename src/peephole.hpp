@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstddef>
+#include <ostream>
+#include <vector>
+
+#include "asm.hpp"
+
+class Peephole {
+public:
+    explicit Peephole(std::vector<Instr>& code) : m_code(code) {}
+
+    void run();  // applies the patterns until none of them matches, again for every new code in the vector
+    void print_stats(std::ostream& out) const;
+    size_t rewrites() const;  // of every run so far
+private:
+    struct Pattern {
+        const char* name;
+        bool (Peephole::*apply)(size_t i);  // rewrites the code starting at instruction i
+    };
+    static const Pattern s_patterns[];
+
+    size_t next(size_t i) const;
+    void kill(size_t i);
+
+    bool reg_live(size_t i, Reg r) const;  // is r read after instruction i, before it is written
+    bool flags_live(size_t i) const;
+
+    bool push_pop(size_t i);
+    bool push_op_pop(size_t i);
+    bool fold_load(size_t i);
+    bool forward_move(size_t i);
+    bool store_reload(size_t i);
+    bool load_op_store(size_t i);
+    bool load_cmp(size_t i);
+    bool self_move(size_t i);
+    bool jump_to_next(size_t i);
+    bool branch_invert(size_t i);
+    bool zero_idiom(size_t i);
+
+    std::vector<Instr>& m_code;
+
+    std::vector<size_t> m_hits;
+    size_t m_passes = 0;  // the most any run took
+    size_t m_before = 0;
+    size_t m_after = 0;
+};
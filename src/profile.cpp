@@ -0,0 +1,269 @@
+#include <algorithm>
+#include <format>
+#include <memory>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <variant>
+#include <vector>
+
+#include "cache.hpp"
+#include "cfg.hpp"
+#include "loops.hpp"
+#include "parser.hpp"
+#include "profile.hpp"
+
+constexpr uint64_t HOT_FRACTION = 100;  // of the hottest line, what a line needs to run to be hot
+constexpr size_t MAX_INLINE_LINES = 8;   // of a subroutine emitted instead of its GOSUB
+
+std::string source_hash(const std::string& code) {
+    return std::format("{:016x}", fnv1a(code));
+}
+
+std::shared_ptr<const Profile> parse_profile(const std::string& text, const std::string& hash, std::string& error) {
+    std::istringstream in(text);
+
+    std::string magic, file_hash;
+    int version = 0;
+    if (!(in >> magic >> version >> file_hash) || magic != "tinyb-profile") {
+        error = "not a profile written by a --profile-generate build";
+        return nullptr;
+    }
+    if (version != PROFILE_VERSION) {
+        error = std::format("version {}, this compiler reads version {}", version, PROFILE_VERSION);
+        return nullptr;
+    }
+    if (file_hash != hash) {
+        error = "counted on another version of the source";
+        return nullptr;
+    }
+
+    auto profile = std::make_shared<Profile>();
+
+    for (std::string line; std::getline(in, line);) {
+        if (line.empty())
+            continue;
+
+        std::istringstream record(line);
+        std::string kind, key1, key2, key3, type;
+        size_t src = 0;
+        long long num = 0;
+        uint64_t a = 0, b = 0;
+
+        record >> kind;
+        if (kind == "line") {  // line <src> num <n> count <n> cycles <n>
+            if (record >> src >> key1 >> num >> key2 >> a >> key3 >> b && key2 == "count") {
+                profile->lines.push_back(a);
+                continue;
+            }
+        } else if (kind == "branch") {  // branch <src> (if|goto) taken <n> not-taken <n>
+            if (record >> src >> type >> key1 >> a >> key2 >> b && key1 == "taken" && key2 == "not-taken") {
+                profile->branches[src].push_back({.is_if = type == "if", .taken = a, .not_taken = b});
+                continue;
+            }
+        }
+
+        error = std::format("malformed record `{}`", line);
+        return nullptr;
+    }
+
+    return profile;
+}
+
+ProfilePlan::ProfilePlan(const NodeProg& prog, const Cfg& cfg, const Profile& profile)
+    : m_profile(profile), m_cold(prog.lines.size(), false), m_hot(prog.lines.size(), false)
+{
+    if (prog.lines.empty() || profile.lines.size() != prog.lines.size())  // the hash matched: a damaged file
+        return;
+
+    for (size_t i = 0; i < prog.lines.size(); i++) {
+        for_each_stat(prog.lines[i]->stat, [this, i](const NodeStat* s) {
+            if (auto stat_let = std::get_if<NodeStatLet*>(&s->com); stat_let && !(*stat_let)->var.index)
+                m_first_let.emplace((*stat_let)->var.name, i);
+        });
+    }
+
+    uint64_t hottest = *std::max_element(profile.lines.begin(), profile.lines.end());
+    uint64_t hot = std::max<uint64_t>(1, hottest / HOT_FRACTION);
+
+    for (size_t i = 0; i < prog.lines.size(); i++) {
+        if (!cfg.reachable(i))
+            continue;
+
+        m_cold[i] = profile.lines[i] == 0;
+        m_hot[i] = profile.lines[i] >= hot;
+        if (m_hot[i])
+            plan_inline(prog, cfg, i);
+    }
+
+    plan_regs(prog);
+}
+
+void ProfilePlan::plan_inline(const NodeProg& prog, const Cfg& cfg, size_t line) {
+    const NodeStatGosub* gosub = nullptr;
+    for_each_stat(prog.lines[line]->stat, [&gosub](const NodeStat* s) {
+        if (auto stat_gosub = std::get_if<NodeStatGosub*>(&s->com))
+            gosub = *stat_gosub;
+    });
+    if (!gosub)
+        return;
+
+    // straight lines up to a RETURN: run one after another, then back after the GOSUB
+    std::vector<NodeLine*> body;
+    std::unordered_set<std::string> declared;  // by the lines of the subroutine
+
+    for (size_t i = cfg.index_of(jump_target(gosub->expr));; i++) {
+        if (i == prog.lines.size() || body.size() == MAX_INLINE_LINES)
+            return;
+
+        const NodeStat* stat = prog.lines[i]->stat;
+        if (std::holds_alternative<NodeStatReturn*>(stat->com))
+            break;
+
+        // the copy comes before the lines below the GOSUB, so what it reads must be declared above it
+        auto known = [&](const std::string& var) {
+            auto first = m_first_let.find(var);
+            return declared.contains(var) || (first != m_first_let.end() && first->second < line);
+        };
+
+        bool ok = true;
+        std::vector<NodeExpr*> exprs;
+        stat_exprs(stat, exprs);
+
+        ExprWalker walker{.on_var = [&](const NodeVar& var) { ok = ok && (var.index || known(var.name)); }};
+        for (auto expr: exprs)
+            walker(expr);
+
+        for_each_stat(stat, [&](const NodeStat* s) {
+            if (std::holds_alternative<NodeStatGoto*>(s->com) || std::holds_alternative<NodeStatGosub*>(s->com) ||
+                std::holds_alternative<NodeStatReturn*>(s->com) || std::holds_alternative<NodeStatEnd*>(s->com))
+            {
+                ok = false;
+            } else if (auto stat_input = std::get_if<NodeStatInput*>(&s->com)) {
+                for (auto& var: (*stat_input)->var_list.list)
+                    ok = ok && (var.index || known(var.name));
+            } else if (auto stat_let = std::get_if<NodeStatLet*>(&s->com); stat_let && !(*stat_let)->var.index) {
+                declared.insert((*stat_let)->var.name);
+            }
+        });
+
+        if (!ok)
+            return;
+
+        body.push_back(prog.lines[i]);
+    }
+
+    m_inline[gosub] = std::move(body);
+}
+
+void ProfilePlan::plan_regs(const NodeProg& prog) {
+    std::unordered_map<std::string, uint64_t> uses;  // executions of the statements mentioning a var
+
+    for (size_t i = 0; i < prog.lines.size(); i++) {
+        uint64_t count = m_profile.lines[i];
+        if (!count)
+            continue;
+
+        std::vector<NodeExpr*> exprs;
+        stat_exprs(prog.lines[i]->stat, exprs);
+
+        ExprWalker walker{.on_var = [&](const NodeVar& var) {
+            if (!var.index)
+                uses[var.name] += count;
+        }};
+        for (auto expr: exprs)
+            walker(expr);
+
+        for_each_stat(prog.lines[i]->stat, [&](const NodeStat* s) {
+            if (auto stat_let = std::get_if<NodeStatLet*>(&s->com); stat_let && !(*stat_let)->var.index) {
+                uses[(*stat_let)->var.name] += count;
+            } else if (auto stat_input = std::get_if<NodeStatInput*>(&s->com)) {
+                for (auto& var: (*stat_input)->var_list.list) {
+                    if (!var.index)
+                        uses[var.name] += count;
+                }
+            }
+        });
+    }
+
+    std::vector<std::pair<uint64_t, std::string>> hottest;
+    for (auto& [var, count]: uses) {
+        if (m_first_let.contains(var))
+            hottest.push_back({count, var});
+    }
+    std::sort(hottest.begin(), hottest.end(), [](const auto& a, const auto& b) {
+        return a.first != b.first ? a.first > b.first : a.second < b.second;
+    });
+
+    static const Reg regs[] = {Reg::r12, Reg::r13, Reg::r14};
+    for (size_t i = 0; i < hottest.size() && i < std::size(regs); i++)
+        m_regs[hottest[i].second] = regs[i];
+}
+
+const BranchCount* ProfilePlan::if_site(size_t src_line, size_t nth) const {
+    auto sites = m_profile.branches.find(src_line);
+    if (sites == m_profile.branches.end())
+        return nullptr;
+
+    for (auto& site: sites->second) {
+        if (site.is_if && nth-- == 0)
+            return &site;
+    }
+    return nullptr;
+}
+
+const std::vector<NodeLine*>* ProfilePlan::inlined(const NodeStatGosub* gosub) const {
+    auto body = m_inline.find(gosub);
+    return body == m_inline.end() ? nullptr : &body->second;
+}
+
+Reg ProfilePlan::reg(const std::string& var) const {
+    auto r = m_regs.find(var);
+    return r == m_regs.end() ? Reg::none : r->second;
+}
+
+size_t ProfilePlan::changes() const {
+    return m_regs.size() + m_inline.size() + std::count(m_cold.begin(), m_cold.end(), true);
+}
+
+void ProfilePlan::dump(const NodeProg& prog, std::ostream& out) const {
+    auto name = [&prog](size_t i) {  // BASIC line number, or source line
+        auto& num = prog.lines[i]->num;
+        return num.has_value() ? num->num : std::format("#{}", prog.lines[i]->line);
+    };
+
+    for (size_t i = 0; i < m_cold.size(); i++) {
+        if (!m_cold[i] || (i > 0 && m_cold[i - 1]))
+            continue;
+
+        size_t last = i;
+        while (last + 1 < m_cold.size() && m_cold[last + 1])
+            last++;
+
+        out << std::format(
+            "profile: cold {}..{} (lines {}-{})\n", name(i), name(last), prog.lines[i]->line, prog.lines[last]->line
+        );
+    }
+
+    for (size_t i = 0; i < prog.lines.size(); i++) {
+        for_each_stat(prog.lines[i]->stat, [&](const NodeStat* s) {
+            auto stat_gosub = std::get_if<NodeStatGosub*>(&s->com);
+            if (auto body = stat_gosub ? inlined(*stat_gosub) : nullptr) {
+                out << std::format(
+                    "profile: inline GOSUB {} at {} ({} lines)\n", jump_target((*stat_gosub)->expr), name(i), body->size()
+                );
+            }
+        });
+    }
+
+    std::vector<std::pair<Reg, std::string>> regs;
+    for (auto& [var, r]: m_regs)
+        regs.push_back({r, var});
+    std::sort(regs.begin(), regs.end());
+
+    static const char* reg_names[] = {"r12", "r13", "r14"};
+    for (auto& [r, var]: regs)
+        out << std::format("profile: {} holds {}\n", reg_names[static_cast<size_t>(r) - static_cast<size_t>(Reg::r12)], var);
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "asm.hpp"
+#include "cfg.hpp"
+#include "parser.hpp"
+
+constexpr int PROFILE_VERSION = 1;
+
+struct BranchCount {
+    bool is_if;  // false - goto
+    uint64_t taken;
+    uint64_t not_taken;
+};
+
+// what a --profile-generate build counted while it ran
+struct Profile {
+    std::vector<uint64_t> lines;  // executions of every line of the program
+    std::unordered_map<size_t, std::vector<BranchCount>> branches;  // source line -> its IF/GOTO, in code order
+};
+
+// what ties a profile to the source it was counted on
+std::string source_hash(const std::string& code);
+
+// nullptr, with the reason in `error`, when the text isn't a profile of this version or of this source
+std::shared_ptr<const Profile> parse_profile(const std::string& text, const std::string& hash, std::string& error);
+
+/*
+    Decisions a profile drives. Reachable lines that never ran are cold and
+    go after the exit of the program, so are the THEN parts of IFs that
+    never passed. A GOSUB run often enough to a short straight subroutine
+    gets its lines instead of the call, and the vars used the most stay in
+    the callee-saved registers r12-r14 (r15 is the base of `@`).
+*/
+class ProfilePlan {
+public:
+    ProfilePlan(const NodeProg& prog, const Cfg& cfg, const Profile& profile);
+
+    bool cold(size_t line) const { return m_cold[line]; }
+    bool hot(size_t line) const { return m_hot[line]; }  // ran at least 1/100 as often as the hottest line
+    const BranchCount* if_site(size_t src_line, size_t nth) const;  // the nth IF of the line
+    const std::vector<NodeLine*>* inlined(const NodeStatGosub* gosub) const;  // lines to emit instead
+    Reg reg(const std::string& var) const;  // Reg::none - stays in memory
+    size_t changes() const;  // vars in registers, inlined GOSUBs and cold lines
+
+    void dump(const NodeProg& prog, std::ostream& out) const;
+private:
+    void plan_inline(const NodeProg& prog, const Cfg& cfg, size_t line);
+    void plan_regs(const NodeProg& prog);
+
+    const Profile& m_profile;
+    std::vector<bool> m_cold;
+    std::vector<bool> m_hot;
+    std::unordered_map<std::string, size_t> m_first_let;  // line declaring every var
+    std::unordered_map<const NodeStatGosub*, std::vector<NodeLine*>> m_inline;
+    std::unordered_map<std::string, Reg> m_regs;
+};
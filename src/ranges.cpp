@@ -0,0 +1,569 @@
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <format>
+#include <functional>
+#include <limits>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <variant>
+#include <vector>
+
+#include "cfg.hpp"
+#include "loops.hpp"
+#include "parser.hpp"
+#include "ranges.hpp"
+
+constexpr size_t STEPS_PER_LINE = 64;  // lines run by the analysis before it gives up, per line of the program
+constexpr int NARROWING_PASSES = 2;
+
+constexpr int64_t MIN = std::numeric_limits<int64_t>::min();
+constexpr int64_t MAX = std::numeric_limits<int64_t>::max();
+constexpr int64_t MAX_U32 = std::numeric_limits<uint32_t>::max();
+
+static std::optional<size_t> var_index(const std::string& name) {
+    if (name.size() == 1 && name[0] >= 'A' && name[0] <= 'Z')
+        return name[0] - 'A';
+    return std::nullopt;
+}
+
+// the var an expression is, as it is
+static std::optional<size_t> plain_var(const NodeExpr* expr) {
+    auto term = std::get_if<NodeTerm*>(&expr->term);
+    if (!term || (*term)->is_negative)
+        return std::nullopt;
+
+    auto fact = std::get_if<NodeFactor*>(&(*term)->fact);
+    if (!fact)
+        return std::nullopt;
+
+    auto var = std::get_if<NodeVar>(&(*fact)->body);
+    if (!var || var->index)
+        return std::nullopt;
+
+    return var_index(var->name);
+}
+
+static bool is_empty(const Range& r) { return r.lo > r.hi; }
+static bool fits_u32(const Range& r) { return r.lo >= 0 && r.hi <= MAX_U32; }
+
+static Range meet(const Range& a, const Range& b) { return {std::max(a.lo, b.lo), std::min(a.hi, b.hi)}; }
+static Range join(const Range& a, const Range& b) { return {std::min(a.lo, b.lo), std::max(a.hi, b.hi)}; }
+
+// the generated code wraps around, a bound that may overflow leaves nothing known
+static Range add(const Range& a, const Range& b) {
+    Range r;
+    if (__builtin_add_overflow(a.lo, b.lo, &r.lo) || __builtin_add_overflow(a.hi, b.hi, &r.hi))
+        return {};
+    return r;
+}
+
+static Range sub(const Range& a, const Range& b) {
+    Range r;
+    if (__builtin_sub_overflow(a.lo, b.hi, &r.lo) || __builtin_sub_overflow(a.hi, b.lo, &r.hi))
+        return {};
+    return r;
+}
+
+static Range neg(const Range& a) {
+    if (a.lo == MIN)
+        return {};
+    return {-a.hi, -a.lo};
+}
+
+static Range mul(const Range& a, const Range& b) {
+    int64_t corners[4];
+    if (__builtin_mul_overflow(a.lo, b.lo, &corners[0]) || __builtin_mul_overflow(a.lo, b.hi, &corners[1]) ||
+        __builtin_mul_overflow(a.hi, b.lo, &corners[2]) || __builtin_mul_overflow(a.hi, b.hi, &corners[3]))
+        return {};
+
+    return {*std::min_element(corners, corners + 4), *std::max_element(corners, corners + 4)};
+}
+
+// truncating, over a divisor that keeps its sign: the extremes are at the corners
+static Range div_part(const Range& a, const Range& b) {
+    if (a.lo == MIN && b.lo <= -1 && b.hi >= -1)  // MIN / -1 traps, next to it is MAX
+        return {};
+
+    int64_t corners[4] = {a.lo / b.lo, a.lo / b.hi, a.hi / b.lo, a.hi / b.hi};
+    return {*std::min_element(corners, corners + 4), *std::max_element(corners, corners + 4)};
+}
+
+static Range div(const Range& a, const Range& b) {
+    // a division by 0 stops the program, it has no value
+    std::optional<Range> r;
+    if (b.lo <= -1)
+        r = div_part(a, {b.lo, std::min(b.hi, int64_t(-1))});
+    if (b.hi >= 1) {
+        Range pos = div_part(a, {std::max(b.lo, int64_t(1)), b.hi});
+        r = r ? join(*r, pos) : pos;
+    }
+    return r.value_or(Range{});
+}
+
+Ranges::Ranges(const NodeProg& prog, const Cfg& cfg, bool int32) : m_prog(prog), m_cfg(cfg), m_int32(int32) {
+    size_t n = prog.lines.size();
+    if (n == 0 || !cfg.reachable(0))
+        return;
+
+    m_head.assign(n, false);
+    m_widen.assign(n, false);
+    m_queued.assign(n, false);
+    m_is_return_point.assign(n, false);
+    m_head[0] = true;
+
+    // the constants IFs compare against, and one off them, are where loops tend to stop
+    m_thresholds = {MIN, -MAX_U32, std::numeric_limits<int32_t>::min(), -1, 0, 1,
+                    std::numeric_limits<int32_t>::max(), MAX_U32, MAX};
+    State any;
+
+    for (size_t i = 0; i < n; i++) {
+        if (!cfg.reachable(i))
+            continue;
+
+        for (auto t: cfg.gotos(i)) {
+            m_head[t] = true;
+            m_widen[t] = m_widen[t] || t <= i;
+        }
+        for (auto t: cfg.gosubs(i))
+            m_head[t] = m_widen[t] = true;
+        if (!cfg.gosubs(i).empty() && i + 1 < n)
+            m_head[i + 1] = m_widen[i + 1] = true;
+
+        for_each_stat(prog.lines[i]->stat, [&](const NodeStat* s) {
+            auto stat_if = std::get_if<NodeStatIf*>(&s->com);
+            if (!stat_if)
+                return;
+
+            for (auto side: {(*stat_if)->expr, (*stat_if)->expr2}) {
+                Range r = expr(side, any, false);
+                if (r.lo != r.hi)
+                    continue;
+
+                m_thresholds.push_back(r.lo);
+                if (r.lo != MIN)
+                    m_thresholds.push_back(r.lo - 1);
+                if (r.lo != MAX)
+                    m_thresholds.push_back(r.lo + 1);
+            }
+        });
+    }
+
+    std::sort(m_thresholds.begin(), m_thresholds.end());
+    m_thresholds.erase(std::unique(m_thresholds.begin(), m_thresholds.end()), m_thresholds.end());
+
+    // up to a fixed point, widening where loops come back
+    send(0, any);
+    while (!m_work.empty() && !m_gave_up) {
+        std::pop_heap(m_work.begin(), m_work.end(), std::greater<>());
+        size_t head = m_work.back();
+        m_work.pop_back();
+        m_queued[head] = false;
+
+        run_block(head, m_in.at(head), false);
+    }
+
+    // then every head again from what the others send it now, which can only be less
+    m_widening = false;
+    for (int pass = 0; pass <= NARROWING_PASSES && !m_gave_up; pass++) {
+        bool record = pass == NARROWING_PASSES;
+        m_next.clear();
+        m_next_returned.reset();
+
+        send(0, any);
+        for (auto& [head, state]: m_in)
+            run_block(head, state, record);
+
+        if (!record) {
+            m_in = std::move(m_next);
+            m_returned = m_next_returned;
+        }
+    }
+
+    if (m_gave_up) {
+        m_narrow.clear();
+        m_decided.clear();
+        m_facts.clear();
+    }
+
+    m_in.clear();
+    m_next.clear();
+    std::sort(m_facts.begin(), m_facts.end());
+}
+
+std::optional<bool> Ranges::decided(const NodeStatIf* stat_if) const {
+    auto it = m_decided.find(stat_if);
+    if (it == m_decided.end())
+        return std::nullopt;
+    return it->second;
+}
+
+void Ranges::send(size_t line, const State& state) {
+    if (line >= m_prog.lines.size())  // off the end, the program exits
+        return;
+
+    if (!m_widening) {
+        auto [it, added] = m_next.emplace(line, state);
+        for (size_t v = 0; !added && v < state.size(); v++)
+            it->second[v] = join(it->second[v], state[v]);
+        return;
+    }
+
+    auto [it, added] = m_in.emplace(line, state);
+    bool changed = added;
+
+    for (size_t v = 0; !added && v < state.size(); v++) {
+        Range& old = it->second[v];
+        Range joined = join(old, state[v]);
+        if (joined == old)
+            continue;
+
+        old = m_widen[line] ? widen(old, joined) : joined;
+        changed = true;
+    }
+
+    if (changed && !m_queued[line]) {
+        m_queued[line] = true;
+        m_work.push_back(line);
+        std::push_heap(m_work.begin(), m_work.end(), std::greater<>());
+    }
+}
+
+void Ranges::returned(const State& state) {
+    std::optional<State>& target = m_widening ? m_returned : m_next_returned;
+
+    bool changed = !target;
+    if (target) {
+        for (size_t v = 0; v < state.size(); v++) {
+            Range joined = join((*target)[v], state[v]);
+            changed = changed || joined != (*target)[v];
+            (*target)[v] = joined;
+        }
+    } else {
+        target = state;
+    }
+
+    // the heads after the GOSUBs widen, that ends it
+    if (changed && m_widening) {
+        for (auto point: m_return_points)
+            send(point, *m_returned);
+    }
+}
+
+Range Ranges::wrap(const Range& r) const {
+    if (m_int32 && (r.lo < std::numeric_limits<int32_t>::min() || r.hi > std::numeric_limits<int32_t>::max()))
+        return {};
+    return r;
+}
+
+Range Ranges::widen(const Range& old, const Range& joined) const {
+    Range r = joined;
+    if (joined.lo < old.lo)
+        r.lo = *std::prev(std::upper_bound(m_thresholds.begin(), m_thresholds.end(), joined.lo));
+    if (joined.hi > old.hi)
+        r.hi = *std::lower_bound(m_thresholds.begin(), m_thresholds.end(), joined.hi);
+    return r;
+}
+
+void Ranges::run_block(size_t head, State state, bool record) {
+    for (size_t i = head;; i++) {
+        if (++m_steps > STEPS_PER_LINE * m_prog.lines.size()) {
+            m_gave_up = true;
+            return;
+        }
+
+        m_line = i;
+        bool falls = true;
+        exec(m_prog.lines[i]->stat, i, state, falls, record);
+
+        if (!falls || i + 1 >= m_prog.lines.size())
+            return;
+        if (m_head[i + 1]) {
+            send(i + 1, state);
+            return;
+        }
+    }
+}
+
+void Ranges::exec(const NodeStat* stat, size_t line, State& state, bool& falls, bool record) {
+    struct StatVisitor {
+        Ranges* ranges;
+        size_t line;
+        State& state;
+        bool& falls;
+        bool record;
+
+        void operator()(const NodeStatPrint* stat_print) {
+            for (auto& item: stat_print->exprs->list) {
+                if (auto e = std::get_if<NodeExpr*>(&item))
+                    ranges->expr(*e, state, record);
+            }
+        }
+
+        void operator()(const NodeStatLet* stat_let) {
+            Range value = ranges->expr(stat_let->expr, state, record);
+
+            if (stat_let->var.index) {
+                ranges->expr(stat_let->var.index, state, record);
+            } else if (auto v = var_index(stat_let->var.name)) {
+                state[*v] = value;
+            }
+        }
+
+        void operator()(const NodeStatInput* stat_input) {
+            for (auto& var: stat_input->var_list.list) {  // an index reads the vars before it as they were read
+                if (var.index)
+                    ranges->expr(var.index, state, record);
+                else if (auto v = var_index(var.name))
+                    state[*v] = Range{};
+            }
+        }
+
+        void operator()(const NodeStatIf* stat_if) {
+            ranges->m_may_trap = false;
+            Range a = ranges->expr(stat_if->expr, state, record);
+            Range b = ranges->expr(stat_if->expr2, state, record);
+            bool may_trap = ranges->m_may_trap;
+
+            State taken = state;
+            bool can_take = ranges->refine(taken, stat_if, a, b, true);
+            bool can_skip = ranges->refine(state, stat_if, a, b, false);
+
+            // not testing it would also skip whatever its expressions could stop the program with
+            if (record && !may_trap && can_take != can_skip) {
+                ranges->m_decided[stat_if] = can_take;
+                ranges->m_facts.push_back({line, can_take ? "IF always true" : "IF never true"});
+            }
+
+            bool then_falls = true;
+            if (can_take)
+                ranges->exec(stat_if->then, line, taken, then_falls, record);
+
+            if (can_take && then_falls) {
+                if (can_skip) {
+                    for (size_t v = 0; v < state.size(); v++)
+                        state[v] = join(state[v], taken[v]);
+                } else {
+                    state = taken;
+                }
+            } else if (!can_skip) {
+                falls = false;
+            }
+        }
+
+        void operator()(const NodeStatGoto* stat_goto) {
+            ranges->send(ranges->m_cfg.index_of(jump_target(stat_goto->expr)), state);
+            falls = false;
+        }
+
+        void operator()(const NodeStatGosub* stat_gosub) {
+            ranges->send(ranges->m_cfg.index_of(jump_target(stat_gosub->expr)), state);
+
+            // it goes on once some RETURN comes back, with what that RETURN had
+            size_t point = line + 1;
+            if (point < ranges->m_prog.lines.size() && !ranges->m_is_return_point[point]) {
+                ranges->m_is_return_point[point] = true;
+                ranges->m_return_points.push_back(point);
+            }
+            if (ranges->m_returned)
+                ranges->send(point, *ranges->m_returned);
+            falls = false;
+        }
+
+        void operator()(const NodeStatReturn*) {
+            ranges->returned(state);
+            falls = !ranges->m_cfg.in_sub_only(line);  // with no GOSUB active it goes on
+        }
+
+        void operator()(const NodeStatEnd*) { falls = false; }
+
+        void operator()(const NodeStatClear*) {}
+        void operator()(const NodeStatList*) {}
+        void operator()(const NodeStatRun*) {}
+        void operator()(std::monostate) {}
+    };
+
+    std::visit(StatVisitor{.ranges = this, .line = line, .state = state, .falls = falls, .record = record}, stat->com);
+}
+
+bool Ranges::refine(State& state, const NodeStatIf* stat_if, Range a, Range b, bool then) const {
+    RelopType relop = stat_if->relop.type;
+    if (relop == RelopType::crazy)  // generated as <>
+        relop = RelopType::ne;
+
+    if (!then) {
+        switch (relop) {
+            case RelopType::eq:  relop = RelopType::ne;  break;
+            case RelopType::ne:  relop = RelopType::eq;  break;
+            case RelopType::lt:  relop = RelopType::gte; break;
+            case RelopType::lte: relop = RelopType::gt;  break;
+            case RelopType::gt:  relop = RelopType::lte; break;
+            case RelopType::gte: relop = RelopType::lt;  break;
+            case RelopType::crazy: break;
+        }
+    }
+
+    // x < y (or x <= y): x is below the highest y, y above the lowest x
+    auto less = [](Range& x, Range& y, bool strict) {
+        if (strict && (y.hi == MIN || x.lo == MAX))
+            return false;
+        x.hi = std::min(x.hi, y.hi - strict);
+        y.lo = std::max(y.lo, x.lo + strict);
+        return true;
+    };
+
+    if (relop == RelopType::lt || relop == RelopType::lte) {
+        if (!less(a, b, relop == RelopType::lt))
+            return false;
+    } else if (relop == RelopType::gt || relop == RelopType::gte) {
+        if (!less(b, a, relop == RelopType::gt))
+            return false;
+    } else if (relop == RelopType::eq) {
+        a = b = meet(a, b);
+    } else {  // ne: only a single value can be taken off an end
+        if (a.lo == a.hi && b.lo == b.hi && a.lo == b.lo)
+            return false;
+        if (b.lo == b.hi) {
+            if (a.lo == b.lo) a.lo++;
+            else if (a.hi == b.lo) a.hi--;
+        }
+        if (a.lo == a.hi) {
+            if (b.lo == a.lo) b.lo++;
+            else if (b.hi == a.lo) b.hi--;
+        }
+    }
+
+    if (is_empty(a) || is_empty(b))
+        return false;
+
+    for (auto [side, r]: {std::pair{stat_if->expr, a}, std::pair{stat_if->expr2, b}}) {
+        if (auto v = plain_var(side)) {
+            state[*v] = meet(state[*v], r);
+            if (is_empty(state[*v]))
+                return false;
+        }
+    }
+    return true;
+}
+
+Range Ranges::expr(const NodeExpr* expr, const State& state, bool record) {
+    if (auto t = std::get_if<NodeTerm*>(&expr->term))
+        return term(*t, state, record);
+    if (auto t = std::get_if<NodeTermOp*>(&expr->term))
+        return term_op(*t, state, record);
+
+    m_may_trap = true;
+    return {};
+}
+
+Range Ranges::term(const NodeTerm* term, const State& state, bool record) {
+    // like the generator, the sign goes to the first factor
+    if (auto f = std::get_if<NodeFactor*>(&term->fact))
+        return fact(*f, term->is_negative, state, record);
+    if (auto f = std::get_if<NodeFactorOp*>(&term->fact))
+        return fact_op(*f, term->is_negative, state, record);
+
+    m_may_trap = true;
+    return {};
+}
+
+Range Ranges::term_op(const NodeTermOp* term_op, const State& state, bool record) {
+    Range a;
+    if (auto t = std::get_if<NodeTerm*>(&term_op->term))
+        a = term(*t, state, record);
+    else if (auto t = std::get_if<NodeTermOp*>(&term_op->term))
+        a = this->term_op(*t, state, record);
+    else
+        m_may_trap = true;
+
+    Range b = term(std::get<NodeTerm*>(term_op->term2), state, record);
+    return wrap(term_op->is_add ? add(a, b) : sub(a, b));
+}
+
+Range Ranges::fact(const NodeFactor* fact, bool is_negative, const State& state, bool record) {
+    struct FactorVisitor {
+        Ranges* ranges;
+        bool is_negative;
+        const State& state;
+        bool record;
+
+        Range operator()(const NodeNum& num) {
+            uint64_t magnitude = 0;
+            auto [end, error] = std::from_chars(num.num.data(), num.num.data() + num.num.size(), magnitude);
+
+            if (error != std::errc() || end != num.num.data() + num.num.size() ||
+                magnitude > static_cast<uint64_t>(MAX) + is_negative)
+            {
+                ranges->m_may_trap = true;  // the generator reports it
+                return {};
+            }
+
+            int64_t value = is_negative ? static_cast<int64_t>(0 - magnitude) : static_cast<int64_t>(magnitude);
+            return {value, value};
+        }
+
+        Range operator()(const NodeVar& var) {
+            if (var.index) {  // `@` isn't followed, and its bounds check may fail
+                ranges->expr(var.index, state, record);
+                ranges->m_may_trap = true;
+                return {};
+            }
+
+            auto v = var_index(var.name);
+            return sign(v ? state[*v] : Range{});
+        }
+
+        Range operator()(const NodeTerm* term) { return sign(ranges->term(term, state, record)); }
+        Range operator()(const NodeTermOp* term_op) { return sign(ranges->term_op(term_op, state, record)); }
+
+        Range sign(const Range& r) const { return is_negative ? ranges->wrap(neg(r)) : r; }
+    };
+
+    return std::visit(FactorVisitor{.ranges = this, .is_negative = is_negative, .state = state, .record = record}, fact->body);
+}
+
+Range Ranges::fact_op(const NodeFactorOp* fact_op, bool is_negative, const State& state, bool record) {
+    Range a;
+    if (auto f = std::get_if<NodeFactor*>(&fact_op->fact))
+        a = fact(*f, is_negative, state, record);
+    else
+        a = this->fact_op(std::get<NodeFactorOp*>(fact_op->fact), is_negative, state, record);
+
+    Range b = fact(std::get<NodeFactor*>(fact_op->fact2), false, state, record);
+
+    if (fact_op->is_mul) {
+        // the low 32 bits of the product are all of it
+        if (record && a.lo >= 0 && b.lo >= 0 && fits_u32(a) && fits_u32(b) && (a.hi == 0 || b.hi <= MAX_U32 / a.hi)) {
+            m_narrow.insert(fact_op);
+            m_facts.push_back({m_line, "32-bit multiplication"});
+        }
+        return wrap(mul(a, b));
+    }
+
+    int64_t min = m_int32 ? std::numeric_limits<int32_t>::min() : MIN;
+    if ((b.lo <= 0 && b.hi >= 0) || (a.lo <= min && b.lo <= -1 && b.hi >= -1))
+        m_may_trap = true;
+
+    // div traps on 0 like idiv does, on nothing else with these
+    if (record && fits_u32(a) && fits_u32(b)) {
+        m_narrow.insert(fact_op);
+        m_facts.push_back({m_line, "32-bit division"});
+    }
+    return wrap(div(a, b));
+}
+
+void Ranges::dump(const NodeProg& prog, std::ostream& out) const {
+    if (m_gave_up) {
+        out << std::format("ranges: gave up after {} lines run\n", m_steps);
+        return;
+    }
+
+    for (auto& [line, fact]: m_facts) {
+        auto& num = prog.lines[line]->num;
+        out << std::format(
+            "ranges: {} (line {}): {}\n",
+            num.has_value() ? num->num : std::format("#{}", prog.lines[line]->line), prog.lines[line]->line, fact
+        );
+    }
+}
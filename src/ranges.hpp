@@ -0,0 +1,94 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <ostream>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "cfg.hpp"
+#include "parser.hpp"
+
+// values a var or an expression can have, lo <= hi
+struct Range {
+    int64_t lo = std::numeric_limits<int64_t>::min();
+    int64_t hi = std::numeric_limits<int64_t>::max();
+
+    bool operator==(const Range& other) const = default;
+};
+
+/*
+    Interval analysis of the 26 vars over the lines of a program. Ranges
+    start out unknown and come from constants, LET and the conditions of
+    IFs: past `IF I < 10 THEN GOTO ...` the var is at least 10. They are
+    followed into GOSUB targets, and whatever a RETURN has goes back to
+    every line after a GOSUB. Loops widen a bound to the next constant
+    compared against (or to the 32 and 64-bit limits) until nothing
+    changes, then a couple of plain passes take back what that gave away.
+
+    What comes out is about nodes, so it holds wherever they are emitted:
+    multiplications and divisions of non-negative values that fit in 32
+    bits, and IFs that always or never take their THEN. With --int32 the
+    code wraps around at 32 bits, so a bound past them leaves nothing known.
+*/
+class Ranges {
+public:
+    Ranges(const NodeProg& prog, const Cfg& cfg, bool int32 = false);
+
+    bool narrow(const NodeFactorOp* fact_op) const { return m_narrow.contains(fact_op); }
+    std::optional<bool> decided(const NodeStatIf* stat_if) const;  // nullopt - depends on the run
+    size_t changes() const { return m_facts.size(); }  // 32-bit operations and decided IFs
+
+    void dump(const NodeProg& prog, std::ostream& out) const;
+private:
+    using State = std::array<Range, 26>;
+
+    // what a block of lines from a head sends on, facts recorded when `record`
+    void run_block(size_t head, State state, bool record);
+    void exec(const NodeStat* stat, size_t line, State& state, bool& falls, bool record);
+    bool refine(State& state, const NodeStatIf* stat_if, Range a, Range b, bool then) const;  // false - can't be
+
+    Range expr(const NodeExpr* expr, const State& state, bool record);
+    Range term(const NodeTerm* term, const State& state, bool record);
+    Range term_op(const NodeTermOp* term_op, const State& state, bool record);
+    Range fact(const NodeFactor* fact, bool is_negative, const State& state, bool record);
+    Range fact_op(const NodeFactorOp* fact_op, bool is_negative, const State& state, bool record);
+
+    void send(size_t line, const State& state);  // an edge to a head
+    void returned(const State& state);           // a RETURN, back to every line after a GOSUB
+    Range widen(const Range& old, const Range& joined) const;
+    Range wrap(const Range& r) const;  // of an expression, as the code computes it
+
+    const NodeProg& m_prog;
+    const Cfg& m_cfg;
+    bool m_int32;
+
+    std::vector<bool> m_head;   // lines a block starts at: the first one, jump targets, after a GOSUB
+    std::vector<bool> m_widen;  // heads a loop comes back to
+    std::vector<int64_t> m_thresholds;  // sorted
+
+    std::unordered_map<size_t, State> m_in;  // of the heads reached
+    std::unordered_map<size_t, State> m_next;  // the pass being made, when it isn't widening
+    bool m_widening = true;
+    std::vector<size_t> m_work;  // heap of heads, the first line first
+    std::vector<bool> m_queued;
+
+    std::optional<State> m_returned;  // join of every RETURN
+    std::optional<State> m_next_returned;
+    std::vector<size_t> m_return_points;  // lines after a GOSUB the analysis reached
+    std::vector<bool> m_is_return_point;
+
+    bool m_may_trap = false;  // the expression just ranged may stop the program or fail to compile
+    size_t m_line = 0;  // of the statement being run
+    size_t m_steps = 0;
+    bool m_gave_up = false;
+
+    std::unordered_set<const NodeFactorOp*> m_narrow;
+    std::unordered_map<const NodeStatIf*, bool> m_decided;
+    std::vector<std::pair<size_t, const char*>> m_facts;  // line and what was found there, for dump()
+};
@@ -0,0 +1,305 @@
+#include <algorithm>
+#include <charconv>
+#include <cstddef>
+#include <cstdlib>
+#include <filesystem>
+#include <format>
+#include <iterator>
+#include <limits>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <dlfcn.h>
+#include <unistd.h>
+
+#include "driver.hpp"
+#include "emitter.hpp"
+#include "error.hpp"
+#include "generator.hpp"
+#include "lexer.hpp"
+#include "parser.hpp"
+#include "repl.hpp"
+#include "toolchain.hpp"
+
+namespace fs = std::filesystem;
+
+static_assert(offsetof(tinyb_ctx, vars) == CTX_VARS);
+static_assert(offsetof(tinyb_ctx, user) == CTX_USER);
+static_assert(offsetof(tinyb_ctx, print_number) == CTX_PRINT_NUMBER);
+static_assert(offsetof(tinyb_ctx, print_text) == CTX_PRINT_TEXT);
+static_assert(offsetof(tinyb_ctx, input_number) == CTX_INPUT_NUMBER);
+static_assert(offsetof(tinyb_ctx, error) == CTX_ERROR);
+
+// slots of the table
+constexpr size_t EXIT = 0;
+constexpr size_t NO_LINE = REPL_SLOTS - 1;
+static_assert(std::string_view(REPL_RUNTIME[EXIT]) == "exit" && std::string_view(REPL_RUNTIME[NO_LINE]) == "rt_no_line");
+
+// the number a typed line starts with
+static std::optional<uint64_t> line_number(const std::string& text) {
+    const char* begin = text.data() + std::min(text.find_first_not_of(' '), text.size());
+    const char* end = text.data() + text.size();
+
+    uint64_t num;
+    auto [ptr, ec] = std::from_chars(begin, end, num);
+    if (ptr == begin)
+        return std::nullopt;
+    if (ec == std::errc::result_out_of_range)
+        Error::critical(1, "Line number is too big!");
+    return num;
+}
+
+Repl::Repl(const Options& options, std::istream& in, std::ostream& out) : m_gen(options.gen), m_in(in), m_out(out) {
+    // a line alone has no source file for the debug info and no cold code to move
+    m_gen.emit = Emit::repl;
+    m_gen.entry = "tinyb_repl";
+    m_gen.layout = false;
+    m_gen.debug = false;
+
+    m_ctx.user = this;
+    m_ctx.print_number = print_number;
+    m_ctx.print_text = print_text;
+    m_ctx.input_number = input_number;
+}
+
+int Repl::run() {
+    try {
+        Emitter asm_text;
+        Generator g{m_gen};
+        g.gen_repl_runtime(asm_text);
+
+        const uintptr_t* runtime;
+        m_runtime = load(asm_text, "tinyb_repl_runtime", runtime);
+        m_table.assign(runtime, runtime + REPL_SLOTS);
+        m_run = reinterpret_cast<Run>(dlsym(m_runtime.get(), m_gen.entry.c_str()));
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << "\n";
+        return EXIT_FAILURE;
+    }
+
+    bool prompt = &m_in == &std::cin && isatty(STDIN_FILENO);
+    std::string text;
+
+    while (true) {
+        if (prompt)
+            m_out << "> " << std::flush;
+        if (!std::getline(m_in, text))
+            break;
+
+        try {
+            enter(text);
+        } catch (const std::exception& e) {
+            std::cerr << e.what() << "\n";
+        }
+        m_mem_pool.reset();
+    }
+
+    return EXIT_SUCCESS;
+}
+
+void Repl::enter(const std::string& text) {
+    auto num = line_number(text);
+    std::string code = text + "\n";
+    Lexer l{code, num.value_or(1)};
+    auto tokens = l.gen_tokens();
+
+    if (tokens.empty() || tokens.front().type == TokenType::cr)
+        return;
+
+    bool alone = tokens.size() == 1 || tokens[1].type == TokenType::cr;
+    if (num && alone) {
+        m_program.erase(*num);
+        m_changed.insert(*num);
+        return;
+    }
+
+    if (!num && alone) {
+        switch (tokens.front().type) {
+            case TokenType::run:
+                update();
+                std::fill(std::begin(m_ctx.vars), std::end(m_ctx.vars), 0);
+                execute(m_program.empty() ? m_table[EXIT] : m_program.begin()->second.code);
+                return;
+            case TokenType::list:
+                list();
+                return;
+            case TokenType::clear:
+                clear();
+                return;
+            default:
+                break;
+        }
+    }
+
+    // parsed as it is typed, so a mistake is never in the program
+    Parser p{m_mem_pool};
+    p.set_int32(m_gen.int32);
+    std::vector<NodeLine*> lines;
+    p.parse_lines(tokens, lines);
+
+    if (num) {
+        m_program[*num] = {.text = text.substr(0, text.find_last_not_of(" \r") + 1)};
+        m_changed.insert(*num);
+        return;
+    }
+
+    // at once, with the program as it is now for GOTO and GOSUB
+    update();
+    if (lines.empty())
+        return;
+
+    const uintptr_t* start;
+    auto library = compile(lines, start);
+    execute(start[0]);
+}
+
+void Repl::list() {
+    for (auto& [num, line]: m_program)
+        m_out << line.text << "\n";
+    m_out.flush();
+}
+
+void Repl::clear() {
+    m_program.clear();
+    m_changed.clear();
+    m_slots.clear();
+    m_table.resize(REPL_SLOTS);
+    std::fill(std::begin(m_ctx.vars), std::end(m_ctx.vars), 0);
+}
+
+std::shared_ptr<void> Repl::load(const Emitter& asm_text, const char* table, const uintptr_t*& symbols) {
+    Intermediates temps{"", false};
+
+    std::string error;
+    if (!asm_text.write(temps.asm_fd(), error))
+        throw std::runtime_error(std::format("Cannot write the assembly: {}", error));
+
+    // gone with the temps, the mapping of it stays
+    std::string library = fs::path(temps.obj_path()).replace_extension(".so").string();
+    std::string tool_output;
+    if (Driver::assemble(temps, library, m_gen, tool_output)) {
+        if (tool_output.ends_with('\n'))
+            tool_output.pop_back();
+        throw std::runtime_error(tool_output);
+    }
+
+    void* handle = dlopen(library.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (!handle)
+        throw std::runtime_error(dlerror());
+    std::shared_ptr<void> loaded{handle, dlclose};
+
+    symbols = static_cast<const uintptr_t*>(dlsym(handle, table));
+    if (!symbols)
+        throw std::runtime_error(std::format("`{}` has no `{}`", library, table));
+    return loaded;
+}
+
+std::shared_ptr<void> Repl::compile(const std::vector<NodeLine*>& lines, const uintptr_t*& code) {
+    Emitter asm_text;
+    Generator g{m_gen};
+    g.gen_repl_lines(lines, [this](uint64_t num) { return line_slot(num); }, asm_text);
+
+    return load(asm_text, "tinyb_repl_lines", code);
+}
+
+void Repl::update() {
+    std::vector<NodeLine*> lines;
+    std::vector<uint64_t> nums;
+
+    // what they warned of was shown as they were typed
+    std::ostringstream warnings;
+    Error::set_sink(warnings);
+    struct SinkGuard {
+        ~SinkGuard() { Error::set_sink(std::cerr); }
+    } sink_guard;
+
+    for (uint64_t num: m_changed) {
+        auto line = m_program.find(num);
+        if (line == m_program.end())
+            continue;
+
+        std::string code = line->second.text + "\n";
+        Lexer l{code, num};
+        auto tokens = l.gen_tokens();
+
+        Parser p{m_mem_pool};
+        p.set_int32(m_gen.int32);
+        p.parse_lines(tokens, lines);
+        nums.push_back(num);
+    }
+
+    if (!lines.empty()) {
+        const uintptr_t* code;
+        auto library = compile(lines, code);
+
+        for (size_t i = 0; i < nums.size(); i++) {
+            auto& line = m_program.at(nums[i]);
+            line.library = library;
+            line.code = code[i];
+        }
+    }
+
+    // the code of every changed line first, then what comes after it and after the line before it
+    for (uint64_t num: m_changed) {
+        auto line = m_program.find(num);
+        m_table[line_slot(num)] = line != m_program.end() ? line->second.code : m_table[NO_LINE];
+    }
+
+    for (uint64_t num: m_changed) {
+        auto next = m_program.lower_bound(num);
+        if (next != m_program.end() && next->first == num)
+            link(next);
+        if (next != m_program.begin())
+            link(std::prev(next));
+    }
+
+    m_changed.clear();
+}
+
+void Repl::execute(uintptr_t start) {
+    int status = m_run(&m_ctx, m_table.data(), start);
+    m_out.flush();
+
+    if (status != TINYB_OK)
+        std::cerr << m_ctx.error << "\n";
+}
+
+size_t Repl::line_slot(uint64_t num) {
+    auto [slot, added] = m_slots.try_emplace(num, m_table.size());
+    if (added)
+        m_table.insert(m_table.end(), {m_table[NO_LINE], m_table[EXIT]});
+    return slot->second;
+}
+
+void Repl::link(std::map<uint64_t, Line>::iterator line) {
+    auto next = std::next(line);
+    m_table[line_slot(line->first) + 1] = next != m_program.end() ? next->second.code : m_table[EXIT];
+}
+
+void Repl::print_number(void* user, int64_t value) {
+    static_cast<Repl*>(user)->m_out << value;
+}
+
+void Repl::print_text(void* user, const char* text, size_t size) {
+    static_cast<Repl*>(user)->m_out.write(text, size);
+}
+
+int Repl::input_number(void* user, int64_t* value) {
+    auto repl = static_cast<Repl*>(user);
+    repl->m_out.flush();
+
+    if (repl->m_in >> *value)
+        return 1;
+
+    if (repl->m_in.eof())
+        return 0;
+
+    // not a number: the rest of its line goes, the run ends with an error
+    repl->m_in.clear();
+    repl->m_in.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+    return -1;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstdint>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "emitter.hpp"
+#include "mem_pool.hpp"
+#include "options.hpp"
+#include "tinyb.h"
+
+/*
+    tinyb --repl: a numbered line typed in replaces the line of the program
+    with that number (a number alone deletes it), anything else runs at once
+    with the vars A to Z as the last run left them. RUN runs the program
+    from its first line with the vars at 0, LIST prints it, CLEAR empties it.
+
+    Every run compiles only the lines changed since the one before, all of
+    them into one shared library, and links them into the table the
+    runtime jumps through (see Generator::gen_repl_runtime): the line before
+    a changed one gets a new successor, nothing else is touched. A library
+    is unloaded when none of its lines are left, so an edit costs one
+    assembler and linker run however big the program is.
+*/
+class Repl {
+public:
+    explicit Repl(const Options& options, std::istream& in = std::cin, std::ostream& out = std::cout);
+
+    int run();
+
+private:
+    using Run = int (*)(tinyb_ctx* ctx, const uintptr_t* table, uintptr_t start);
+
+    struct Line {
+        std::string text;  // as it was typed
+        std::shared_ptr<void> library{};  // with its code, none - not compiled yet
+        uintptr_t code = 0;
+    };
+
+    void enter(const std::string& text);
+    void list();
+    void clear();
+
+    // assembles and loads a library, `symbols` is the table it exports
+    std::shared_ptr<void> load(const Emitter& asm_text, const char* table, const uintptr_t*& symbols);
+    std::shared_ptr<void> compile(const std::vector<NodeLine*>& lines, const uintptr_t*& code);
+    void update();  // compiles and links the lines changed since the last one
+    void execute(uintptr_t start);
+
+    size_t line_slot(uint64_t num);  // of the code of the line, the code after it is in the next one
+    void link(std::map<uint64_t, Line>::iterator line);
+
+    static void print_number(void* user, int64_t value);
+    static void print_text(void* user, const char* text, size_t size);
+    static int input_number(void* user, int64_t* value);
+
+    GenOptions m_gen;
+    std::istream& m_in;
+    std::ostream& m_out;
+    MemoryPool m_mem_pool;  // nodes of what is being compiled, reset after it
+
+    std::shared_ptr<void> m_runtime;
+    Run m_run = nullptr;
+
+    std::map<uint64_t, Line> m_program;
+    std::set<uint64_t> m_changed;  // lines typed in or deleted since the last update
+    std::unordered_map<uint64_t, size_t> m_slots;
+    std::vector<uintptr_t> m_table;  // REPL_RUNTIME, then the pairs of the line numbers
+
+    tinyb_ctx m_ctx{};
+};
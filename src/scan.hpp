@@ -0,0 +1,109 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__SSE2__) && !defined(TINYB_NO_SIMD)
+#include <emmintrin.h>
+#define TINYB_SCAN_SSE2 1
+#endif
+
+/*
+    Runs of the source the lexer takes as a whole, 16 bytes at a time with
+    SSE2 (part of every x86-64) and a byte at a time for the tail and on
+    other targets. Every scan returns how many bytes from p are in the run,
+    end - p when it goes to the end. Only ASCII letters and digits count as
+    such, like std::isalpha and std::isdigit in the C locale.
+*/
+
+namespace scan {
+
+// most runs (names, numbers, the space between tokens) end within this many bytes, sooner than
+// a block is loaded and compared
+constexpr size_t SCALAR_PREFIX = 8;
+
+inline bool is_alpha(char c) { return static_cast<unsigned char>((c | 0x20) - 'a') < 26; }
+inline bool is_digit(char c) { return static_cast<unsigned char>(c - '0') < 10; }
+
+#ifdef TINYB_SCAN_SSE2
+// bytes of v that are in [lo, lo + count), as a movemask
+inline unsigned in_range(__m128i v, char lo, char count) {
+    __m128i offset = _mm_sub_epi8(v, _mm_set1_epi8(lo));
+    __m128i below = _mm_cmpeq_epi8(_mm_min_epu8(offset, _mm_set1_epi8(count - 1)), offset);
+    return _mm_movemask_epi8(below);
+}
+
+// bytes before the first one `mask` (a movemask of the bytes in the run) leaves out, over whole
+// blocks of 16: where the tail starts when there is none
+template <typename Mask>
+inline size_t span16(const char* p, const char* end, Mask mask) {
+    const char* s = p;
+    for (; end - s >= 16; s += 16) {
+        unsigned out = ~mask(_mm_loadu_si128(reinterpret_cast<const __m128i*>(s))) & 0xffff;
+        if (out)
+            return s - p + __builtin_ctz(out);
+    }
+    return s - p;
+}
+#endif
+
+// n moved on over the bytes `in` takes, up to limit
+template <typename In>
+inline size_t bytes(const char* p, const char* end, size_t n, size_t limit, In in) {
+    while (n < limit && p + n < end && in(p[n]))
+        n++;
+    return n;
+}
+
+inline bool is_space(char c) { return c == ' '; }
+inline bool is_str_text(char c) { return c != '"' && c != '\\'; }
+
+inline size_t alpha(const char* p, const char* end) {
+    size_t n = bytes(p, end, 0, SCALAR_PREFIX, is_alpha);
+#ifdef TINYB_SCAN_SSE2
+    if (n == SCALAR_PREFIX)
+        n += span16(p + n, end, [](__m128i v) { return in_range(_mm_or_si128(v, _mm_set1_epi8(0x20)), 'a', 26); });
+#endif
+    return bytes(p, end, n, SIZE_MAX, is_alpha);
+}
+
+inline size_t digits(const char* p, const char* end) {
+    size_t n = bytes(p, end, 0, SCALAR_PREFIX, is_digit);
+#ifdef TINYB_SCAN_SSE2
+    if (n == SCALAR_PREFIX)
+        n += span16(p + n, end, [](__m128i v) { return in_range(v, '0', 10); });
+#endif
+    return bytes(p, end, n, SIZE_MAX, is_digit);
+}
+
+inline size_t spaces(const char* p, const char* end) {
+    size_t n = bytes(p, end, 0, SCALAR_PREFIX, is_space);
+#ifdef TINYB_SCAN_SSE2
+    if (n == SCALAR_PREFIX)
+        n += span16(p + n, end, [](__m128i v) { return unsigned(_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')))); });
+#endif
+    return bytes(p, end, n, SIZE_MAX, is_space);
+}
+
+// the text of a string literal up to its closing quote or an escape
+inline size_t str_text(const char* p, const char* end) {
+    size_t n = bytes(p, end, 0, SCALAR_PREFIX, is_str_text);
+#ifdef TINYB_SCAN_SSE2
+    if (n == SCALAR_PREFIX) {
+        n += span16(p + n, end, [](__m128i v) {
+            __m128i stop = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('"')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\\')));
+            return unsigned(~_mm_movemask_epi8(stop));
+        });
+    }
+#endif
+    return bytes(p, end, n, SIZE_MAX, is_str_text);
+}
+
+// a comment up to the end of its line; memchr is vectorized at least as wide as this
+inline size_t to_newline(const char* p, const char* end) {
+    auto nl = static_cast<const char*>(std::memchr(p, '\n', end - p));
+    return nl ? nl - p : end - p;
+}
+
+}  // namespace scan
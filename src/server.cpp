@@ -0,0 +1,282 @@
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <csignal>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "mem_pool.hpp"
+#include "server.hpp"
+#include "thread_pool.hpp"
+
+namespace fs = std::filesystem;
+
+constexpr uint64_t MAX_MESSAGE_SIZE = 1ull << 32;
+
+static bool read_full(int fd, void* buf, size_t size) {
+    auto ptr = static_cast<char*>(buf);
+    while (size > 0) {
+        ssize_t got = read(fd, ptr, size);
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) return false;
+
+        ptr += got;
+        size -= got;
+    }
+    return true;
+}
+
+static bool write_full(int fd, const void* buf, size_t size) {
+    auto ptr = static_cast<const char*>(buf);
+    while (size > 0) {
+        ssize_t put = write(fd, ptr, size);
+        if (put < 0 && errno == EINTR) continue;
+        if (put <= 0) return false;
+
+        ptr += put;
+        size -= put;
+    }
+    return true;
+}
+
+static bool send_strings(int fd, const std::vector<std::string>& strings) {
+    uint32_t count = strings.size();
+    if (!write_full(fd, &count, sizeof(count)))
+        return false;
+
+    for (auto& str: strings) {
+        uint64_t size = str.size();
+        if (!write_full(fd, &size, sizeof(size)) || !write_full(fd, str.data(), str.size()))
+            return false;
+    }
+    return true;
+}
+
+static bool recv_strings(int fd, std::vector<std::string>& strings) {
+    uint32_t count;
+    if (!read_full(fd, &count, sizeof(count)) || count > 1024)
+        return false;
+
+    strings.resize(count);
+    for (auto& str: strings) {
+        uint64_t size;
+        if (!read_full(fd, &size, sizeof(size)) || size > MAX_MESSAGE_SIZE)
+            return false;
+
+        str.resize(size);
+        if (!read_full(fd, str.data(), size))
+            return false;
+    }
+    return true;
+}
+
+static bool read_file(const fs::path& path, std::string& content) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open())
+        return false;
+
+    std::stringstream stream;
+    stream << file.rdbuf();
+    content = stream.str();
+    return true;
+}
+
+std::string default_socket_path() {
+    if (const char* dir = std::getenv("XDG_RUNTIME_DIR"))
+        return (fs::path(dir) / "tinyb.sock").string();
+
+    return std::format("/tmp/tinyb-{}.sock", getuid());
+}
+
+static int open_socket(const std::string& path, sockaddr_un& addr) {
+    if (path.size() >= sizeof(addr.sun_path)) {
+        std::cerr << std::format("Socket path `{}` is too long\n", path);
+        return -1;
+    }
+
+    addr = {};
+    addr.sun_family = AF_UNIX;
+    std::strcpy(addr.sun_path, path.c_str());
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        std::cerr << std::format("socket: {}\n", std::strerror(errno));
+
+    return fd;
+}
+
+int Server::run() {
+    std::string path = m_options.socket.empty() ? default_socket_path() : m_options.socket;
+
+    sockaddr_un addr;
+    int fd = open_socket(path, addr);
+    if (fd < 0)
+        return EXIT_FAILURE;
+
+    unlink(path.c_str());  // left over by a previous server
+
+    if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 || listen(fd, 64) < 0) {
+        std::cerr << std::format("Cannot listen on `{}`: {}\n", path, std::strerror(errno));
+        close(fd);
+        return EXIT_FAILURE;
+    }
+
+    std::signal(SIGPIPE, SIG_IGN);  // clients may hang up before the response
+    std::cerr << std::format("tinyb: serving on {}\n", path);
+
+    ThreadPool pool{m_options.jobs};
+
+    while (true) {
+        int client = accept4(fd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (client < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+
+            std::cerr << std::format("accept: {}\n", std::strerror(errno));
+            break;
+        }
+
+        pool.submit([this, client] {
+            handle(client);
+            close(client);
+        });
+    }
+
+    pool.wait();
+    close(fd);
+    return EXIT_FAILURE;
+}
+
+void Server::handle(int client) {
+    // every worker keeps its arena between requests
+    thread_local MemoryPool mem_pool;
+
+    std::vector<std::string> request;
+    if (!recv_strings(client, request) || request.size() < 3)
+        return;
+
+    Options options = m_options;  // cache settings are the server's
+    options.gen = GenOptions{};
+
+    size_t args = request.size() - 3;
+    for (size_t i = 0; i < args; i++) {
+        if (!parse_gen_option(request[i], options.gen)) {
+            send_strings(client, {"0", std::format("Unknown option `{}`\n", request[i]), ""});
+            return;
+        }
+    }
+
+    std::string dir_template = (fs::temp_directory_path() / "tinyb-serve-XXXXXX").string();
+    if (!mkdtemp(dir_template.data())) {
+        send_strings(client, {"0", std::format("mkdtemp: {}\n", std::strerror(errno)), ""});
+        return;
+    }
+    fs::path dir = dir_template;
+
+    // what Driver::compile sets for a local build, from the paths of the client
+    options.gen.source_path = request[args];
+    options.gen.profile_path = request[args + 1];
+
+    JobResult result = m_driver.build(std::move(request.back()), (dir / "out").string(), options, &mem_pool);
+    mem_pool.reset();
+
+    std::string executable;
+    if (result.ok && !read_file(dir / "out", executable)) {
+        result.ok = false;
+        result.diagnostics += "Cannot read the linked executable\n";
+    }
+
+    std::error_code ec;
+    fs::remove_all(dir, ec);
+
+    send_strings(client, {result.ok ? "1" : "0", result.diagnostics, executable});
+}
+
+int run_client(const Options& options) {
+    if (options.inputs.size() != 1) {
+        std::cerr << "--connect compiles exactly one file\n";
+        return EXIT_FAILURE;
+    }
+
+    // a relative profile is the client's, the server runs somewhere else
+    std::vector<std::string> request;
+    for (auto& arg: options.gen_args) {
+        if (arg.starts_with("--profile-use="))
+            request.push_back("--profile-use=" + fs::absolute(arg.substr(arg.find('=') + 1)).string());
+        else
+            request.push_back(arg);
+    }
+
+    fs::path output = options.output.empty() ? "out" : options.output;
+    request.push_back(fs::absolute(options.inputs.front()).string());
+    request.push_back(output.string() + ".prof");  // relative like a local build, to where the program runs
+    request.emplace_back();
+
+    if (!read_file(options.inputs.front(), request.back())) {
+        std::cerr << std::format("Cannot open `{}`\n", options.inputs.front());
+        return EXIT_FAILURE;
+    }
+
+    std::string path = options.socket.empty() ? default_socket_path() : options.socket;
+
+    sockaddr_un addr;
+    int fd = open_socket(path, addr);
+    if (fd < 0)
+        return EXIT_FAILURE;
+
+    if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+        std::cerr << std::format("Cannot connect to `{}`: {}\n", path, std::strerror(errno));
+        close(fd);
+        return EXIT_FAILURE;
+    }
+
+    std::vector<std::string> response;
+    bool ok = send_strings(fd, request) && recv_strings(fd, response) && response.size() == 3;
+    close(fd);
+
+    if (!ok) {
+        std::cerr << "Compile server closed the connection\n";
+        return EXIT_FAILURE;
+    }
+
+    std::cerr << response[1];
+    if (response[0] != "1")
+        return EXIT_FAILURE;
+
+    // written next to the destination and renamed, a running `out` is never half written
+    fs::path tmp = output;
+    tmp += std::format(".tmp{}", getpid());
+
+    {
+        std::ofstream file(tmp, std::ios::binary | std::ios::trunc);
+        file.write(response[2].data(), response[2].size());
+
+        if (!file) {
+            std::cerr << std::format("Cannot write `{}`\n", tmp.string());
+            return EXIT_FAILURE;
+        }
+    }
+
+    chmod(tmp.c_str(), 0755);
+
+    std::error_code ec;
+    fs::rename(tmp, output, ec);
+    if (ec) {
+        std::cerr << std::format("Cannot write `{}`: {}\n", output.string(), ec.message());
+        fs::remove(tmp, ec);
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
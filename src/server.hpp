@@ -0,0 +1,31 @@
+#pragma once
+
+#include <string>
+
+#include "cache.hpp"
+#include "driver.hpp"
+#include "options.hpp"
+
+/*
+    Compile server protocol, both directions are a list of strings:
+        u32 count, then count times: u64 size, bytes
+
+    request:  gen options (as on the command line)..., source path, profile path, source
+              (the paths as the client sees them, `--profile-use=` made absolute)
+    response: "1" or "0" (ok), diagnostics, executable
+*/
+class Server {
+public:
+    Server(const Options& options, Cache& cache) : m_options(options), m_driver(options, cache) {}
+
+    int run();
+
+private:
+    void handle(int client);
+
+    const Options& m_options;
+    Driver m_driver;
+};
+
+std::string default_socket_path();
+int run_client(const Options& options);
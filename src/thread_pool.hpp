@@ -0,0 +1,128 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+    Work stealing pool: every worker owns a deque, takes its own tasks from
+    the back and steals from the front of the others when it runs dry.
+*/
+class ThreadPool {
+public:
+    explicit ThreadPool(size_t threads) {
+        if (threads == 0)
+            threads = 1;
+
+        for (size_t i = 0; i < threads; i++)
+            m_queues.push_back(std::make_unique<Queue>());
+
+        for (size_t i = 0; i < threads; i++)
+            m_threads.emplace_back(&ThreadPool::work, this, i);
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard lock(m_mutex);
+            m_stop = true;
+        }
+        m_wake.notify_all();
+
+        for (auto& thread: m_threads)
+            thread.join();
+    }
+
+    ThreadPool(ThreadPool& copy) = delete;
+    ThreadPool(ThreadPool&& copy) = delete;
+
+    void submit(std::function<void()> task) {
+        auto& queue = *m_queues[m_next++ % m_queues.size()];
+        {
+            std::lock_guard lock(queue.mutex);
+            queue.tasks.push_back(std::move(task));
+        }
+        {
+            std::lock_guard lock(m_mutex);
+            m_queued++;
+            m_pending++;
+        }
+        m_wake.notify_one();
+    }
+
+    void wait() {
+        std::unique_lock lock(m_mutex);
+        m_idle.wait(lock, [this] { return m_pending == 0; });
+    }
+
+    size_t size() const { return m_threads.size(); }
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    bool pop(size_t worker, std::function<void()>& task) {
+        {
+            auto& own = *m_queues[worker];
+            std::lock_guard lock(own.mutex);
+            if (!own.tasks.empty()) {
+                task = std::move(own.tasks.back());
+                own.tasks.pop_back();
+                return true;
+            }
+        }
+
+        for (size_t i = 1; i < m_queues.size(); i++) {
+            auto& victim = *m_queues[(worker + i) % m_queues.size()];
+            std::lock_guard lock(victim.mutex);
+            if (!victim.tasks.empty()) {
+                task = std::move(victim.tasks.front());
+                victim.tasks.pop_front();
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    void work(size_t worker) {
+        while (true) {
+            {
+                std::unique_lock lock(m_mutex);
+                m_wake.wait(lock, [this] { return m_stop || m_queued > 0; });
+
+                if (m_queued == 0)  // stopping and nothing left
+                    return;
+
+                m_queued--;  // reserve one of the queued tasks
+            }
+
+            std::function<void()> task;
+            while (!pop(worker, task)) {}  // the reserved task sits in some queue
+
+            task();
+
+            std::lock_guard lock(m_mutex);
+            if (--m_pending == 0)
+                m_idle.notify_all();
+        }
+    }
+
+    std::vector<std::unique_ptr<Queue>> m_queues;
+    std::vector<std::thread> m_threads;
+    std::atomic<size_t> m_next = 0;
+
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::condition_variable m_idle;
+    size_t m_queued = 0;   // tasks sitting in queues
+    size_t m_pending = 0;  // tasks not finished yet
+    bool m_stop = false;
+};
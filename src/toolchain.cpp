@@ -0,0 +1,119 @@
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <format>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "toolchain.hpp"
+
+extern char** environ;
+
+namespace fs = std::filesystem;
+
+Intermediates::Intermediates(const std::string& output, bool keep, const char* extension) {
+    if (keep) {
+        m_asm_path = output + extension;
+        m_obj_path = output + ".o";
+
+        m_asm_fd = open(m_asm_path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (m_asm_fd < 0)
+            throw std::runtime_error(std::format("Cannot write `{}`: {}", m_asm_path, std::strerror(errno)));
+        return;
+    }
+
+    std::string dir = (fs::temp_directory_path() / "tinyb-XXXXXX").string();
+    if (!mkdtemp(dir.data()))
+        throw std::runtime_error(std::format("Cannot create a temporary directory: {}", std::strerror(errno)));
+    m_dir = dir;
+    m_obj_path = (fs::path(dir) / "out.o").string();
+
+    // the assembler opens /dev/stdin, a new description of the memfd, reading it from the start
+    m_asm_path = "/dev/stdin";
+    m_asm_fd = memfd_create("tinyb.asm", MFD_CLOEXEC);
+    if (m_asm_fd >= 0)
+        return;
+
+    std::string file = (fs::path(dir) / "out").string() + extension;  // no memfd in this kernel
+    m_asm_fd = open(file.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (m_asm_fd < 0) {
+        std::string error = std::strerror(errno);
+        std::error_code ec;
+        fs::remove_all(m_dir, ec);
+        throw std::runtime_error(std::format("Cannot write `{}`: {}", file, error));
+    }
+}
+
+Intermediates::~Intermediates() {
+    if (m_asm_fd >= 0)
+        close(m_asm_fd);
+
+    if (!m_dir.empty()) {
+        std::error_code ec;
+        fs::remove_all(m_dir, ec);
+    }
+}
+
+int run_tool(const std::vector<std::string>& argv, int input_fd, std::string& output) {
+    int pipe_fds[2];
+    if (pipe2(pipe_fds, O_CLOEXEC) < 0) {
+        output += std::format("Cannot run `{}`: {}\n", argv.front(), std::strerror(errno));
+        return 127;
+    }
+
+    // the copies in the child lose O_CLOEXEC, nothing else of ours leaks into it
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    if (input_fd >= 0)
+        posix_spawn_file_actions_adddup2(&actions, input_fd, STDIN_FILENO);
+    else
+        posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+    posix_spawn_file_actions_adddup2(&actions, pipe_fds[1], STDOUT_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, pipe_fds[1], STDERR_FILENO);
+
+    std::vector<char*> args;
+    for (auto& arg: argv)
+        args.push_back(const_cast<char*>(arg.c_str()));
+    args.push_back(nullptr);
+
+    pid_t pid;
+    int error = posix_spawnp(&pid, args.front(), &actions, nullptr, args.data(), environ);
+    posix_spawn_file_actions_destroy(&actions);
+    close(pipe_fds[1]);
+
+    if (error) {
+        close(pipe_fds[0]);
+        output += std::format("Cannot run `{}`: {}\n", argv.front(), std::strerror(error));
+        return 127;
+    }
+
+    char buf[4096];
+    for (;;) {
+        ssize_t size = read(pipe_fds[0], buf, sizeof(buf));
+        if (size > 0)
+            output.append(buf, size);
+        else if (size == 0 || errno != EINTR)
+            break;
+    }
+    close(pipe_fds[0]);
+
+    int status;
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR) {
+            output += std::format("Lost `{}`: {}\n", argv.front(), std::strerror(errno));
+            return 127;
+        }
+    }
+
+    if (WIFSIGNALED(status))
+        return 128 + WTERMSIG(status);
+    return WEXITSTATUS(status);
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+/*
+    The files between the assembly and the executable of one compilation.
+    The assembly stays in memory, in a memfd the assembler reads as its
+    stdin, and the object goes into a directory of its own under $TMPDIR;
+    both are gone with the Intermediates. Kept, they are <output>.asm and
+    <output>.o next to the executable (<output>.c for the C of --emit=c).
+*/
+class Intermediates {
+public:
+    Intermediates(const std::string& output, bool keep, const char* extension = ".asm");  // throws std::runtime_error
+    ~Intermediates();
+
+    Intermediates(const Intermediates&) = delete;
+    Intermediates& operator=(const Intermediates&) = delete;
+
+    int asm_fd() const { return m_asm_fd; }  // written by the generator, read by the assembler
+    const std::string& asm_path() const { return m_asm_path; }  // what the assembler is told to open
+    const std::string& obj_path() const { return m_obj_path; }
+private:
+    int m_asm_fd = -1;
+    std::string m_asm_path;
+    std::string m_obj_path;
+    std::string m_dir;  // removed with everything in it, empty - nothing to remove
+};
+
+// Runs argv[0], found in PATH, without a shell, with `input_fd` (-1 - /dev/null) as its stdin and
+// stdout and stderr appended to `output`. The exit status, 128 + the signal that killed it, or
+// 127 when it couldn't be started (as a shell would), with the reason in `output`.
+int run_tool(const std::vector<std::string>& argv, int input_fd, std::string& output);